@@ -4,48 +4,205 @@
  * Target: GStreamer 1.28.0
  * 
  * Cross-platform instant replay system that:
- * - Ingests H.264 RTSP stream
+ * - Ingests H.264 RTSP streams from one or more cameras
  * - Stores in ring buffer (30-60 seconds)
  * - Outputs via RTSP with seeking support
+ * - Exports clips asynchronously on a bounded worker pool
+ * - Speed ramps with motion-compensated slow motion
  * - Hardware-accelerated encoding/decoding (NVIDIA/VAAPI with software fallback)
  */
 
 #include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/video/video.h>
+#include <gst/rtp/rtp.h>
 #include <gst/rtsp-server/rtsp-server.h>
 #include <iostream>
 #include <string>
 #include <cstring>
+#include <cstdlib>
+#include <cmath>
 #include <signal.h>
 #include <thread>
 #include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <set>
+#include <tuple>
+#include <vector>
 
 #ifdef _WIN32
 #include <windows.h>
 #else
+#include <errno.h>
+#include <glib-unix.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/tcp.h>
+#include <time.h>
 #include <unistd.h>
 #endif
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Camera input (one ingest branch and ring per camera)
+struct CameraConfig {
+    std::string id;
+    std::string rtsp_url;
+};
+
+// Lower rung of the /replay ladder (--ladder)
+struct LadderRung {
+    guint bitrate_kbps;
+    guint height;
+};
+
+// How speed ramps are rendered
+enum SpeedRampRender {
+    RAMP_RETIME,        // passthrough: frames keep their data and get new timestamps
+    RAMP_REPEAT,        // constant frame rate transcode, earlier frame repeated
+    RAMP_BLEND,         // constant frame rate transcode, neighbouring frames blended
+    RAMP_INTERPOLATE    // constant frame rate transcode, motion-compensated frames
+};
+
 // Configuration structure
 struct ReplayConfig {
-    std::string input_rtsp_url;
+    std::vector<CameraConfig> cameras;
     int buffer_seconds;
+    int ring_megabytes;
+    int scrub_cache_megabytes;              // decoded frames kept for scrubbing
+    int timecode_rate;                      // wall-clock timecode frame rate without timecode SEI
+    double stall_tolerance;                 // frame intervals of silence before a camera counts as stalled
+    int client_queue_kb;                    // per-client TCP send queue bound, bytes
+    int client_queue_ms;                    // per-client TCP send queue bound, RTP time
+    std::vector<LadderRung> ladder;         // lower rungs of the /replay mount, best first
+    double max_cpu_percent;                 // admission limit, share of all cores; 0 = none
+    double max_egress_mbps;                 // admission limit on sent RTSP data; 0 = none
+    int server_loops;                       // RTSP accept/handling loops sharing the port
+    std::string handoff_socket;             // Unix socket offering listeners and rings to an upgrade
+    std::string take_over_socket;           // take listeners and rings over from the process there
+    std::string config_file;                // key file of options, watched and reapplied
     int output_rtsp_port;
     bool use_hardware_accel;
     int gpu_id;
     std::string output_mount_point;
+    std::string replay_camera;              // camera the /replay mount serves; the first by default
+    std::string reel_mount_point;
+    std::string loop_mount_point;
+    std::string reverse_mount_point;
+    std::string scrub_mount_point;
+    SpeedRampRender ramp_render;            // speed ramps on the mounts
+    bool benchmark_interpolation;           // run the interpolation benchmark and exit
+    bool benchmark_egress;                  // run the TCP egress benchmark and exit
+    bool simulate_drift;                    // check the clock drift estimator and exit
+    int export_workers;
+    std::string export_directory;
     
     ReplayConfig() : 
         buffer_seconds(60),
+        ring_megabytes(256),
+        scrub_cache_megabytes(1024),
+        timecode_rate(25),
+        stall_tolerance(10.0),
+        client_queue_kb(4096),
+        client_queue_ms(2000),
+        max_cpu_percent(0),
+        max_egress_mbps(0),
+        server_loops(1),
         output_rtsp_port(8554),
         use_hardware_accel(true),
         gpu_id(0),
-        output_mount_point("/replay") {}
+        output_mount_point("/replay"),
+        reel_mount_point("/highlights"),
+        loop_mount_point("/loop"),
+        reverse_mount_point("/reverse"),
+        scrub_mount_point("/scrub"),
+        ramp_render(RAMP_RETIME),
+        benchmark_interpolation(false),
+        benchmark_egress(false),
+        simulate_drift(false),
+        export_workers(0),
+        export_directory(g_get_tmp_dir()) {}
 };
 
 // Global pipeline and loop
 static GMainLoop *main_loop = nullptr;
 static GstElement *pipeline = nullptr;
 static volatile sig_atomic_t shutdown_requested = 0;
+static bool ingest_released = false;   // rings handed to a successor, ingest stopped (main loop only)
+
+// Metrics
+//
+// Process-wide counters and gauges keyed by name and label set, e.g.
+// ("ingest_stalls_total", "camera=\"left\""). The `metrics` command prints
+// them in Prometheus text format.
+class MetricsRegistry {
+public:
+    void add(const std::string &name, const std::string &labels, gint64 delta = 1) {
+        std::lock_guard<std::mutex> guard(lock);
+        values[Key(name, labels)] += delta;
+    }
+    
+    void set(const std::string &name, const std::string &labels, gint64 value) {
+        std::lock_guard<std::mutex> guard(lock);
+        values[Key(name, labels)] = value;
+    }
+    
+    // Forget every series with exactly this label set
+    void remove(const std::string &labels) {
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto it = values.begin(); it != values.end();) {
+            if (it->first.second == labels) {
+                it = values.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    
+    std::string render() {
+        std::lock_guard<std::mutex> guard(lock);
+        std::string text;
+        for (const auto &entry : values) {
+            gchar *line = g_strdup_printf("%s{%s} %" G_GINT64_FORMAT "\n", entry.first.first.c_str(),
+                                          entry.first.second.c_str(), entry.second);
+            text += line;
+            g_free(line);
+        }
+        return text;
+    }
+
+private:
+    typedef std::pair<std::string, std::string> Key;
+    
+    std::mutex lock;
+    std::map<Key, gint64> values;
+};
+
+static MetricsRegistry metrics;
+
+static std::string camera_label(const std::string &camera_id) {
+    return "camera=\"" + camera_id + "\"";
+}
 
 // Hardware acceleration detection
 enum HWAccelType {
@@ -106,254 +263,7982 @@ const char* get_encoder_element(HWAccelType hw_type) {
     }
 }
 
-// Signal handler for graceful shutdown
-void signal_handler(int signum) {
-    g_print("\nReceived signal %d, shutting down...\n", signum);
-    shutdown_requested = 1;
-    if (main_loop) {
-        g_main_loop_quit(main_loop);
-    }
-}
+// Hardware path chosen at startup, used by clip rendering off the main thread
+static HWAccelType replay_hw_type = HW_ACCEL_NONE;
 
-// Bus message callback
-static gboolean bus_callback(GstBus *bus, GstMessage *message, gpointer user_data) {
-    switch (GST_MESSAGE_TYPE(message)) {
-        case GST_MESSAGE_ERROR: {
-            GError *err;
-            gchar *debug_info;
-            gst_message_parse_error(message, &err, &debug_info);
-            g_printerr("ERROR from element %s: %s\n", 
-                      GST_OBJECT_NAME(message->src), err->message);
-            g_printerr("Debugging info: %s\n", debug_info ? debug_info : "none");
-            g_error_free(err);
-            g_free(debug_info);
-            g_main_loop_quit(main_loop);
+// Configure an H.264 encoder for rendering: given bitrate, keyframes
+// every `keyframe_interval` frames (or when forced) and no B-frames, so
+// output DTS equals PTS
+void configure_encoder(GstElement *encoder, HWAccelType hw_type, guint bitrate_kbps, guint keyframe_interval) {
+    switch (hw_type) {
+        case HW_ACCEL_NVIDIA:
+            g_object_set(G_OBJECT(encoder),
+                         "bitrate", bitrate_kbps,
+                         "gop-size", (gint)keyframe_interval,
+                         "bframes", 0u,
+                         NULL);
             break;
-        }
-        case GST_MESSAGE_WARNING: {
-            GError *err;
-            gchar *debug_info;
-            gst_message_parse_warning(message, &err, &debug_info);
-            g_printerr("WARNING from element %s: %s\n", 
-                      GST_OBJECT_NAME(message->src), err->message);
-            g_printerr("Debugging info: %s\n", debug_info ? debug_info : "none");
-            g_error_free(err);
-            g_free(debug_info);
+        case HW_ACCEL_VAAPI:
+            g_object_set(G_OBJECT(encoder),
+                         "bitrate", bitrate_kbps,
+                         "keyframe-period", keyframe_interval,
+                         "max-bframes", 0u,
+                         NULL);
             break;
-        }
-        case GST_MESSAGE_EOS:
-            g_print("End-Of-Stream reached.\n");
-            g_main_loop_quit(main_loop);
+        case HW_ACCEL_MSDK:
+            g_object_set(G_OBJECT(encoder),
+                         "bitrate", bitrate_kbps,
+                         "gop-size", keyframe_interval,
+                         "b-frames", 0u,
+                         NULL);
             break;
-        case GST_MESSAGE_STATE_CHANGED: {
-            if (GST_MESSAGE_SRC(message) == GST_OBJECT(pipeline)) {
-                GstState old_state, new_state, pending_state;
-                gst_message_parse_state_changed(message, &old_state, &new_state, &pending_state);
-                g_print("Pipeline state changed from %s to %s\n",
-                       gst_element_state_get_name(old_state),
-                       gst_element_state_get_name(new_state));
-            }
+        default:
+            g_object_set(G_OBJECT(encoder),
+                         "bitrate", bitrate_kbps,
+                         "key-int-max", keyframe_interval,
+                         "bframes", 0u,
+                         NULL);
+            gst_util_set_object_arg(G_OBJECT(encoder), "tune", "zerolatency");
+            gst_util_set_object_arg(G_OBJECT(encoder), "speed-preset", "veryfast");
             break;
+    }
+}
+
+GstElement* make_encoder(HWAccelType hw_type, guint bitrate_kbps, guint keyframe_interval,
+                         const char *name) {
+    GstElement *encoder = gst_element_factory_make(get_encoder_element(hw_type), name);
+    if (encoder) {
+        configure_encoder(encoder, hw_type, bitrate_kbps, keyframe_interval);
+    }
+    return encoder;
+}
+
+// Shared replay timeline in microseconds. Wall clock at startup plus the
+// monotonic clock since, so it never steps backwards when NTP adjusts the
+// system time and every camera ring is stamped on the same axis.
+static gint64 timeline_now_us() {
+    static const gint64 monotonic_anchor = g_get_monotonic_time();
+    static const gint64 wall_anchor = g_get_real_time();
+    return wall_anchor + (g_get_monotonic_time() - monotonic_anchor);
+}
+
+// SMPTE timecode, packed one field per byte (hours in the top byte) so
+// packed values compare in time order
+static const guint32 NO_TIMECODE = G_MAXUINT32;
+
+static guint32 pack_timecode(guint hours, guint minutes, guint seconds, guint frames) {
+    return (hours << 24) | (minutes << 16) | (seconds << 8) | frames;
+}
+
+static std::string format_timecode(guint32 timecode) {
+    if (timecode == NO_TIMECODE) {
+        return "--:--:--:--";
+    }
+    gchar *text = g_strdup_printf("%02u:%02u:%02u:%02u", timecode >> 24, (timecode >> 16) & 0xff,
+                                  (timecode >> 8) & 0xff, timecode & 0xff);
+    std::string result(text);
+    g_free(text);
+    return result;
+}
+
+// "HH:MM:SS:FF" (or "HH:MM:SS;FF" for drop-frame)
+static bool parse_timecode(const std::string &text, guint32 &timecode) {
+    guint hours, minutes, seconds, frames;
+    char separator;
+    int consumed = 0;
+    if (sscanf(text.c_str(), "%2u:%2u:%2u%c%2u%n", &hours, &minutes, &seconds, &separator,
+               &frames, &consumed) != 5 || (size_t)consumed != text.size() ||
+        (separator != ':' && separator != ';') || hours > 23 || minutes > 59 || seconds > 59) {
+        return false;
+    }
+    timecode = pack_timecode(hours, minutes, seconds, frames);
+    return true;
+}
+
+// Capture time travels with ring buffers as an NTP reference timestamp
+// meta, the form rtphdrextntp64 writes into the RTP header extension
+static const guint64 NTP_UNIX_OFFSET_SECONDS = 2208988800ULL;
+
+static GstCaps* ntp_reference_caps() {
+    static GstCaps *caps = gst_caps_new_empty_simple("timestamp/x-ntp");
+    return caps;
+}
+
+static void set_capture_time(GstBuffer *buffer, gint64 capture_time_us) {
+    GstClockTime ntp = (GstClockTime)capture_time_us * GST_USECOND + NTP_UNIX_OFFSET_SECONDS * GST_SECOND;
+    gst_buffer_add_reference_timestamp_meta(buffer, ntp_reference_caps(), ntp, GST_CLOCK_TIME_NONE);
+}
+
+// Capture time (Unix microseconds) of a buffer that came out of a ring,
+// or -1
+static gint64 get_capture_time(GstBuffer *buffer) {
+    GstReferenceTimestampMeta *meta = gst_buffer_get_reference_timestamp_meta(buffer, ntp_reference_caps());
+    if (!meta || meta->timestamp < NTP_UNIX_OFFSET_SECONDS * GST_SECOND) {
+        return -1;
+    }
+    return (gint64)((meta->timestamp - NTP_UNIX_OFFSET_SECONDS * GST_SECOND) / GST_USECOND);
+}
+
+// Frame ring
+//
+// Per-camera store of parsed H.264 access units (byte-stream, one AU per
+// entry). A fixed index of frame descriptors plus a byte arena, both
+// addressed by monotonically increasing counters. There is exactly one
+// writer (the camera's appsink streaming thread, in the process holding
+// the ring's writer token); readers never take a lock and instead validate
+// that what they copied was not overwritten.
+// The layout is plain data so the same storage can be placed in shared
+// memory: with --handoff-socket each ring lives in a memfd that an upgraded
+// process maps and continues writing (see Upgrade handoff).
+
+enum RingFrameFlags {
+    RING_FRAME_KEYFRAME = 1 << 0,           // random access point: IDR or recovery point SEI
+    RING_FRAME_RECOVERY_POINT = 1 << 1,     // random access point without an IDR
+    RING_FRAME_REFRESHING = 1 << 2,         // not clean yet when decoding starts at gop_seq
+    RING_FRAME_DISPOSABLE = 1 << 3,         // nal_ref_idc 0: no other frame references it
+    RING_FRAME_METADATA_KLV = 1 << 4,       // metadata ring entry: SMPTE 336M KLV packet
+    RING_FRAME_METADATA_ONVIF = 1 << 5      // metadata ring entry: ONVIF metadata XML
+};
+
+struct RingFrame {
+    guint64 seq;              // monotonic frame number
+    guint64 gop_seq;          // seq of the random access point this frame decodes from
+    guint64 clean_seq;        // newest random access point it decodes cleanly from (G_MAXUINT64: none)
+    guint64 data_offset;      // monotonic byte offset into the data arena
+    guint32 size;
+    guint32 flags;            // RingFrameFlags
+    GstClockTime pts;
+    GstClockTime dts;
+    GstClockTime duration;
+    gint64 capture_time_us;   // position on the shared replay timeline
+    guint32 timecode;         // SMPTE timecode of the picture, packed (NO_TIMECODE if unknown)
+    guint64 metadata_seq;     // head of the camera's metadata ring when this frame was written
+};
+
+struct RingSlot {
+    std::atomic<guint64> version;   // seqlock: odd while the writer updates the slot
+    RingFrame frame;
+};
+
+struct RingHeader {
+    guint32 magic;
+    guint32 layout_version;               // RING_LAYOUT_VERSION of the build that created it
+    guint32 frame_size;
+    guint64 index_capacity;
+    guint64 data_capacity;
+    gint64 window_us;
+    guint64 writer_gop_seq;               // writer only
+    std::atomic<guint64> head_seq;        // next seq to be written
+    std::atomic<guint64> tail_seq;        // oldest readable seq
+    std::atomic<guint64> data_head;       // end of published bytes
+    std::atomic<guint64> data_reserved;   // end of bytes being written
+    std::atomic<guint32> writer;          // writer token: id of the writing process, | RING_WRITER_BUSY in push
+};
+
+static const guint32 RING_MAGIC = 0x52504c59; // "RPLY"
+// Bump on any change to RingHeader, RingSlot or RingFrame, including ones
+// that keep their sizes: a successor only adopts rings of its own layout
+static const guint32 RING_LAYOUT_VERSION = 1;
+static const guint32 RING_WRITER_BUSY = 0x80000000u;
+
+static guint32 ring_writer_id() {
+#ifdef _WIN32
+    return (guint32)GetCurrentProcessId();
+#else
+    return (guint32)getpid();
+#endif
+}
+
+class FrameRing {
+public:
+    // With `shared_name` the storage is a memfd a successor can map
+    // (Linux); otherwise, or if that fails, plain heap memory
+    FrameRing(guint64 index_capacity, guint64 data_capacity, GstClockTime window,
+              const char *shared_name = nullptr)
+        : storage(nullptr), storage_bytes(storage_size(index_capacity, data_capacity)), fd(-1),
+          writer_id(ring_writer_id()) {
+        if (shared_name) {
+            storage = map_shared(shared_name, storage_bytes, fd);
         }
-        case GST_MESSAGE_BUFFERING: {
-            gint percent = 0;
-            gst_message_parse_buffering(message, &percent);
-            g_print("Buffering: %d%%\r", percent);
-            if (percent < 100) {
-                gst_element_set_state(pipeline, GST_STATE_PAUSED);
-            } else {
-                gst_element_set_state(pipeline, GST_STATE_PLAYING);
-            }
-            break;
+        if (!storage) {
+            storage = g_malloc0(storage_bytes);
         }
-        case GST_MESSAGE_ELEMENT: {
-            const GstStructure *s = gst_message_get_structure(message);
-            const gchar *name = gst_structure_get_name(s);
-            if (g_str_has_prefix(name, "GstBin")) {
-                // Handle bin messages if needed
+        attach(storage, index_capacity, data_capacity, window);
+        header->writer.store(writer_id, std::memory_order_release);
+    }
+
+    ~FrameRing() {
+        if (fd >= 0) {
+#ifdef __linux__
+            munmap(storage, storage_bytes);
+            close(fd);
+#endif
+        } else {
+            g_free(storage);
+        }
+    }
+    
+    // Map a ring another process created with `shared_name`, taking over
+    // `memfd`. Null (and the fd closed) unless its layout and capacities
+    // match this build and configuration. The writer token stays with the
+    // other process until take_writer().
+    static FrameRing* adopt(int memfd, guint64 index_capacity, guint64 data_capacity) {
+#ifdef __linux__
+        gsize bytes = storage_size(index_capacity, data_capacity);
+        struct stat info;
+        void *memory = MAP_FAILED;
+        if (fstat(memfd, &info) == 0 && (gsize)info.st_size == bytes) {
+            memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+        }
+        if (memory != MAP_FAILED) {
+            const RingHeader *existing = static_cast<const RingHeader *>(memory);
+            if (existing->magic == RING_MAGIC && existing->layout_version == RING_LAYOUT_VERSION &&
+                existing->frame_size == sizeof(RingFrame) &&
+                existing->index_capacity == index_capacity && existing->data_capacity == data_capacity) {
+                FrameRing *ring = new FrameRing(memory, bytes, memfd);
+                ring->layout(memory, index_capacity);
+                return ring;
             }
-            break;
+            munmap(memory, bytes);
         }
-        default:
-            break;
+        close(memfd);
+#endif
+        return nullptr;
     }
-    return TRUE;
-}
-
-// Pad added callback for dynamic pads (rtspsrc)
-static void on_pad_added(GstElement *element, GstPad *pad, gpointer data) {
-    GstElement *depay = GST_ELEMENT(data);
-    GstPad *sinkpad = gst_element_get_static_pad(depay, "sink");
     
-    GstCaps *caps = gst_pad_get_current_caps(pad);
-    if (!caps) {
-        caps = gst_pad_query_caps(pad, NULL);
+    // Take the writer token back from a process that has exited, whatever
+    // state it left the token in
+    void reclaim_writer() {
+        header->writer.store(writer_id, std::memory_order_release);
     }
     
-    gchar *caps_str = gst_caps_to_string(caps);
-    g_print("Received new pad '%s' from '%s' with caps: %s\n",
-           GST_PAD_NAME(pad), GST_ELEMENT_NAME(element), caps_str);
-    g_free(caps_str);
+    // memfd backing the ring, -1 for heap rings
+    int shared_fd() const { return fd; }
     
-    // Only link if it's H.264 video
-    GstStructure *structure = gst_caps_get_structure(caps, 0);
-    const gchar *media = gst_structure_get_string(structure, "media");
-    const gchar *encoding = gst_structure_get_string(structure, "encoding-name");
+    bool owns_writer() const {
+        return (header->writer.load(std::memory_order_acquire) & ~RING_WRITER_BUSY) == writer_id;
+    }
     
-    if (media && encoding && 
-        g_strcmp0(media, "video") == 0 && 
-        g_strcmp0(encoding, "H264") == 0) {
+    // Take the writer token from whichever process holds it, once that
+    // process is between pushes; its next push then fails
+    bool take_writer() {
+        guint32 current = header->writer.load(std::memory_order_acquire);
+        if (current & RING_WRITER_BUSY) {
+            return false;
+        }
+        return current == writer_id ||
+               header->writer.compare_exchange_strong(current, writer_id, std::memory_order_acq_rel);
+    }
+
+    FrameRing(const FrameRing &) = delete;
+    FrameRing &operator=(const FrameRing &) = delete;
+
+    static gsize storage_size(guint64 index_capacity, guint64 data_capacity) {
+        return sizeof(RingHeader) + index_capacity * sizeof(RingSlot) + data_capacity;
+    }
+
+    guint64 head() const { return header->head_seq.load(std::memory_order_acquire); }
+    guint64 tail() const { return header->tail_seq.load(std::memory_order_acquire); }
+
+    // Append one access unit. Called from the camera's streaming thread only;
+    // fails once another process has taken the writer token.
+    bool push(const guint8 *bytes, gsize size, GstClockTime pts, GstClockTime dts,
+              GstClockTime duration, gint64 capture_time_us, guint32 flags,
+              guint32 timecode = NO_TIMECODE, guint64 metadata_seq = 0,
+              guint64 clean_seq = G_MAXUINT64) {
+        if (size == 0 || size > header->data_capacity) {
+            return false;
+        }
+        guint32 owner = writer_id;
+        if (!header->writer.compare_exchange_strong(owner, writer_id | RING_WRITER_BUSY, std::memory_order_acquire)) {
+            return false;
+        }
+        bool written = append(bytes, size, pts, dts, duration, capture_time_us, flags, timecode,
+                              metadata_seq, clean_seq);
+        header->writer.store(writer_id, std::memory_order_release);
+        return written;
+    }
+
+    // Copy the descriptor of frame `seq`. Fails if it is not (or no longer) buffered.
+    bool read_frame(guint64 seq, RingFrame &frame) const {
+        if (seq < tail() || seq >= head()) {
+            return false;
+        }
+        const RingSlot &slot = slots[seq % header->index_capacity];
+        for (int attempt = 0; attempt < 4; attempt++) {
+            guint64 before = slot.version.load(std::memory_order_acquire);
+            if (before & 1) {
+                continue;
+            }
+            frame = slot.frame;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.version.load(std::memory_order_relaxed) == before) {
+                return frame.seq == seq;
+            }
+        }
+        return false;
+    }
+
+    // Copy the access unit out of the arena into a new buffer carrying the
+    // frame's timestamps. Returns nullptr if the bytes were overwritten.
+    GstBuffer* read_buffer(const RingFrame &frame) const {
+        GstBuffer *buffer = gst_buffer_new_allocate(NULL, frame.size, NULL);
+        GstMapInfo map;
+        if (!gst_buffer_map(buffer, &map, GST_MAP_WRITE)) {
+            gst_buffer_unref(buffer);
+            return nullptr;
+        }
+        copy_out(frame.data_offset, map.data, frame.size);
+        gst_buffer_unmap(buffer, &map);
         
-        if (!gst_pad_is_linked(sinkpad)) {
-            GstPadLinkReturn ret = gst_pad_link(pad, sinkpad);
-            if (GST_PAD_LINK_FAILED(ret)) {
-                g_printerr("Failed to link pads: %d\n", ret);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        guint64 reserved = header->data_reserved.load(std::memory_order_acquire);
+        if (reserved - frame.data_offset > header->data_capacity) {
+            gst_buffer_unref(buffer);
+            return nullptr;
+        }
+        
+        GST_BUFFER_PTS(buffer) = frame.pts;
+        GST_BUFFER_DTS(buffer) = frame.dts;
+        GST_BUFFER_DURATION(buffer) = frame.duration;
+        if (!(frame.flags & RING_FRAME_KEYFRAME)) {
+            GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+        }
+        if (frame.flags & RING_FRAME_DISPOSABLE) {
+            GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DROPPABLE);
+        }
+        set_capture_time(buffer, frame.capture_time_us);
+        return buffer;
+    }
+
+    // First buffered seq whose capture time is after `capture_time_us`
+    // (head() if none). Binary search over the index.
+    guint64 find_frame_after(gint64 capture_time_us) const {
+        guint64 lo = tail();
+        guint64 hi = head();
+        while (lo < hi) {
+            guint64 mid = lo + (hi - lo) / 2;
+            RingFrame frame;
+            if (!read_frame(mid, frame) || frame.capture_time_us <= capture_time_us) {
+                lo = mid + 1;
             } else {
-                g_print("✓ Successfully linked RTSP source to depayloader\n");
+                hi = mid;
             }
         }
+        return lo;
     }
-    
-    gst_caps_unref(caps);
-    gst_object_unref(sinkpad);
-}
 
-// Create the input pipeline for ring buffer
-GstElement* create_input_pipeline(const ReplayConfig &config, HWAccelType hw_type) {
-    GstElement *pipeline_elem = gst_pipeline_new("input-pipeline");
-    if (!pipeline_elem) {
-        g_printerr("Failed to create input pipeline\n");
+    // First buffered random access point at or after `seq` (head() if none).
+    guint64 find_random_access_from(guint64 seq) const {
+        guint64 end = head();
+        for (seq = std::max(seq, tail()); seq < end; seq++) {
+            RingFrame frame;
+            if (read_frame(seq, frame) && frame.gop_seq == seq) {
+                return seq;
+            }
+        }
+        return end;
+    }
+
+    // Random access point of the GOP before the one starting at `gop_seq`
+    // (G_MAXUINT64 once that GOP is no longer fully buffered)
+    guint64 previous_random_access(guint64 gop_seq) const {
+        RingFrame frame;
+        if (gop_seq == 0 || !read_frame(gop_seq - 1, frame) || frame.gop_seq < tail()) {
+            return G_MAXUINT64;
+        }
+        return frame.gop_seq;
+    }
+
+    // Random access point to decode from so that frame `seq` and every
+    // frame after it come out clean: its own GOP's, or with intra refresh
+    // the newest earlier one whose refresh had completed by `seq`.
+    // G_MAXUINT64 if that point is no longer (or was never) buffered.
+    guint64 clean_decode_start(guint64 seq) const {
+        RingFrame frame;
+        if (!read_frame(seq, frame) || frame.clean_seq > seq || frame.clean_seq < tail()) {
+            return G_MAXUINT64;
+        }
+        return frame.clean_seq;
+    }
+
+    // Timeline position of the frame stamped `timecode`. Timecode rises
+    // with seq apart from B-frame reordering, so a binary search over the
+    // index lands next to it; the frames around it give the
+    // stream-to-timeline offset, as for frame-accurate cuts.
+    bool find_timecode(guint32 timecode, gint64 &time_us) const {
+        guint64 lo = tail();
+        guint64 hi = head();
+        while (lo < hi) {
+            guint64 mid = lo + (hi - lo) / 2;
+            RingFrame frame;
+            if (!read_frame(mid, frame) || frame.timecode < timecode) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        
+        const guint64 reorder_window = 16;
+        guint64 end = std::min(lo + reorder_window, head());
+        GstClockTimeDiff offset = G_MAXINT64;
+        RingFrame match;
+        bool found = false;
+        for (guint64 seq = std::max(lo > reorder_window ? lo - reorder_window : 0, tail()); seq < end; seq++) {
+            RingFrame frame;
+            if (!read_frame(seq, frame)) {
+                continue;
+            }
+            if (GST_CLOCK_TIME_IS_VALID(frame.pts)) {
+                offset = std::min<GstClockTimeDiff>(offset,
+                    frame.capture_time_us * (gint64)GST_USECOND - (GstClockTimeDiff)frame.pts);
+            }
+            if (!found && frame.timecode == timecode) {
+                match = frame;
+                found = true;
+            }
+        }
+        if (!found) {
+            return false;
+        }
+        time_us = GST_CLOCK_TIME_IS_VALID(match.pts) && offset != G_MAXINT64 ?
+                  ((gint64)match.pts + offset) / (gint64)GST_USECOND : match.capture_time_us;
+        return true;
+    }
+
+    // Resolve a timeline range to [first_seq, end_seq) starting on the
+    // random access point that covers `start_us`.
+    bool resolve_range(gint64 start_us, gint64 end_us, guint64 &first_seq, guint64 &end_seq) const {
+        if (end_us <= start_us) {
+            return false;
+        }
+        guint64 start_seq = find_frame_after(start_us - 1);
+        end_seq = find_frame_after(end_us);
+        if (start_seq >= end_seq) {
+            return false;
+        }
+        
+        RingFrame frame;
+        if (!read_frame(start_seq, frame)) {
+            return false;
+        }
+        first_seq = frame.gop_seq;
+        if (first_seq < tail()) {
+            // The head of this GOP already aged out; start on the next one.
+            first_seq = find_random_access_from(start_seq);
+        }
+        return first_seq < end_seq;
+    }
+
+private:
+    FrameRing(void *memory, gsize bytes, int memfd)
+        : storage(memory), storage_bytes(bytes), fd(memfd), writer_id(ring_writer_id()) {}
+    
+    // Zeroed shared storage of `bytes`, or null
+    static void* map_shared(const char *name, gsize bytes, int &memfd) {
+#ifdef __linux__
+        memfd = memfd_create(name, MFD_CLOEXEC);
+        if (memfd >= 0 && ftruncate(memfd, (off_t)bytes) == 0) {
+            void *memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+            if (memory != MAP_FAILED) {
+                return memory;
+            }
+        }
+        g_printerr("Cannot place ring %s in shared memory: %s\n", name, g_strerror(errno));
+        if (memfd >= 0) {
+            close(memfd);
+        }
+#endif
+        memfd = -1;
         return nullptr;
     }
     
-    // Create elements
-    GstElement *rtspsrc = gst_element_factory_make("rtspsrc", "source");
-    GstElement *depay = gst_element_factory_make("rtph264depay", "depay");
-    GstElement *parse = gst_element_factory_make("h264parse", "parse");
-    GstElement *queue_buffer = gst_element_factory_make("queue2", "ring-buffer");
-    GstElement *filesink = gst_element_factory_make("filesink", "output");
+    // push() with the writer token held
+    bool append(const guint8 *bytes, gsize size, GstClockTime pts, GstClockTime dts,
+                GstClockTime duration, gint64 capture_time_us, guint32 flags,
+                guint32 timecode, guint64 metadata_seq, guint64 clean_seq) {
+        guint64 seq = header->head_seq.load(std::memory_order_relaxed);
+        if (flags & RING_FRAME_KEYFRAME) {
+            header->writer_gop_seq = seq;
+        } else if (header->writer_gop_seq == G_MAXUINT64) {
+            return false; // nothing is decodable before the first random access point
+        }
+        
+        make_room(size, capture_time_us);
+        
+        guint64 offset = header->data_head.load(std::memory_order_relaxed);
+        header->data_reserved.store(offset + size, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_release);
+        copy_in(offset, bytes, size);
+        
+        RingSlot &slot = slots[seq % header->index_capacity];
+        guint64 version = slot.version.load(std::memory_order_relaxed);
+        slot.version.store(version + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.frame.seq = seq;
+        slot.frame.gop_seq = header->writer_gop_seq;
+        slot.frame.clean_seq = clean_seq;
+        slot.frame.data_offset = offset;
+        slot.frame.size = (guint32)size;
+        slot.frame.flags = flags;
+        slot.frame.pts = pts;
+        slot.frame.dts = dts;
+        slot.frame.duration = duration;
+        slot.frame.capture_time_us = capture_time_us;
+        slot.frame.timecode = timecode;
+        slot.frame.metadata_seq = metadata_seq;
+        slot.version.store(version + 2, std::memory_order_release);
+        
+        header->data_head.store(offset + size, std::memory_order_release);
+        header->head_seq.store(seq + 1, std::memory_order_release);
+        return true;
+    }
+
+    void attach(void *memory, guint64 index_capacity, guint64 data_capacity, GstClockTime window) {
+        guint8 *base = static_cast<guint8 *>(memory);
+        header = new (base) RingHeader();
+        header->magic = RING_MAGIC;
+        header->layout_version = RING_LAYOUT_VERSION;
+        header->frame_size = sizeof(RingFrame);
+        header->index_capacity = index_capacity;
+        header->data_capacity = data_capacity;
+        header->window_us = (gint64)(window / GST_USECOND);
+        header->writer_gop_seq = G_MAXUINT64;
+        layout(memory, index_capacity);
+        for (guint64 i = 0; i < index_capacity; i++) {
+            new (&slots[i]) RingSlot();
+        }
+    }
     
-    if (!rtspsrc || !depay || !parse || !queue_buffer || !filesink) {
-        g_printerr("Failed to create pipeline elements\n");
-        if (rtspsrc) gst_object_unref(rtspsrc);
-        if (depay) gst_object_unref(depay);
-        if (parse) gst_object_unref(parse);
-        if (queue_buffer) gst_object_unref(queue_buffer);
-        if (filesink) gst_object_unref(filesink);
-        gst_object_unref(pipeline_elem);
-        return nullptr;
+    void layout(void *memory, guint64 index_capacity) {
+        guint8 *base = static_cast<guint8 *>(memory);
+        header = reinterpret_cast<RingHeader *>(base);
+        slots = reinterpret_cast<RingSlot *>(base + sizeof(RingHeader));
+        data = base + sizeof(RingHeader) + index_capacity * sizeof(RingSlot);
+    }
+
+    // Advance the tail past frames that are too old or whose slot/bytes the
+    // next write would reuse.
+    void make_room(gsize size, gint64 newest_capture_us) {
+        guint64 head_seq = header->head_seq.load(std::memory_order_relaxed);
+        guint64 tail_seq = header->tail_seq.load(std::memory_order_relaxed);
+        guint64 data_end = header->data_head.load(std::memory_order_relaxed) + size;
+        while (tail_seq < head_seq) {
+            const RingFrame &oldest = slots[tail_seq % header->index_capacity].frame;
+            bool index_full = head_seq - tail_seq >= header->index_capacity;
+            bool data_full = data_end - oldest.data_offset > header->data_capacity;
+            bool expired = header->window_us > 0 &&
+                           newest_capture_us - oldest.capture_time_us > header->window_us;
+            if (!index_full && !data_full && !expired) {
+                break;
+            }
+            tail_seq++;
+        }
+        header->tail_seq.store(tail_seq, std::memory_order_release);
+    }
+
+    void copy_in(guint64 offset, const guint8 *bytes, gsize size) {
+        gsize pos = offset % header->data_capacity;
+        gsize first = std::min<gsize>(size, header->data_capacity - pos);
+        memcpy(data + pos, bytes, first);
+        memcpy(data, bytes + first, size - first);
+    }
+
+    void copy_out(guint64 offset, guint8 *bytes, gsize size) const {
+        gsize pos = offset % header->data_capacity;
+        gsize first = std::min<gsize>(size, header->data_capacity - pos);
+        memcpy(bytes, data + pos, first);
+        memcpy(bytes + first, data, size - first);
+    }
+
+    void *storage;
+    gsize storage_bytes;
+    int fd;
+    guint32 writer_id;
+    RingHeader *header;
+    RingSlot *slots;
+    guint8 *data;
+};
+
+// H.264 byte-stream helpers
+enum H264NalType {
+    H264_NAL_SLICE = 1,
+    H264_NAL_IDR = 5,
+    H264_NAL_SEI = 6,
+    H264_NAL_SPS = 7,
+    H264_NAL_PPS = 8,
+    H264_NAL_AUD = 9
+};
+
+// Call `visit(type, nal, size)` for each NAL unit of a byte-stream access
+// unit; `nal` points at the NAL header. Stops early when visit returns false.
+template <typename Visitor>
+static void for_each_nal(const guint8 *data, gsize size, Visitor visit) {
+    auto find_start_code = [&](gsize from) -> gsize {
+        for (gsize i = from; i + 3 <= size; i++) {
+            if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+                return i;
+            }
+        }
+        return size;
+    };
+    
+    gsize start_code = find_start_code(0);
+    while (start_code < size) {
+        gsize begin = start_code + 3;
+        gsize next = find_start_code(begin);
+        gsize end = next;
+        while (end > begin && data[end - 1] == 0) {
+            end--; // trailing zeros belong to the next 4-byte start code
+        }
+        if (end > begin && !visit(data[begin] & 0x1f, data + begin, end - begin)) {
+            return;
+        }
+        start_code = next;
+    }
+}
+
+// SPS and PPS NAL units of an access unit, start codes included
+static std::string h264_parameter_sets(const guint8 *data, gsize size) {
+    static const guint8 start_code[] = { 0, 0, 0, 1 };
+    std::string result;
+    for_each_nal(data, size, [&](guint type, const guint8 *nal, gsize nal_size) {
+        if (type == H264_NAL_SPS || type == H264_NAL_PPS) {
+            result.append(reinterpret_cast<const char *>(start_code), sizeof(start_code));
+            result.append(reinterpret_cast<const char *>(nal), nal_size);
+        }
+        return type != H264_NAL_IDR && type != H264_NAL_SLICE;
+    });
+    return result;
+}
+
+// Unsigned Exp-Golomb and fixed-width reads over a NAL payload with the
+// emulation prevention bytes removed. Reads past the end return zeros.
+class RbspReader {
+public:
+    RbspReader(const guint8 *nal, gsize size) : bit(0) {
+        for (gsize i = 0; i < size; i++) {
+            if (i >= 2 && nal[i] == 3 && nal[i - 1] == 0 && nal[i - 2] == 0) {
+                continue;
+            }
+            bytes.push_back(nal[i]);
+        }
+    }
+    
+    guint32 bits(guint count) {
+        guint32 value = 0;
+        for (guint i = 0; i < count; i++, bit++) {
+            guint8 byte = bit / 8 < bytes.size() ? bytes[bit / 8] : 0;
+            value = (value << 1) | ((byte >> (7 - bit % 8)) & 1);
+        }
+        return value;
+    }
+    
+    guint32 ue() {
+        guint zeros = 0;
+        while (zeros < 32 && !more_bits_exhausted() && bits(1) == 0) {
+            zeros++;
+        }
+        return zeros == 0 ? 0 : ((1u << zeros) - 1) + bits(zeros);
+    }
+    
+    gint32 se() {
+        guint32 code = ue();
+        return (code & 1) ? (gint32)((code + 1) / 2) : -(gint32)(code / 2);
+    }
+    
+    bool exhausted() const { return bit > bytes.size() * 8; }
+    const std::vector<guint8>& data() const { return bytes; }
+
+private:
+    bool more_bits_exhausted() const { return bit >= bytes.size() * 8; }
+    
+    std::vector<guint8> bytes;
+    gsize bit;
+};
+
+static const guint H264_SEI_PIC_TIMING = 1;
+static const guint H264_SEI_RECOVERY_POINT = 6;
+
+// recovery_frame_cnt of the access unit's recovery point SEI, or -1
+static gint h264_recovery_frame_count(const guint8 *data, gsize size) {
+    gint count = -1;
+    for_each_nal(data, size, [&](guint type, const guint8 *nal, gsize nal_size) {
+        if (type != H264_NAL_SEI) {
+            return type != H264_NAL_IDR && type != H264_NAL_SLICE;
+        }
+        RbspReader sei(nal + 1, nal_size - 1);
+        const std::vector<guint8> &payload = sei.data();
+        gsize pos = 0;
+        // sei_message()s until the RBSP trailing bits
+        while (pos + 2 <= payload.size() && payload[pos] != 0x80) {
+            guint payload_type = 0, payload_size = 0;
+            while (pos < payload.size() && payload[pos] == 0xff) payload_type += payload[pos++];
+            if (pos < payload.size()) payload_type += payload[pos++];
+            while (pos < payload.size() && payload[pos] == 0xff) payload_size += payload[pos++];
+            if (pos < payload.size()) payload_size += payload[pos++];
+            if (payload_type == H264_SEI_RECOVERY_POINT) {
+                RbspReader recovery(payload.data() + pos, std::min<gsize>(payload_size, payload.size() - pos));
+                count = (gint)recovery.ue();
+                return false;
+            }
+            pos += payload_size;
+        }
+        return true;
+    });
+    return count;
+}
+
+// Whether the access unit's picture is a reference (nal_ref_idc != 0)
+static bool h264_is_reference(const guint8 *data, gsize size) {
+    bool reference = false;
+    for_each_nal(data, size, [&](guint type, const guint8 *nal, gsize) {
+        if (type == H264_NAL_SLICE || type == H264_NAL_IDR) {
+            reference = (nal[0] & 0x60) != 0;
+            return false;
+        }
+        return true;
+    });
+    return reference;
+}
+
+// Whether the access unit's picture is an IDR picture (NAL unit type 5).
+// h264parse clears the delta-unit flag on any I picture, so the buffer
+// flags cannot tell.
+static bool h264_is_idr(const guint8 *data, gsize size) {
+    bool idr = false;
+    for_each_nal(data, size, [&](guint type, const guint8 *, gsize) {
+        if (type == H264_NAL_SLICE || type == H264_NAL_IDR) {
+            idr = type == H264_NAL_IDR;
+            return false;
+        }
+        return true;
+    });
+    return idr;
+}
+
+// user_data_unregistered SEI stamped on mount output: this UUID, then the
+// capture time in Unix microseconds as a big-endian 64-bit integer
+static const guint8 CAPTURE_TIME_SEI_UUID[16] = {
+    0x52, 0x50, 0x4c, 0x59, 0x63, 0x61, 0x70, 0x74,
+    0x75, 0x72, 0x65, 0x2d, 0x74, 0x69, 0x6d, 0x65
+};
+static const guint H264_SEI_USER_DATA_UNREGISTERED = 5;
+
+// user_data_unregistered SEI carrying camera metadata replayed with the
+// video: the UUID names the payload kind, the packet follows unchanged
+static const guint8 KLV_METADATA_SEI_UUID[16] = {
+    0x52, 0x50, 0x4c, 0x59, 0x6d, 0x65, 0x74, 0x61,
+    0x64, 0x61, 0x74, 0x61, 0x2d, 0x6b, 0x6c, 0x76
+};
+static const guint8 ONVIF_METADATA_SEI_UUID[16] = {
+    0x52, 0x50, 0x4c, 0x59, 0x6d, 0x65, 0x74, 0x61,
+    0x64, 0x61, 0x74, 0x61, 0x2d, 0x6f, 0x6e, 0x76
+};
+
+// A user_data_unregistered SEI NAL unit, start code included
+static std::vector<guint8> h264_user_data_sei(const guint8 uuid[16], const guint8 *payload, gsize size) {
+    std::vector<guint8> rbsp = { (guint8)H264_SEI_USER_DATA_UNREGISTERED };
+    gsize payload_size = 16 + size;
+    for (; payload_size >= 255; payload_size -= 255) {
+        rbsp.push_back(0xff);
+    }
+    rbsp.push_back((guint8)payload_size);
+    rbsp.insert(rbsp.end(), uuid, uuid + 16);
+    rbsp.insert(rbsp.end(), payload, payload + size);
+    rbsp.push_back(0x80);
+    
+    std::vector<guint8> sei = { 0, 0, 0, 1, H264_NAL_SEI };
+    guint zeros = 0;
+    for (guint8 byte : rbsp) {
+        if (zeros >= 2 && byte <= 3) {
+            sei.push_back(3); // emulation prevention
+            zeros = 0;
+        }
+        sei.push_back(byte);
+        zeros = byte == 0 ? zeros + 1 : 0;
+    }
+    return sei;
+}
+
+// The access unit with `nal_units` in front of its first slice. Consumes
+// `buffer`; returns it unchanged when it has no slice.
+static GstBuffer* insert_before_first_slice(GstBuffer *buffer, const std::vector<guint8> &nal_units) {
+    GstMapInfo map;
+    if (nal_units.empty() || !gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        return buffer;
+    }
+    gsize insert_at = map.size;
+    for_each_nal(map.data, map.size, [&](guint type, const guint8 *nal, gsize) {
+        if (type != H264_NAL_SLICE && type != H264_NAL_IDR) {
+            return true;
+        }
+        insert_at = (nal - map.data) - 3;
+        if (insert_at > 0 && map.data[insert_at - 1] == 0) {
+            insert_at--;
+        }
+        return false;
+    });
+    if (insert_at == map.size) {
+        gst_buffer_unmap(buffer, &map);
+        return buffer;
+    }
+    
+    GstBuffer *result = gst_buffer_new_allocate(nullptr, map.size + nal_units.size(), nullptr);
+    GstMapInfo out;
+    if (!result || !gst_buffer_map(result, &out, GST_MAP_WRITE)) {
+        if (result) gst_buffer_unref(result);
+        gst_buffer_unmap(buffer, &map);
+        return buffer;
+    }
+    memcpy(out.data, map.data, insert_at);
+    memcpy(out.data + insert_at, nal_units.data(), nal_units.size());
+    memcpy(out.data + insert_at + nal_units.size(), map.data + insert_at, map.size - insert_at);
+    gst_buffer_unmap(result, &out);
+    gst_buffer_unmap(buffer, &map);
+    gst_buffer_copy_into(result, buffer, GST_BUFFER_COPY_METADATA, 0, -1);
+    gst_buffer_unref(buffer);
+    return result;
+}
+
+// The access unit with a capture time SEI. Consumes `buffer`; returns it
+// unchanged when it has no capture time.
+static GstBuffer* add_capture_time_sei(GstBuffer *buffer) {
+    gint64 capture_time_us = get_capture_time(buffer);
+    if (capture_time_us < 0) {
+        return buffer;
+    }
+    guint8 payload[8];
+    for (int i = 0; i < 8; i++) {
+        payload[i] = (guint8)((guint64)capture_time_us >> (56 - 8 * i));
+    }
+    return insert_before_first_slice(buffer, h264_user_data_sei(CAPTURE_TIME_SEI_UUID, payload, sizeof(payload)));
+}
+
+// Classifies access units as they are indexed. An IDR, or an access unit
+// carrying a recovery point SEI (gradual decoding refresh, or an open-GOP
+// I picture), is a random access point. After a recovery point SEI with
+// recovery_frame_cnt N the picture is clean once frame_num has moved on by
+// N, i.e. after N more reference pictures (cameras do not use frame_num
+// gaps). Each recovery point counts its own refresh down, since a refresh
+// can outlast the spacing of the SEIs; a frame records the newest point
+// whose refresh had completed by then, and is flagged as refreshing when
+// that is not its own GOP's point. Non-reference pictures (typically
+// B-frames) are flagged as disposable.
+class RandomAccessTracker {
+public:
+    RandomAccessTracker() : recovery_frames(-1), access_seq(G_MAXUINT64), clean_seq(G_MAXUINT64) {}
+
+    // Flags of an access unit from its own NAL units
+    guint32 classify(const guint8 *data, gsize size) {
+        guint32 flags = h264_is_reference(data, size) ? 0 : RING_FRAME_DISPOSABLE;
+        recovery_frames = -1;
+        if (h264_is_idr(data, size)) {
+            flags = RING_FRAME_KEYFRAME;
+        } else if ((recovery_frames = h264_recovery_frame_count(data, size)) >= 0) {
+            flags = RING_FRAME_KEYFRAME | RING_FRAME_RECOVERY_POINT;
+        }
+        return flags;
+    }
+    
+    // The access unit classified last, with final `flags`, is written as
+    // frame `seq`. Adds RING_FRAME_REFRESHING to `flags`; returns the frame's
+    // clean decode start (G_MAXUINT64: none yet).
+    guint64 commit(guint64 seq, guint32 &flags) {
+        // A refresh completes after its last counted reference picture
+        for (auto it = pending.rbegin(); it != pending.rend(); ++it) {
+            if (it->remaining == 0) {
+                clean_seq = it->seq;
+                pending.erase(pending.begin(), it.base());
+                break;
+            }
+        }
+        if (flags & RING_FRAME_KEYFRAME) {
+            access_seq = seq;
+            if (!(flags & RING_FRAME_RECOVERY_POINT) || recovery_frames == 0) {
+                pending.clear();
+                clean_seq = seq;
+            } else {
+                if (pending.size() >= MAX_PENDING) {
+                    pending.pop_front();
+                }
+                pending.push_back({ seq, (guint)recovery_frames });
+            }
+        }
+        if (clean_seq != access_seq) {
+            flags |= RING_FRAME_REFRESHING;
+        }
+        if (!(flags & RING_FRAME_DISPOSABLE)) {
+            for (Pending &point : pending) {
+                if (point.remaining > 0) {
+                    point.remaining--;
+                }
+            }
+        }
+        return clean_seq;
+    }
+    
+    // Forget the stream so far: the next frames do not follow on from it
+    void reset() {
+        pending.clear();
+        access_seq = G_MAXUINT64;
+        clean_seq = G_MAXUINT64;
+    }
+
+private:
+    static const gsize MAX_PENDING = 64;
+    
+    struct Pending {
+        guint64 seq;
+        guint remaining;        // reference pictures until its refresh completes
+    };
+    
+    gint recovery_frames;       // of the access unit classified last
+    std::deque<Pending> pending;
+    guint64 access_seq;         // newest random access point
+    guint64 clean_seq;          // newest one whose refresh has completed
+};
+
+// The parts of an SPS's VUI needed to read picture timing SEI
+struct H264TimingInfo {
+    bool delays_present;                // CpbDpbDelaysPresentFlag
+    guint cpb_removal_delay_length;
+    guint dpb_output_delay_length;
+    guint time_offset_length;
+    bool pic_struct_present;
+    guint nominal_rate;                 // frames per second from timing_info, 0 if absent
+    
+    H264TimingInfo()
+        : delays_present(false), cpb_removal_delay_length(24), dpb_output_delay_length(24),
+          time_offset_length(24), pic_struct_present(false), nominal_rate(0) {}
+};
+
+// hrd_parameters(): only the delay field lengths are kept
+static void h264_read_hrd(RbspReader &rbsp, H264TimingInfo &info) {
+    guint cpb_count = rbsp.ue() + 1;
+    rbsp.bits(8); // bit_rate_scale, cpb_size_scale
+    for (guint i = 0; i < cpb_count && i < 32; i++) {
+        rbsp.ue();
+        rbsp.ue();
+        rbsp.bits(1);
+    }
+    rbsp.bits(5); // initial_cpb_removal_delay_length_minus1
+    info.cpb_removal_delay_length = rbsp.bits(5) + 1;
+    info.dpb_output_delay_length = rbsp.bits(5) + 1;
+    info.time_offset_length = rbsp.bits(5);
+}
+
+// Walk an SPS (NAL header included) up to the end of its VUI timing fields
+static bool h264_parse_sps_timing(const guint8 *nal, gsize size, H264TimingInfo &info) {
+    if (size < 4) {
+        return false;
+    }
+    RbspReader rbsp(nal + 1, size - 1);
+    guint profile_idc = rbsp.bits(8);
+    rbsp.bits(16); // constraint flags, level_idc
+    rbsp.ue();     // seq_parameter_set_id
+    static const guint high_profiles[] = { 100, 110, 122, 244, 44, 83, 86, 118, 128, 138, 139, 134, 135 };
+    if (std::find(std::begin(high_profiles), std::end(high_profiles), profile_idc) != std::end(high_profiles)) {
+        guint chroma_format_idc = rbsp.ue();
+        if (chroma_format_idc == 3) {
+            rbsp.bits(1);
+        }
+        rbsp.ue();
+        rbsp.ue();
+        rbsp.bits(1);
+        if (rbsp.bits(1)) { // seq_scaling_matrix_present_flag
+            for (guint i = 0; i < (chroma_format_idc != 3 ? 8u : 12u); i++) {
+                if (!rbsp.bits(1)) continue;
+                gint last = 8, next = 8;
+                for (guint j = 0; j < (i < 6 ? 16u : 64u) && next != 0; j++) {
+                    next = (last + rbsp.se() + 256) % 256;
+                    last = next == 0 ? last : next;
+                }
+            }
+        }
+    }
+    rbsp.ue(); // log2_max_frame_num_minus4
+    guint poc_type = rbsp.ue();
+    if (poc_type == 0) {
+        rbsp.ue();
+    } else if (poc_type == 1) {
+        rbsp.bits(1);
+        rbsp.se();
+        rbsp.se();
+        guint cycle = rbsp.ue();
+        for (guint i = 0; i < cycle && i < 256; i++) {
+            rbsp.se();
+        }
+    }
+    rbsp.ue();     // max_num_ref_frames
+    rbsp.bits(1);
+    rbsp.ue();     // pic_width_in_mbs_minus1
+    rbsp.ue();
+    if (!rbsp.bits(1)) { // frame_mbs_only_flag
+        rbsp.bits(1);
+    }
+    rbsp.bits(1);
+    if (rbsp.bits(1)) { // frame_cropping_flag
+        rbsp.ue(); rbsp.ue(); rbsp.ue(); rbsp.ue();
+    }
+    
+    info = H264TimingInfo();
+    if (!rbsp.bits(1)) { // vui_parameters_present_flag
+        return true;
+    }
+    if (rbsp.bits(1) && rbsp.bits(8) == 255) { // aspect_ratio_info, Extended_SAR
+        rbsp.bits(32);
+    }
+    if (rbsp.bits(1)) { // overscan_info_present_flag
+        rbsp.bits(1);
+    }
+    if (rbsp.bits(1)) { // video_signal_type_present_flag
+        rbsp.bits(4);
+        if (rbsp.bits(1)) {
+            rbsp.bits(24);
+        }
+    }
+    if (rbsp.bits(1)) { // chroma_loc_info_present_flag
+        rbsp.ue();
+        rbsp.ue();
+    }
+    if (rbsp.bits(1)) { // timing_info_present_flag
+        guint32 num_units_in_tick = rbsp.bits(32);
+        guint32 time_scale = rbsp.bits(32);
+        rbsp.bits(1);
+        if (num_units_in_tick > 0) {
+            info.nominal_rate = (guint)std::ceil(time_scale / (2.0 * num_units_in_tick) - 0.01);
+        }
+    }
+    bool nal_hrd = rbsp.bits(1);
+    if (nal_hrd) {
+        h264_read_hrd(rbsp, info);
+    }
+    bool vcl_hrd = rbsp.bits(1);
+    if (vcl_hrd) {
+        h264_read_hrd(rbsp, info);
+    }
+    if (nal_hrd || vcl_hrd) {
+        info.delays_present = true;
+        rbsp.bits(1); // low_delay_hrd_flag
+    }
+    info.pic_struct_present = rbsp.bits(1);
+    return !rbsp.exhausted();
+}
+
+// Clock timestamp of the access unit's picture timing SEI. Fields a
+// timestamp leaves out keep their value from `timecode`. Returns false
+// when the access unit carries none.
+static bool h264_picture_timecode(const guint8 *data, gsize size, const H264TimingInfo &info,
+                                  guint32 &timecode) {
+    if (!info.pic_struct_present) {
+        return false;
+    }
+    bool found = false;
+    for_each_nal(data, size, [&](guint type, const guint8 *nal, gsize nal_size) {
+        if (type != H264_NAL_SEI) {
+            return type != H264_NAL_IDR && type != H264_NAL_SLICE;
+        }
+        RbspReader sei(nal + 1, nal_size - 1);
+        const std::vector<guint8> &payload = sei.data();
+        gsize pos = 0;
+        while (pos + 2 <= payload.size() && payload[pos] != 0x80) {
+            guint payload_type = 0, payload_size = 0;
+            while (pos < payload.size() && payload[pos] == 0xff) payload_type += payload[pos++];
+            if (pos < payload.size()) payload_type += payload[pos++];
+            while (pos < payload.size() && payload[pos] == 0xff) payload_size += payload[pos++];
+            if (pos < payload.size()) payload_size += payload[pos++];
+            if (payload_type != H264_SEI_PIC_TIMING) {
+                pos += payload_size;
+                continue;
+            }
+            
+            RbspReader timing(payload.data() + pos, std::min<gsize>(payload_size, payload.size() - pos));
+            if (info.delays_present) {
+                timing.bits(info.cpb_removal_delay_length);
+                timing.bits(info.dpb_output_delay_length);
+            }
+            static const guint clock_timestamps[] = { 1, 1, 1, 2, 2, 3, 3, 2, 3 };
+            guint pic_struct = timing.bits(4);
+            guint count = pic_struct < G_N_ELEMENTS(clock_timestamps) ? clock_timestamps[pic_struct] : 0;
+            for (guint i = 0; i < count; i++) {
+                if (!timing.bits(1)) { // clock_timestamp_flag
+                    continue;
+                }
+                timing.bits(2 + 1 + 5); // ct_type, nuit_field_based_flag, counting_type
+                bool full = timing.bits(1);
+                timing.bits(2);         // discontinuity_flag, cnt_dropped_flag
+                guint frames = timing.bits(8);
+                guint seconds = (timecode >> 8) & 0xff, minutes = (timecode >> 16) & 0xff, hours = timecode >> 24;
+                if (timecode == NO_TIMECODE) {
+                    seconds = minutes = hours = 0;
+                }
+                if (full) {
+                    seconds = timing.bits(6);
+                    minutes = timing.bits(6);
+                    hours = timing.bits(5);
+                } else if (timing.bits(1)) {
+                    seconds = timing.bits(6);
+                    if (timing.bits(1)) {
+                        minutes = timing.bits(6);
+                        if (timing.bits(1)) {
+                            hours = timing.bits(5);
+                        }
+                    }
+                }
+                if (info.time_offset_length > 0) {
+                    timing.bits(info.time_offset_length);
+                }
+                if (!found && !timing.exhausted() && seconds < 60 && minutes < 60 && hours < 24) {
+                    timecode = pack_timecode(hours, minutes, seconds, frames);
+                    found = true;
+                }
+            }
+            return false;
+        }
+        return true;
+    });
+    return found;
+}
+
+// Stamps every access unit with a timecode. Cameras that send picture
+// timing SEI with clock timestamps are used as-is (pictures without one
+// count on from the last); otherwise timecode is time of day on the
+// replay timeline at `fallback_rate` frames per second.
+class TimecodeTracker {
+public:
+    explicit TimecodeTracker(guint fallback_rate)
+        : fallback_rate(std::max(fallback_rate, 1u)), last(NO_TIMECODE), from_stream(false) {}
+
+    guint32 stamp(const guint8 *data, gsize size, gint64 capture_time_us) {
+        for_each_nal(data, size, [&](guint type, const guint8 *nal, gsize nal_size) {
+            if (type == H264_NAL_SPS) {
+                h264_parse_sps_timing(nal, nal_size, timing);
+            }
+            return type != H264_NAL_IDR && type != H264_NAL_SLICE;
+        });
+        
+        guint32 timecode = last;
+        if (h264_picture_timecode(data, size, timing, timecode)) {
+            from_stream = true;
+        } else if (from_stream && last != NO_TIMECODE) {
+            timecode = next_frame(last, timing.nominal_rate ? timing.nominal_rate : fallback_rate);
+        } else {
+            timecode = wall_clock(capture_time_us);
+        }
+        last = timecode;
+        return timecode;
+    }
+
+private:
+    static guint32 next_frame(guint32 timecode, guint rate) {
+        guint hours = timecode >> 24, minutes = (timecode >> 16) & 0xff;
+        guint seconds = (timecode >> 8) & 0xff, frames = (timecode & 0xff) + 1;
+        if (frames >= rate) { frames = 0; seconds++; }
+        if (seconds >= 60) { seconds = 0; minutes++; }
+        if (minutes >= 60) { minutes = 0; hours++; }
+        return pack_timecode(hours % 24, minutes, seconds, frames);
+    }
+    
+    guint32 wall_clock(gint64 capture_time_us) const {
+        GDateTime *local = g_date_time_new_from_unix_local(capture_time_us / G_USEC_PER_SEC);
+        if (!local) {
+            return NO_TIMECODE;
+        }
+        guint frames = (guint)((capture_time_us % G_USEC_PER_SEC) * fallback_rate / G_USEC_PER_SEC);
+        guint32 timecode = pack_timecode(g_date_time_get_hour(local), g_date_time_get_minute(local),
+                                         g_date_time_get_second(local), frames);
+        g_date_time_unref(local);
+        return timecode;
+    }
+    
+    guint fallback_rate;
+    H264TimingInfo timing;
+    guint32 last;
+    bool from_stream;       // the camera sends clock timestamps
+};
+
+// Maps a camera's stream time onto the replay timeline. Arrival times
+// carry network jitter and the camera clock drifts against ours, so
+// arrival is not used directly: each 10 s epoch contributes its smallest
+// (arrival - stream time), a least-squares line through the last ten
+// minutes of those gives offset and drift, and the applied mapping is
+// steered towards that line by changing its rate only, never by stepping.
+// Timeline positions never exceed the arrival time and never go backwards.
+class DriftEstimator {
+public:
+    explicit DriftEstimator(const std::string &camera_id)
+        : labels(camera_label(camera_id)), anchored(false), anchor_stream_us(0), anchor_timeline_us(0),
+          rate(1.0), drift(0.0), epoch_start_us(0), epoch_min_offset_us(G_MAXINT64), last_timeline_us(0) {}
+
+    // Timeline position of an access unit with decode (or presentation)
+    // time `stream_time` that arrived at `arrival_us`
+    gint64 correct(GstClockTime stream_time, gint64 arrival_us) {
+        if (!GST_CLOCK_TIME_IS_VALID(stream_time)) {
+            return monotonic(arrival_us);
+        }
+        gint64 x = (gint64)(stream_time / GST_USECOND);
+        if (!anchored || std::llabs(arrival_us - map(x)) > RESYNC_US) {
+            reset(x, arrival_us); // first frame, or a stream time discontinuity
+        }
+        epoch_min_offset_us = std::min(epoch_min_offset_us, arrival_us - x);
+        if (x - epoch_start_us >= EPOCH_US) {
+            end_epoch(x);
+        } else if (x < epoch_start_us) {
+            epoch_start_us = x;
+        }
+        return monotonic(std::min(map(x), arrival_us));
+    }
+    
+    // Latest drift estimate (positive: the camera clock runs slow)
+    gdouble drift_ppm() const { return drift * 1e6; }
+
+private:
+    static const gint64 EPOCH_US = 10 * G_USEC_PER_SEC;
+    static const gint64 RESYNC_US = G_USEC_PER_SEC;
+    static const size_t HISTORY_EPOCHS = 60;
+    
+    gint64 map(gint64 x) const {
+        return anchor_timeline_us + (gint64)std::llround((x - anchor_stream_us) * rate);
+    }
+    
+    gint64 monotonic(gint64 timeline_us) {
+        last_timeline_us = std::max(timeline_us, last_timeline_us + 1);
+        return last_timeline_us;
+    }
+    
+    void reset(gint64 x, gint64 arrival_us) {
+        anchored = true;
+        anchor_stream_us = x;
+        anchor_timeline_us = arrival_us;
+        rate = 1.0;
+        epochs.clear();
+        epoch_start_us = x;
+        epoch_min_offset_us = G_MAXINT64;
+    }
+    
+    void end_epoch(gint64 x) {
+        epochs.emplace_back((epoch_start_us + x) / 2, epoch_min_offset_us);
+        if (epochs.size() > HISTORY_EPOCHS) {
+            epochs.pop_front();
+        }
+        epoch_start_us = x;
+        epoch_min_offset_us = G_MAXINT64;
+        if (epochs.size() < 3) {
+            return;
+        }
+        
+        // offset(x) = intercept + drift * x, relative to the oldest epoch
+        gdouble mean_x = 0, mean_y = 0;
+        for (const auto &epoch : epochs) {
+            mean_x += epoch.first - epochs.front().first;
+            mean_y += epoch.second - epochs.front().second;
+        }
+        mean_x /= epochs.size();
+        mean_y /= epochs.size();
+        gdouble sxx = 0, sxy = 0;
+        for (const auto &epoch : epochs) {
+            gdouble dx = epoch.first - epochs.front().first - mean_x;
+            sxx += dx * dx;
+            sxy += dx * (epoch.second - epochs.front().second - mean_y);
+        }
+        drift = sxx > 0 ? sxy / sxx : 0.0;
+        
+        // Re-anchor where we are and aim to meet the line one epoch ahead
+        gint64 target_x = x + EPOCH_US;
+        gdouble target = target_x + epochs.front().second + mean_y +
+                         drift * (target_x - epochs.front().first - mean_x);
+        anchor_timeline_us = map(x);
+        anchor_stream_us = x;
+        rate = std::min(std::max((target - anchor_timeline_us) / EPOCH_US, 1.0 - MAX_RATE_ERROR), 1.0 + MAX_RATE_ERROR);
+        metrics.set("ingest_clock_drift_ppb", labels, (gint64)std::llround(drift * 1e9));
+    }
+    
+    static constexpr gdouble MAX_RATE_ERROR = 1e-3;
+    
+    std::string labels;
+    bool anchored;
+    gint64 anchor_stream_us;
+    gint64 anchor_timeline_us;
+    gdouble rate;                                   // timeline µs per stream µs
+    gdouble drift;                                  // fitted, arrival µs per stream µs - 1
+    std::deque<std::pair<gint64, gint64>> epochs;   // (stream time, smallest arrival - stream time)
+    gint64 epoch_start_us;
+    gint64 epoch_min_offset_us;
+    gint64 last_timeline_us;
+};
+
+// Drift simulation
+//
+// Feeds a DriftEstimator six hours of a 25 fps camera whose clock is off
+// by a known rate, with 20 ms network delay plus exponential jitter
+// (fixed seed), and compares the mapping with the true capture times.
+// This needs the stream times to be the camera's own clock, which is why
+// rtspsrc runs with buffer-mode none: in slave mode the jitterbuffer has
+// already skewed them onto the receiver clock.
+static bool simulate_drift(gdouble camera_ppm, gdouble jitter_ms, gdouble &estimated_ppm, gdouble &max_error_ms) {
+    const gint64 frame_us = 40000;
+    const gint64 delay_us = 20000;
+    const gint64 frames = 6LL * 3600 * G_USEC_PER_SEC / frame_us;
+    const gint64 settle_frames = 10LL * 60 * G_USEC_PER_SEC / frame_us;
+    const gint64 start_us = 1700000000LL * G_USEC_PER_SEC;
+    std::mt19937 random(1);
+    std::exponential_distribution<gdouble> jitter(1.0 / (jitter_ms * 1000.0));
+    
+    DriftEstimator estimator("simulated");
+    max_error_ms = 0;
+    for (gint64 n = 0; n < frames; n++) {
+        gint64 stream_us = n * frame_us;
+        gint64 capture_us = start_us + (gint64)std::llround(stream_us * (1.0 + camera_ppm * 1e-6));
+        gint64 arrival_us = capture_us + delay_us + (gint64)jitter(random);
+        gint64 timeline_us = estimator.correct((GstClockTime)stream_us * GST_USECOND, arrival_us);
+        if (n >= settle_frames) {
+            max_error_ms = std::max(max_error_ms, std::fabs(timeline_us - (capture_us + delay_us)) / 1000.0);
+        }
+    }
+    estimated_ppm = estimator.drift_ppm();
+    return std::fabs(estimated_ppm - camera_ppm) < 1.0 && max_error_ms < 1.0;
+}
+
+static int run_drift_simulation() {
+    const gdouble cases[][2] = { { 50.0, 5.0 }, { -50.0, 5.0 }, { 50.0, 20.0 } };
+    g_print("Clock drift estimator: 6 h at 25 fps, 20 ms delay, exponential jitter, error after 10 min\n");
+    bool ok = true;
+    for (const auto &scenario : cases) {
+        gdouble estimated, max_error;
+        bool passed = simulate_drift(scenario[0], scenario[1], estimated, max_error);
+        g_print("  camera %+5.1f ppm, jitter %4.1f ms: estimated %+7.2f ppm, max timeline error %.3f ms  %s\n",
+               scenario[0], scenario[1], estimated, max_error, passed ? "ok" : "FAILED");
+        ok = ok && passed;
+    }
+    return ok ? 0 : 1;
+}
+
+// Metadata ring size per camera; analytics metadata is a few KB/s
+static const guint64 METADATA_RING_BYTES = 8 * 1024 * 1024;
+
+// What a predecessor process handed over (--take-over): its RTSP
+// listeners and the memfds of its rings, by camera id
+struct HandoffInheritance {
+    std::vector<GSocket *> listeners;
+    std::map<std::string, int> video_rings;
+    std::map<std::string, int> metadata_rings;
+};
+
+static HandoffInheritance inherited;
+
+// The predecessor's ring for `camera_id` when it handed one over and it
+// fits this configuration, else a new one (in shared memory when a
+// successor may take it over later)
+static FrameRing* make_camera_ring(std::map<std::string, int> &inherited_rings, const std::string &camera_id,
+                                   const char *kind, guint64 index_capacity, guint64 data_capacity,
+                                   GstClockTime window, bool shared) {
+    auto it = inherited_rings.find(camera_id);
+    if (it != inherited_rings.end()) {
+        int memfd = it->second;
+        inherited_rings.erase(it);
+        FrameRing *ring = FrameRing::adopt(memfd, index_capacity, data_capacity);
+        if (ring) {
+            g_print("✓ Camera %s: continuing the predecessor's %s ring\n", camera_id.c_str(), kind);
+            return ring;
+        }
+        g_printerr("Camera %s: the inherited %s ring does not match this configuration, starting empty\n",
+                   camera_id.c_str(), kind);
+    }
+    std::string name = std::string("replay-") + kind + "-" + camera_id;
+    return new FrameRing(index_capacity, data_capacity, window, shared ? name.c_str() : nullptr);
+}
+
+// Camera registry
+static std::atomic<guint64> camera_generations(0);
+
+struct Camera {
+    std::string id;
+    const guint64 generation;     // tells a camera re-added under the same id from the one removed
+    std::string rtsp_url;
+    std::string spill_path;       // raw .h264 written by the queue2/filesink branch
+    std::unique_ptr<FrameRing> ring;
+    std::unique_ptr<FrameRing> metadata_ring;   // ONVIF/KLV application stream, one entry per packet
+    
+    Camera(const CameraConfig &camera_config, const ReplayConfig &config)
+        : id(camera_config.id),
+          generation(camera_generations++),
+          rtsp_url(camera_config.rtsp_url),
+          timecode_tracker((guint)config.timecode_rate),
+          clock_drift(camera_config.id),
+          last_arrival_us(0),
+          frame_interval_us(0),
+          awaiting_keyframe(false),
+          caps(nullptr) {
+        guint64 index_capacity = (guint64)config.buffer_seconds * 240 + 1024;
+        guint64 data_capacity = (guint64)config.ring_megabytes * 1024 * 1024;
+        GstClockTime window = (GstClockTime)config.buffer_seconds * GST_SECOND;
+        bool shared = !config.handoff_socket.empty();
+        ring.reset(make_camera_ring(inherited.video_rings, id, "video", index_capacity, data_capacity,
+                                    window, shared));
+        metadata_ring.reset(make_camera_ring(inherited.metadata_rings, id, "metadata",
+                                             (guint64)config.buffer_seconds * 100 + 256, METADATA_RING_BYTES,
+                                             window, shared));
+    }
+    
+    ~Camera() {
+        if (caps) gst_caps_unref(caps);
+    }
+    
+    // Caps of the stored access units, for appsrc elements reading the ring
+    GstCaps* get_caps() {
+        std::lock_guard<std::mutex> guard(caps_lock);
+        return caps ? gst_caps_ref(caps) : nullptr;
+    }
+    
+    void set_caps(GstCaps *new_caps) {
+        std::lock_guard<std::mutex> guard(caps_lock);
+        gst_caps_replace(&caps, new_caps);
+    }
+    
+    // Latest SPS/PPS seen in the stream (Annex B bytes)
+    std::string get_parameter_sets() {
+        std::lock_guard<std::mutex> guard(caps_lock);
+        return parameter_sets;
+    }
+    
+    void set_parameter_sets(const std::string &bytes) {
+        std::lock_guard<std::mutex> guard(caps_lock);
+        parameter_sets = bytes;
+    }
+
+    RandomAccessTracker access_tracker;     // ingest streaming thread only
+    TimecodeTracker timecode_tracker;       // ingest streaming thread only
+    DriftEstimator clock_drift;             // ingest streaming thread only
+    
+    // Arrivals, for the stall watchdog
+    std::atomic<gint64> last_arrival_us;
+    std::atomic<gint64> frame_interval_us;  // smoothed gap between access units, 0 until measured
+    std::atomic<bool> awaiting_keyframe;    // after a source rebuild, until the next random access point
+    
+    // Called by the ingest thread per access unit. Gaps far above the
+    // interval (a stall, a reconnect) are not averaged in.
+    void note_arrival(gint64 now_us) {
+        gint64 last = last_arrival_us.exchange(now_us);
+        gint64 interval = frame_interval_us.load();
+        gint64 gap = now_us - last;
+        if (last > 0 && gap > 0 && (interval == 0 || gap < 4 * interval)) {
+            frame_interval_us.store(interval == 0 ? gap : interval + (gap - interval) / 16);
+        }
+    }
+
+private:
+    std::mutex caps_lock;
+    GstCaps *caps;
+    std::string parameter_sets;
+};
+
+static std::mutex cameras_lock;
+static std::vector<std::shared_ptr<Camera>> cameras;
+
+static std::shared_ptr<Camera> find_camera(const std::string &id) {
+    std::lock_guard<std::mutex> guard(cameras_lock);
+    for (const auto &camera : cameras) {
+        if (camera->id == id) {
+            return camera;
+        }
+    }
+    return nullptr;
+}
+
+static std::vector<std::shared_ptr<Camera>> list_cameras() {
+    std::lock_guard<std::mutex> guard(cameras_lock);
+    return cameras;
+}
+
+// Signal handler for graceful shutdown
+void signal_handler(int signum) {
+    g_print("\nReceived signal %d, shutting down...\n", signum);
+    shutdown_requested = 1;
+    if (main_loop) {
+        g_main_loop_quit(main_loop);
+    }
+}
+
+// Bus message callback
+static gboolean bus_callback(GstBus *bus, GstMessage *message, gpointer user_data) {
+    switch (GST_MESSAGE_TYPE(message)) {
+        case GST_MESSAGE_ERROR: {
+            GError *err;
+            gchar *debug_info;
+            gst_message_parse_error(message, &err, &debug_info);
+            g_printerr("ERROR from element %s: %s\n", 
+                      GST_OBJECT_NAME(message->src), err->message);
+            g_printerr("Debugging info: %s\n", debug_info ? debug_info : "none");
+            g_error_free(err);
+            g_free(debug_info);
+            g_main_loop_quit(main_loop);
+            break;
+        }
+        case GST_MESSAGE_WARNING: {
+            GError *err;
+            gchar *debug_info;
+            gst_message_parse_warning(message, &err, &debug_info);
+            g_printerr("WARNING from element %s: %s\n", 
+                      GST_OBJECT_NAME(message->src), err->message);
+            g_printerr("Debugging info: %s\n", debug_info ? debug_info : "none");
+            g_error_free(err);
+            g_free(debug_info);
+            break;
+        }
+        case GST_MESSAGE_EOS:
+            g_print("End-Of-Stream reached.\n");
+            g_main_loop_quit(main_loop);
+            break;
+        case GST_MESSAGE_STATE_CHANGED: {
+            if (GST_MESSAGE_SRC(message) == GST_OBJECT(pipeline)) {
+                GstState old_state, new_state, pending_state;
+                gst_message_parse_state_changed(message, &old_state, &new_state, &pending_state);
+                g_print("Pipeline state changed from %s to %s\n",
+                       gst_element_state_get_name(old_state),
+                       gst_element_state_get_name(new_state));
+            }
+            break;
+        }
+        case GST_MESSAGE_BUFFERING: {
+            gint percent = 0;
+            gst_message_parse_buffering(message, &percent);
+            g_print("Buffering: %d%%\r", percent);
+            if (percent < 100) {
+                gst_element_set_state(pipeline, GST_STATE_PAUSED);
+            } else {
+                gst_element_set_state(pipeline, GST_STATE_PLAYING);
+            }
+            break;
+        }
+        case GST_MESSAGE_ELEMENT: {
+            const GstStructure *s = gst_message_get_structure(message);
+            const gchar *name = gst_structure_get_name(s);
+            if (g_str_has_prefix(name, "GstBin")) {
+                // Handle bin messages if needed
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return TRUE;
+}
+
+// Successor side of an upgrade handoff: take the camera's rings over at a
+// random access point newer than anything the predecessor has written, so
+// the ring never holds a frame twice and every GOP has a single writer
+static bool take_over_rings(Camera &camera, guint32 flags, gint64 capture_time_us) {
+    if (!(flags & RING_FRAME_KEYFRAME)) {
+        return false;
+    }
+    FrameRing &ring = *camera.ring;
+    RingFrame newest;
+    guint64 head = ring.head();
+    if (head > ring.tail() && ring.read_frame(head - 1, newest) &&
+        capture_time_us <= newest.capture_time_us + camera.frame_interval_us.load() / 2) {
+        return false; // the predecessor already has this frame
+    }
+    if (!ring.take_writer()) {
+        return false;
+    }
+    camera.metadata_ring->take_writer();
+    g_print("✓ Camera %s: took over ring writing at frame %" G_GUINT64_FORMAT "\n", camera.id.c_str(), head);
+    metrics.add("handoff_rings_taken_total", camera_label(camera.id));
+    return true;
+}
+
+// Ring tap: copy each parsed access unit into the camera's frame ring
+static GstFlowReturn on_ring_sample(GstAppSink *appsink, gpointer user_data) {
+    Camera *camera = static_cast<Camera *>(user_data);
+    GstSample *sample = gst_app_sink_pull_sample(appsink);
+    if (!sample) {
+        return GST_FLOW_EOS;
+    }
+    
+    GstCaps *caps = gst_sample_get_caps(sample);
+    if (caps) {
+        camera->set_caps(caps);
+    }
+    
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    GstMapInfo map;
+    if (buffer && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        gint64 arrival_us = timeline_now_us();
+        camera->note_arrival(arrival_us);
+        guint32 flags = camera->access_tracker.classify(map.data, map.size);
+        if (camera->awaiting_keyframe.load() && !(flags & RING_FRAME_KEYFRAME)) {
+            // References of these frames were lost with the old connection
+            camera->access_tracker.reset();
+            gst_buffer_unmap(buffer, &map);
+            gst_sample_unref(sample);
+            return GST_FLOW_OK;
+        }
+        camera->awaiting_keyframe.store(false);
+        std::string parameter_sets = (flags & RING_FRAME_KEYFRAME) ?
+                                     h264_parameter_sets(map.data, map.size) : std::string();
+        if (!parameter_sets.empty()) {
+            camera->set_parameter_sets(parameter_sets);
+        }
+        
+        // Every random access point must carry SPS/PPS so decoding can start
+        // there; h264parse only guarantees that in front of IDRs
+        std::string prefixed;
+        const guint8 *bytes = map.data;
+        gsize size = map.size;
+        if ((flags & RING_FRAME_RECOVERY_POINT) && parameter_sets.empty()) {
+            prefixed = camera->get_parameter_sets();
+            if (prefixed.empty()) {
+                flags &= ~(guint32)(RING_FRAME_KEYFRAME | RING_FRAME_RECOVERY_POINT);
+            } else {
+                prefixed.append(reinterpret_cast<const char *>(map.data), map.size);
+                bytes = reinterpret_cast<const guint8 *>(prefixed.data());
+                size = prefixed.size();
+            }
+        }
+        
+        GstClockTime stream_time = GST_CLOCK_TIME_IS_VALID(GST_BUFFER_DTS(buffer)) ?
+                                   GST_BUFFER_DTS(buffer) : GST_BUFFER_PTS(buffer);
+        gint64 capture_time_us = camera->clock_drift.correct(stream_time, arrival_us);
+        guint32 timecode = camera->timecode_tracker.stamp(map.data, map.size, capture_time_us);
+        if (!camera->ring->owns_writer() && !take_over_rings(*camera, flags, capture_time_us)) {
+            // The predecessor process is still writing this camera's ring
+            camera->access_tracker.reset();
+            gst_buffer_unmap(buffer, &map);
+            gst_sample_unref(sample);
+            return GST_FLOW_OK;
+        }
+        // Only this thread writes the ring now, so the frame lands at head()
+        guint64 clean_seq = camera->access_tracker.commit(camera->ring->head(), flags);
+        if (!camera->ring->push(bytes, size,
+                                GST_BUFFER_PTS(buffer), GST_BUFFER_DTS(buffer),
+                                GST_BUFFER_DURATION(buffer), capture_time_us, flags, timecode,
+                                camera->metadata_ring->head(), clean_seq)) {
+            camera->access_tracker.reset();
+        }
+        gst_buffer_unmap(buffer, &map);
+    }
+    
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+// Add one camera's ingest branch to the input pipeline:
+//   rtspsrc ! rtph264depay ! h264parse ! tee ! queue2 ! filesink
+//                                          tee ! queue ! appsink (frame ring)
+//   rtspsrc ! metadata depay ! queue ! appsink (metadata ring, if offered)
+static GstElement* make_camera_element(const char *factory, const char *prefix, const Camera &camera) {
+    gchar *name = g_strdup_printf("%s-%s", prefix, camera.id.c_str());
+    GstElement *element = gst_element_factory_make(factory, name);
+    g_free(name);
+    return element;
+}
+
+// Metadata tap: store each depayloaded metadata packet in the camera's
+// metadata ring, on the same timeline as the video
+static GstFlowReturn on_metadata_sample(GstAppSink *appsink, gpointer user_data) {
+    Camera *camera = static_cast<Camera *>(user_data);
+    GstSample *sample = gst_app_sink_pull_sample(appsink);
+    if (!sample) {
+        return GST_FLOW_EOS;
+    }
+    
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    GstStructure *structure = gst_caps_get_structure(gst_sample_get_caps(sample), 0);
+    guint32 kind = gst_structure_has_name(structure, "meta/x-klv") ?
+                   RING_FRAME_METADATA_KLV : RING_FRAME_METADATA_ONVIF;
+    GstMapInfo map;
+    if (!camera->metadata_ring->owns_writer() && camera->ring->owns_writer()) {
+        camera->metadata_ring->take_writer(); // the predecessor was mid-push at the video takeover
+    }
+    if (buffer && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        camera->metadata_ring->push(map.data, map.size, GST_BUFFER_PTS(buffer), GST_BUFFER_DTS(buffer),
+                                    GST_BUFFER_DURATION(buffer), timeline_now_us(),
+                                    RING_FRAME_KEYFRAME | kind);
+        gst_buffer_unmap(buffer, &map);
+    }
+    
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+// Depayload an application stream (ONVIF analytics or KLV) into the
+// camera's metadata ring: rtspsrc pad ! depay ! queue ! appsink
+static void add_metadata_branch(GstElement *rtspsrc, GstPad *pad, Camera *camera, const char *depay_factory) {
+    GstElement *bin = GST_ELEMENT(gst_element_get_parent(rtspsrc));
+    GstElement *depay = make_camera_element(depay_factory, "metadata-depay", *camera);
+    GstElement *queue = make_camera_element("queue", "metadata-queue", *camera);
+    GstElement *sink = make_camera_element("appsink", "metadata-tap", *camera);
+    if (!bin || !depay || !queue || !sink) {
+        g_printerr("Cannot store metadata of camera %s: %s not available\n", camera->id.c_str(), depay_factory);
+        if (depay) gst_object_unref(depay);
+        if (queue) gst_object_unref(queue);
+        if (sink) gst_object_unref(sink);
+        if (bin) gst_object_unref(bin);
+        return;
+    }
+    
+    g_object_set(G_OBJECT(sink), "sync", FALSE, "async", FALSE, NULL);
+    GstAppSinkCallbacks callbacks = {};
+    callbacks.new_sample = on_metadata_sample;
+    gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks, camera, NULL);
+    
+    gst_bin_add_many(GST_BIN(bin), depay, queue, sink, NULL);
+    GstPad *sinkpad = gst_element_get_static_pad(depay, "sink");
+    if (!gst_element_link_many(depay, queue, sink, NULL) || GST_PAD_LINK_FAILED(gst_pad_link(pad, sinkpad))) {
+        g_printerr("Failed to link metadata branch of camera %s\n", camera->id.c_str());
+    } else {
+        gst_element_sync_state_with_parent(sink);
+        gst_element_sync_state_with_parent(queue);
+        gst_element_sync_state_with_parent(depay);
+        g_print("✓ Storing %s metadata of camera %s\n", depay_factory, camera->id.c_str());
+    }
+    gst_object_unref(sinkpad);
+    gst_object_unref(bin);
+}
+
+// Pad added callback for dynamic pads (rtspsrc): H.264 video goes to the
+// camera's depayloader, ONVIF/KLV application streams to a metadata branch
+static void on_pad_added(GstElement *element, GstPad *pad, gpointer data) {
+    Camera *camera = static_cast<Camera *>(data);
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    if (!caps) {
+        caps = gst_pad_query_caps(pad, NULL);
+    }
+    
+    gchar *caps_str = gst_caps_to_string(caps);
+    g_print("Received new pad '%s' from '%s' with caps: %s\n",
+           GST_PAD_NAME(pad), GST_ELEMENT_NAME(element), caps_str);
+    g_free(caps_str);
+    
+    GstStructure *structure = gst_caps_get_structure(caps, 0);
+    const gchar *media = gst_structure_get_string(structure, "media");
+    const gchar *encoding = gst_structure_get_string(structure, "encoding-name");
+    
+    if (media && encoding && 
+        g_strcmp0(media, "video") == 0 && 
+        g_strcmp0(encoding, "H264") == 0) {
+        gchar *depay_name = g_strdup_printf("depay-%s", camera->id.c_str());
+        GstElement *bin = GST_ELEMENT(gst_element_get_parent(element));
+        GstElement *depay = bin ? gst_bin_get_by_name(GST_BIN(bin), depay_name) : nullptr;
+        GstPad *sinkpad = depay ? gst_element_get_static_pad(depay, "sink") : nullptr;
+        if (sinkpad && !gst_pad_is_linked(sinkpad)) {
+            GstPadLinkReturn ret = gst_pad_link(pad, sinkpad);
+            if (GST_PAD_LINK_FAILED(ret)) {
+                g_printerr("Failed to link pads: %d\n", ret);
+            } else {
+                g_print("✓ Successfully linked %s to %s\n",
+                       GST_ELEMENT_NAME(element), GST_ELEMENT_NAME(depay));
+            }
+        }
+        if (sinkpad) gst_object_unref(sinkpad);
+        if (depay) gst_object_unref(depay);
+        if (bin) gst_object_unref(bin);
+        g_free(depay_name);
+    } else if (media && encoding && g_strcmp0(media, "application") == 0) {
+        if (g_ascii_strcasecmp(encoding, "VND.ONVIF.METADATA") == 0) {
+            add_metadata_branch(element, pad, camera, "rtponvifmetadatadepay");
+        } else if (g_ascii_strcasecmp(encoding, "SMPTE336M") == 0) {
+            add_metadata_branch(element, pad, camera, "rtpklvdepay");
+        }
+    }
+    
+    gst_caps_unref(caps);
+}
+
+// The camera's rtspsrc, configured and wired to on_pad_added
+static GstElement* make_camera_source(const std::shared_ptr<Camera> &camera) {
+    GstElement *rtspsrc = make_camera_element("rtspsrc", "source", *camera);
+    if (!rtspsrc) {
+        return nullptr;
+    }
+    g_object_set(G_OBJECT(rtspsrc),
+                 "location", camera->rtsp_url.c_str(),
+                 "latency", 2000,
+                 "protocols", 0x00000004, // TCP
+                 "buffer-mode", 0, // None: keep the camera's clock for DriftEstimator
+                 NULL);
+    g_signal_connect(rtspsrc, "pad-added", G_CALLBACK(on_pad_added), camera.get());
+    return rtspsrc;
+}
+
+static bool add_camera_branch(GstElement *pipeline_elem, const std::shared_ptr<Camera> &camera,
+                              const ReplayConfig &config) {
+    const char *id = camera->id.c_str();
+    
+    // Create elements
+    GstElement *rtspsrc = make_camera_source(camera);
+    GstElement *depay = make_camera_element("rtph264depay", "depay", *camera);
+    GstElement *parse = make_camera_element("h264parse", "parse", *camera);
+    GstElement *au_filter = make_camera_element("capsfilter", "au-filter", *camera);
+    GstElement *tee = make_camera_element("tee", "split", *camera);
+    GstElement *queue_buffer = make_camera_element("queue2", "ring-buffer", *camera);
+    GstElement *filesink = make_camera_element("filesink", "output", *camera);
+    GstElement *ring_queue = make_camera_element("queue", "ring-queue", *camera);
+    GstElement *ring_sink = make_camera_element("appsink", "ring-tap", *camera);
+    
+    GstElement *elements[] = {
+        rtspsrc, depay, parse, au_filter, tee, queue_buffer, filesink, ring_queue, ring_sink
+    };
+    bool all_created = true;
+    for (GstElement *element : elements) {
+        all_created = all_created && element != nullptr;
+    }
+    if (!all_created) {
+        g_printerr("Failed to create pipeline elements for camera %s\n", id);
+        for (GstElement *element : elements) {
+            if (element) gst_object_unref(element);
+        }
+        return false;
+    }
+    
+    // One access unit per buffer, SPS/PPS in front of every IDR so each
+    // GOP read back from the ring decodes on its own
+    g_object_set(G_OBJECT(parse), "config-interval", -1, NULL);
+    GstCaps *au_caps = gst_caps_from_string(
+        "video/x-h264,stream-format=byte-stream,alignment=au");
+    g_object_set(G_OBJECT(au_filter), "caps", au_caps, NULL);
+    gst_caps_unref(au_caps);
+    
+    // Configure queue2 as ring buffer
+    guint64 max_size_time = (guint64)config.buffer_seconds * GST_SECOND;
+    guint64 ring_buffer_max_size = 1000000000; // 1GB max
+    
+    g_object_set(G_OBJECT(queue_buffer),
+                 "max-size-time", max_size_time,
+                 "ring-buffer-max-size", ring_buffer_max_size,
+                 "use-buffering", TRUE,
+                 "temp-template", NULL, // Memory-based ring buffer
+                 NULL);
+    
+    // For testing: save to file (in production, connect to RTSP server)
+    g_object_set(G_OBJECT(filesink),
+                 "location", camera->spill_path.c_str(),
+                 NULL);
+    
+    // Frame ring tap: never drop, never sync to the clock
+    g_object_set(G_OBJECT(ring_sink),
+                 "sync", FALSE,
+                 "async", FALSE,
+                 NULL);
+    GstAppSinkCallbacks callbacks = {};
+    callbacks.new_sample = on_ring_sample;
+    gst_app_sink_set_callbacks(GST_APP_SINK(ring_sink), &callbacks, camera.get(), NULL);
+    
+    // Add elements to pipeline
+    gst_bin_add_many(GST_BIN(pipeline_elem), 
+                     rtspsrc, depay, parse, au_filter, tee,
+                     queue_buffer, filesink, ring_queue, ring_sink, NULL);
+    
+    // Link static elements (rtspsrc has dynamic pads)
+    if (!gst_element_link_many(depay, parse, au_filter, tee, NULL) ||
+        !gst_element_link_many(tee, queue_buffer, filesink, NULL) ||
+        !gst_element_link_many(tee, ring_queue, ring_sink, NULL)) {
+        g_printerr("Failed to link pipeline elements for camera %s\n", id);
+        return false;
+    }
+    
+    // A camera added while the pipeline runs starts at once
+    if (GST_STATE(pipeline_elem) != GST_STATE_NULL) {
+        for (GstElement *element : elements) {
+            gst_element_sync_state_with_parent(element);
+        }
+    }
+    
+    g_print("✓ Ingest branch for camera %s created\n", id);
+    return true;
+}
+
+// Create the input pipeline for ring buffer
+GstElement* create_input_pipeline(const ReplayConfig &config, HWAccelType hw_type) {
+    GstElement *pipeline_elem = gst_pipeline_new("input-pipeline");
+    if (!pipeline_elem) {
+        g_printerr("Failed to create input pipeline\n");
+        return nullptr;
+    }
+    
+    for (const auto &camera : list_cameras()) {
+        if (!add_camera_branch(pipeline_elem, camera, config)) {
+            gst_object_unref(pipeline_elem);
+            return nullptr;
+        }
+    }
+    
+    g_print("✓ Input pipeline created successfully (%zu camera%s)\n",
+           config.cameras.size(), config.cameras.size() == 1 ? "" : "s");
+    return pipeline_elem;
+}
+
+// Ingest stall watchdog
+//
+// A camera that stops sending without closing its connection never posts
+// an error; its ring just stops growing until TCP gives up. The watchdog
+// compares each camera's last arrival with a deadline of
+// `stall_tolerance` measured frame intervals. Past the deadline it reports
+// the stall and rebuilds the camera's source in place, so recovery is
+// bounded by the deadline plus a reconnect.
+static const guint WATCHDOG_PERIOD_MS = 10;
+static const gint64 STALL_MIN_DEADLINE_US = 20000;
+static const gint64 STALL_FIRST_RETRY_US = 4 * G_USEC_PER_SEC;   // reconnect plus jitterbuffer latency
+static const gint64 STALL_MAX_RETRY_US = 30 * G_USEC_PER_SEC;
+
+struct StallState {
+    gint64 since_us;            // last arrival before the stall
+    gint64 next_rebuild_us;
+    gint64 retry_us;
+};
+
+static std::map<std::string, StallState> stalled_cameras;     // main loop only
+
+// Replace the camera's rtspsrc (and its metadata branch) with a fresh one.
+// The depayloader and everything after it stay in place.
+static void rebuild_camera_source(const std::shared_ptr<Camera> &camera) {
+    GstBin *bin = GST_BIN(pipeline);
+    std::vector<GstElement *> retired;
+    for (const char *prefix : { "source", "metadata-depay", "metadata-queue", "metadata-tap" }) {
+        gchar *name = g_strdup_printf("%s-%s", prefix, camera->id.c_str());
+        GstElement *element = gst_bin_get_by_name(bin, name);
+        g_free(name);
+        if (element) {
+            gst_element_set_locked_state(element, TRUE);
+            gst_bin_remove(bin, element);
+            retired.push_back(element);
+        }
+    }
+    // Tearing down a stalled connection can block; do it off the main loop
+    std::thread([retired] {
+        for (GstElement *element : retired) {
+            gst_element_set_state(element, GST_STATE_NULL);
+            gst_object_unref(element);
+        }
+    }).detach();
+    
+    camera->awaiting_keyframe.store(true);
+    GstElement *source = make_camera_source(camera);
+    if (!source || !gst_bin_add(bin, source) || !gst_element_sync_state_with_parent(source)) {
+        g_printerr("Failed to rebuild the source of camera %s\n", camera->id.c_str());
+    }
+}
+
+static gboolean watchdog_tick(gpointer user_data) {
+    const ReplayConfig *config = static_cast<const ReplayConfig *>(user_data);
+    if (ingest_released || config->stall_tolerance <= 0) {
+        return G_SOURCE_CONTINUE;
+    }
+    gint64 now_us = timeline_now_us();
+    for (const auto &camera : list_cameras()) {
+        gint64 last_us = camera->last_arrival_us.load();
+        gint64 interval_us = camera->frame_interval_us.load();
+        if (last_us == 0 || interval_us == 0) {
+            continue; // no stream yet
+        }
+        std::string labels = camera_label(camera->id);
+        gint64 deadline_us = std::max((gint64)(config->stall_tolerance * interval_us), STALL_MIN_DEADLINE_US);
+        auto it = stalled_cameras.find(camera->id);
+        if (now_us - last_us <= deadline_us) {
+            if (it != stalled_cameras.end()) {
+                gint64 outage_ms = (last_us - it->second.since_us) / 1000;
+                g_print("Camera %s recovered after %" G_GINT64_FORMAT " ms\n", camera->id.c_str(), outage_ms);
+                metrics.set("ingest_stalled", labels, 0);
+                metrics.set("ingest_last_outage_ms", labels, outage_ms);
+                stalled_cameras.erase(it);
+            }
+            continue;
+        }
+        
+        if (it == stalled_cameras.end()) {
+            g_printerr("Camera %s stalled: nothing for %" G_GINT64_FORMAT " ms (frame interval %.1f ms), "
+                       "rebuilding its source\n", camera->id.c_str(), (now_us - last_us) / 1000,
+                       interval_us / 1000.0);
+            metrics.add("ingest_stalls_total", labels);
+            metrics.set("ingest_stalled", labels, 1);
+            StallState state = { last_us, now_us, STALL_FIRST_RETRY_US };
+            it = stalled_cameras.emplace(camera->id, state).first;
+        }
+        if (now_us >= it->second.next_rebuild_us) {
+            rebuild_camera_source(camera);
+            metrics.add("ingest_source_rebuilds_total", labels);
+            it->second.next_rebuild_us = now_us + it->second.retry_us;
+            it->second.retry_us = std::min(it->second.retry_us * 2, STALL_MAX_RETRY_US);
+        }
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+// Output branches
+//
+// Consumers attached to a camera's running ingest: an archive sink, an
+// analytics tap, another encode. Each is a bin parsed from a launch
+// description behind a leaky queue, fed from a request pad of the camera's
+// tee, so a slow consumer drops its own buffers and never holds up the
+// ring tap. Nothing else in the pipeline changes state. On attach, the bin
+// reaches PLAYING on its own before its pad is linked, and a probe on the
+// tee pad drops buffers until the first keyframe, so the branch's decoders
+// and muxers start on a clean frame. On detach, an idle
+// probe unlinks it between two buffers and sends it an EOS, so muxers
+// finish their files; the bin is removed once the EOS has reached its
+// sinks, or after BRANCH_EOS_TIMEOUT_MS.
+static const guint64 BRANCH_QUEUE_MS = 2000;
+static const guint BRANCH_EOS_TIMEOUT_MS = 5000;
+
+struct OutputBranch {
+    std::string camera_id;
+    std::string name;
+    std::string description;
+    GstElement *bin;
+    GstPad *tee_pad;
+    gint64 detach_started_us;
+    std::atomic<int> sinks_pending;     // sinks the detach EOS has not reached
+    std::atomic<bool> finished;
+    guint eos_timeout;
+};
+
+static std::map<std::string, std::shared_ptr<OutputBranch>> output_branches;   // main loop only
+
+static std::string branch_key(const std::string &camera_id, const std::string &name) {
+    return camera_id + "/" + name;
+}
+
+static void delete_branch_ref(gpointer data) {
+    delete static_cast<std::shared_ptr<OutputBranch> *>(data);
+}
+
+// A sink that prerolls on its own would take the running pipeline out of
+// PLAYING until it does
+static void disable_sink_preroll(const GValue *item, gpointer) {
+    GObject *sink = G_OBJECT(g_value_get_object(item));
+    if (g_object_class_find_property(G_OBJECT_GET_CLASS(sink), "async")) {
+        g_object_set(sink, "async", FALSE, NULL);
+    }
+}
+
+// Removed (letting the buffer through) at the first keyframe
+static GstPadProbeReturn drop_until_keyframe(GstPad *, GstPadProbeInfo *info, gpointer) {
+    if (GST_BUFFER_FLAG_IS_SET(GST_PAD_PROBE_INFO_BUFFER(info), GST_BUFFER_FLAG_DELTA_UNIT)) {
+        return GST_PAD_PROBE_DROP;
+    }
+    return GST_PAD_PROBE_REMOVE;
+}
+
+static bool attach_output_branch(const std::string &camera_id, const std::string &name,
+                                 const std::string &description) {
+    gint64 started_us = g_get_monotonic_time();
+    std::string key = branch_key(camera_id, name);
+    if (!find_camera(camera_id)) {
+        g_printerr("Unknown camera '%s'\n", camera_id.c_str());
+        return false;
+    }
+    if (output_branches.count(key)) {
+        g_printerr("Branch %s is already attached (or still detaching)\n", key.c_str());
+        return false;
+    }
+    gchar *tee_name = g_strdup_printf("split-%s", camera_id.c_str());
+    GstElement *tee = gst_bin_get_by_name(GST_BIN(pipeline), tee_name);
+    g_free(tee_name);
+    if (!tee) {
+        g_printerr("Camera %s has no running ingest\n", camera_id.c_str());
+        return false;
+    }
+    
+    gchar *launch = g_strdup_printf("queue leaky=downstream max-size-buffers=0 max-size-bytes=0 "
+                                    "max-size-time=%" G_GUINT64_FORMAT " ! %s",
+                                    BRANCH_QUEUE_MS * GST_MSECOND, description.c_str());
+    GError *error = nullptr;
+    GstElement *bin = gst_parse_bin_from_description(launch, TRUE, &error);
+    g_free(launch);
+    if (!bin) {
+        g_printerr("Invalid branch '%s': %s\n", description.c_str(), error ? error->message : "unknown error");
+        g_clear_error(&error);
+        gst_object_unref(tee);
+        return false;
+    }
+    gchar *bin_name = g_strdup_printf("branch-%s-%s", camera_id.c_str(), name.c_str());
+    gst_element_set_name(bin, bin_name);
+    g_free(bin_name);
+    GstIterator *sinks = gst_bin_iterate_sinks(GST_BIN(bin));
+    gst_iterator_foreach(sinks, disable_sink_preroll, NULL);
+    gst_iterator_free(sinks);
+    
+    auto branch = std::make_shared<OutputBranch>();
+    branch->camera_id = camera_id;
+    branch->name = name;
+    branch->description = description;
+    branch->bin = GST_ELEMENT(gst_object_ref(bin));
+    branch->tee_pad = nullptr;
+    branch->detach_started_us = 0;
+    branch->sinks_pending = 0;
+    branch->finished = false;
+    branch->eos_timeout = 0;
+    
+    GstPad *sink_pad = nullptr;
+    bool attached = gst_bin_add(GST_BIN(pipeline), bin) && gst_element_sync_state_with_parent(bin);
+    if (attached) {
+        branch->tee_pad = gst_element_request_pad_simple(tee, "src_%u");
+        if (branch->tee_pad) {
+            gst_pad_add_probe(branch->tee_pad, GST_PAD_PROBE_TYPE_BUFFER, drop_until_keyframe, NULL, NULL);
+        }
+        sink_pad = gst_element_get_static_pad(bin, "sink");
+        attached = branch->tee_pad && sink_pad && GST_PAD_LINK_SUCCESSFUL(gst_pad_link(branch->tee_pad, sink_pad));
+    }
+    if (sink_pad) gst_object_unref(sink_pad);
+    if (!attached) {
+        g_printerr("Cannot attach branch %s to camera %s\n", name.c_str(), camera_id.c_str());
+        if (branch->tee_pad) {
+            gst_element_release_request_pad(tee, branch->tee_pad);
+            gst_object_unref(branch->tee_pad);
+        }
+        gst_element_set_locked_state(bin, TRUE);
+        gst_element_set_state(bin, GST_STATE_NULL);
+        gst_bin_remove(GST_BIN(pipeline), bin);
+        gst_object_unref(branch->bin);
+        gst_object_unref(tee);
+        return false;
+    }
+    gst_object_unref(tee);
+    
+    output_branches[key] = branch;
+    g_print("✓ Branch %s attached to camera %s in %.1f ms\n", name.c_str(), camera_id.c_str(),
+            (g_get_monotonic_time() - started_us) / 1000.0);
+    return true;
+}
+
+static void finish_branch_detach(const std::shared_ptr<OutputBranch> &branch) {
+    if (branch->finished.exchange(true)) {
+        return;
+    }
+    if (branch->eos_timeout) {
+        g_source_remove(branch->eos_timeout);
+        branch->eos_timeout = 0;
+    }
+    GstElement *tee = GST_ELEMENT(gst_pad_get_parent(branch->tee_pad));
+    if (tee) {
+        gst_element_release_request_pad(tee, branch->tee_pad);
+        gst_object_unref(tee);
+    }
+    gst_object_unref(branch->tee_pad);
+    
+    GstElement *bin = branch->bin;
+    gst_element_set_locked_state(bin, TRUE);
+    gst_bin_remove(GST_BIN(pipeline), bin);
+    std::thread([bin] {
+        gst_element_set_state(bin, GST_STATE_NULL);
+        gst_object_unref(bin);
+    }).detach();
+    output_branches.erase(branch_key(branch->camera_id, branch->name));
+    g_print("✓ Branch %s detached from camera %s in %.1f ms\n", branch->name.c_str(), branch->camera_id.c_str(),
+            (g_get_monotonic_time() - branch->detach_started_us) / 1000.0);
+}
+
+static gboolean on_branch_drained(gpointer data) {
+    finish_branch_detach(*static_cast<std::shared_ptr<OutputBranch> *>(data));
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean on_branch_eos_timeout(gpointer data) {
+    std::shared_ptr<OutputBranch> branch = *static_cast<std::shared_ptr<OutputBranch> *>(data);
+    branch->eos_timeout = 0;
+    g_printerr("Branch %s did not drain in %u ms; removing it\n", branch->name.c_str(), BRANCH_EOS_TIMEOUT_MS);
+    finish_branch_detach(branch);
+    return G_SOURCE_REMOVE;
+}
+
+static GstPadProbeReturn on_branch_sink_event(GstPad *, GstPadProbeInfo *info, gpointer user_data) {
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) != GST_EVENT_EOS) {
+        return GST_PAD_PROBE_OK;
+    }
+    std::shared_ptr<OutputBranch> branch = *static_cast<std::shared_ptr<OutputBranch> *>(user_data);
+    if (--branch->sinks_pending == 0) {
+        g_idle_add_full(G_PRIORITY_DEFAULT, on_branch_drained, new std::shared_ptr<OutputBranch>(branch),
+                        delete_branch_ref);
+    }
+    return GST_PAD_PROBE_REMOVE;
+}
+
+static void watch_branch_sink(const GValue *item, gpointer user_data) {
+    std::shared_ptr<OutputBranch> &branch = *static_cast<std::shared_ptr<OutputBranch> *>(user_data);
+    GstPad *pad = gst_element_get_static_pad(GST_ELEMENT(g_value_get_object(item)), "sink");
+    if (pad) {
+        branch->sinks_pending++;
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, on_branch_sink_event,
+                          new std::shared_ptr<OutputBranch>(branch), delete_branch_ref);
+        gst_object_unref(pad);
+    }
+}
+
+// Runs once the tee's pad is between buffers, in whichever thread that is
+static GstPadProbeReturn unlink_branch(GstPad *pad, GstPadProbeInfo *, gpointer) {
+    GstPad *peer = gst_pad_get_peer(pad);
+    if (peer) {
+        gst_pad_unlink(pad, peer);
+        gst_pad_send_event(peer, gst_event_new_eos());
+        gst_object_unref(peer);
+    }
+    return GST_PAD_PROBE_REMOVE;
+}
+
+static bool detach_output_branch(const std::string &camera_id, const std::string &name) {
+    auto it = output_branches.find(branch_key(camera_id, name));
+    if (it == output_branches.end() || it->second->detach_started_us) {
+        g_printerr("No branch %s on camera %s\n", name.c_str(), camera_id.c_str());
+        return false;
+    }
+    std::shared_ptr<OutputBranch> branch = it->second;
+    branch->detach_started_us = g_get_monotonic_time();
+    
+    // One extra count so the last sink cannot finish before all are watched
+    branch->sinks_pending = 1;
+    GstIterator *sinks = gst_bin_iterate_sinks(GST_BIN(branch->bin));
+    gst_iterator_foreach(sinks, watch_branch_sink, &branch);
+    gst_iterator_free(sinks);
+    branch->eos_timeout = g_timeout_add_full(G_PRIORITY_DEFAULT, BRANCH_EOS_TIMEOUT_MS, on_branch_eos_timeout,
+                                             new std::shared_ptr<OutputBranch>(branch), delete_branch_ref);
+    gst_pad_add_probe(branch->tee_pad, GST_PAD_PROBE_TYPE_IDLE, unlink_branch, NULL, NULL);
+    if (--branch->sinks_pending == 0) {
+        finish_branch_detach(branch); // a bin without sinks
+    }
+    return true;
+}
+
+// The camera is going away with its tee: its branches go without an EOS
+static void take_camera_output_branches(const std::string &camera_id, std::vector<GstElement *> &retired) {
+    for (auto it = output_branches.begin(); it != output_branches.end();) {
+        std::shared_ptr<OutputBranch> branch = it->second;
+        if (branch->camera_id != camera_id) {
+            ++it;
+            continue;
+        }
+        branch->finished = true;
+        if (branch->eos_timeout) {
+            g_source_remove(branch->eos_timeout);
+        }
+        gst_object_unref(branch->tee_pad);
+        gst_element_set_locked_state(branch->bin, TRUE);
+        gst_bin_remove(GST_BIN(pipeline), branch->bin);
+        retired.push_back(branch->bin);
+        it = output_branches.erase(it);
+    }
+}
+
+// Live camera changes
+//
+// A configuration reload adds a camera with a new ring and ingest branch
+// while the pipeline plays. A removed camera leaves the registry at once,
+// so no new reader finds it; its ring drains as the readers that already
+// hold it (mount feeders, exports) finish, and is freed with the last one.
+// Other cameras' branches and sessions are not touched.
+static const char *const CAMERA_ELEMENT_PREFIXES[] = {
+    "source", "depay", "parse", "au-filter", "split", "ring-buffer", "output", "ring-queue", "ring-tap",
+    "metadata-depay", "metadata-queue", "metadata-tap"
+};
+
+// A successor writes spill files of its own: the predecessor's /replay
+// viewers are still reading the old ones, which opening them would truncate
+static std::string spill_suffix;
+static std::string replay_camera_id;    // the camera the /replay mount serves, fixed at startup
+static std::string replay_spill_path;   // the spill file the /replay mount serves
+
+// The /replay camera keeps the historical spill file, also when it is
+// removed and added back; no other camera ever writes it
+static std::string camera_spill_path(const std::string &camera_id) {
+    return (camera_id == replay_camera_id ? std::string("/tmp/replay-buffer") : "/tmp/replay-buffer-" + camera_id) +
+           spill_suffix + ".h264";
+}
+
+static void remove_camera_branch(const std::shared_ptr<Camera> &camera) {
+    GstBin *bin = GST_BIN(pipeline);
+    std::vector<GstElement *> retired;
+    for (const char *prefix : CAMERA_ELEMENT_PREFIXES) {
+        gchar *name = g_strdup_printf("%s-%s", prefix, camera->id.c_str());
+        GstElement *element = gst_bin_get_by_name(bin, name);
+        g_free(name);
+        if (element) {
+            gst_element_set_locked_state(element, TRUE);
+            gst_bin_remove(bin, element);
+            retired.push_back(element);
+        }
+    }
+    take_camera_output_branches(camera->id, retired);
+    // The streaming threads call back into the camera until its elements
+    // have stopped, so they keep it alive until then
+    std::thread([retired, camera] {
+        for (GstElement *element : retired) {
+            gst_element_set_state(element, GST_STATE_NULL);
+            gst_object_unref(element);
+        }
+    }).detach();
+}
+
+static bool add_camera(const CameraConfig &camera_config, const ReplayConfig &config) {
+    auto camera = std::make_shared<Camera>(camera_config, config);
+    camera->spill_path = camera_spill_path(camera->id);
+    if (!add_camera_branch(pipeline, camera, config)) {
+        remove_camera_branch(camera);
+        return false;
+    }
+    std::lock_guard<std::mutex> guard(cameras_lock);
+    cameras.push_back(camera);
+    return true;
+}
+
+static void remove_camera(const std::string &camera_id) {
+    std::shared_ptr<Camera> camera;
+    {
+        std::lock_guard<std::mutex> guard(cameras_lock);
+        auto it = std::find_if(cameras.begin(), cameras.end(),
+                               [&](const std::shared_ptr<Camera> &c) { return c->id == camera_id; });
+        if (it == cameras.end()) {
+            return;
+        }
+        camera = *it;
+        cameras.erase(it);
+    }
+    remove_camera_branch(camera);
+    stalled_cameras.erase(camera_id);
+    metrics.remove(camera_label(camera_id));
+    g_print("✓ Camera %s removed; its ring stays readable until current readers finish\n", camera_id.c_str());
+    if (camera_id == replay_camera_id) {
+        g_printerr("  the replay mount serves what camera %s recorded until it is added back\n", camera_id.c_str());
+    }
+}
+
+// Point a camera at a new URL, keeping its ring
+static void set_camera_url(const std::shared_ptr<Camera> &camera, const std::string &rtsp_url) {
+    camera->rtsp_url = rtsp_url;
+    rebuild_camera_source(camera);
+    g_print("✓ Camera %s now reads %s\n", camera->id.c_str(), rtsp_url.c_str());
+}
+
+// SEI for the metadata ring entries [from_seq, end_seq); entries that aged
+// out are skipped
+static std::vector<guint8> metadata_sei(const FrameRing &metadata, guint64 from_seq, guint64 end_seq) {
+    std::vector<guint8> nal_units;
+    for (guint64 seq = std::max(from_seq, metadata.tail()); seq < end_seq; seq++) {
+        RingFrame entry;
+        GstBuffer *packet = metadata.read_frame(seq, entry) ? metadata.read_buffer(entry) : nullptr;
+        GstMapInfo map;
+        if (!packet) {
+            continue;
+        }
+        if (gst_buffer_map(packet, &map, GST_MAP_READ)) {
+            const guint8 *uuid = (entry.flags & RING_FRAME_METADATA_KLV) ?
+                                 KLV_METADATA_SEI_UUID : ONVIF_METADATA_SEI_UUID;
+            std::vector<guint8> sei = h264_user_data_sei(uuid, map.data, map.size);
+            nal_units.insert(nal_units.end(), sei.begin(), sei.end());
+            gst_buffer_unmap(packet, &map);
+        }
+        gst_buffer_unref(packet);
+    }
+    return nal_units;
+}
+
+// GOP cache
+//
+// Ring readers work in whole GOPs. Concurrent readers of the same camera
+// and GOP share one copy: the first caller reads it out of the ring, the
+// others wait for that read and get the same refcounted buffers. A byte
+// budget of recently read GOPs stays alive so back-to-back exports of the
+// same moment hit as well.
+struct Gop {
+    std::string camera_id;
+    guint64 first_seq;
+    bool complete;                          // the next GOP had started when this one was read
+    std::vector<GstBuffer *> frames;        // decode order, ring timestamps
+    std::vector<gint64> capture_times_us;
+    gsize bytes;
+    gsize clean_from;                       // frames before this are still refreshing (intra-refresh)
+    
+    Gop() : first_seq(0), complete(false), bytes(0), clean_from(0) {}
+    ~Gop() {
+        for (GstBuffer *frame : frames) gst_buffer_unref(frame);
+    }
+    
+    guint64 end_seq() const { return first_seq + frames.size(); }
+};
+
+typedef std::shared_ptr<const Gop> GopRef;
+
+// Copy one GOP out of a camera ring. Returns nullptr once any of it aged out.
+// Metadata that arrived since the previous frame rides along in SEI.
+static GopRef read_gop(const Camera &camera, guint64 gop_seq) {
+    auto gop = std::make_shared<Gop>();
+    gop->camera_id = camera.id;
+    gop->first_seq = gop_seq;
+    
+    RingFrame previous;
+    guint64 metadata_seq = gop_seq > 0 && camera.ring->read_frame(gop_seq - 1, previous) ?
+                           previous.metadata_seq : G_MAXUINT64;
+    for (guint64 seq = gop_seq; seq < camera.ring->head(); seq++) {
+        RingFrame frame;
+        if (!camera.ring->read_frame(seq, frame)) {
+            return nullptr;
+        }
+        if (frame.gop_seq != gop_seq) {
+            gop->complete = true;
+            break;
+        }
+        GstBuffer *buffer = camera.ring->read_buffer(frame);
+        if (!buffer) {
+            return nullptr;
+        }
+        if (frame.flags & RING_FRAME_REFRESHING) {
+            gop->clean_from = gop->frames.size() + 1;
+        }
+        if (metadata_seq < frame.metadata_seq) {
+            buffer = insert_before_first_slice(buffer, metadata_sei(*camera.metadata_ring, metadata_seq,
+                                                                    frame.metadata_seq));
+        }
+        metadata_seq = frame.metadata_seq;
+        gop->frames.push_back(buffer);
+        gop->capture_times_us.push_back(frame.capture_time_us);
+        gop->bytes += gst_buffer_get_size(buffer);
+    }
+    
+    if (gop->frames.empty()) {
+        return nullptr;
+    }
+    return gop;
+}
+
+class GopCache {
+public:
+    explicit GopCache(gsize retain_bytes)
+        : retain_bytes(retain_bytes), retained_bytes(0), ring_reads(0), shared_reads(0) {}
+
+    // Shared GOP of `camera` starting at `gop_seq`, or nullptr if it is no
+    // longer buffered.
+    GopRef acquire(const std::shared_ptr<Camera> &camera, guint64 gop_seq) {
+        Key key(camera->id, camera->generation, gop_seq);
+        std::promise<GopRef> promise;
+        std::shared_future<GopRef> pending;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto it = entries.find(key);
+            if (it != entries.end()) {
+                if (GopRef gop = it->second.gop.lock()) {
+                    shared_reads++;
+                    return gop;
+                }
+                pending = it->second.pending;
+            }
+            if (pending.valid()) {
+                shared_reads++;
+            } else {
+                entries[key].pending = promise.get_future().share();
+                ring_reads++;
+            }
+        }
+        if (pending.valid()) {
+            return pending.get();
+        }
+        
+        GopRef gop = read_gop(*camera, gop_seq);
+        promise.set_value(gop);
+        
+        std::lock_guard<std::mutex> guard(lock);
+        if (gop && gop->complete) {
+            Entry &entry = entries[key];
+            entry.pending = std::shared_future<GopRef>();
+            entry.gop = gop;
+            retain(gop);
+        } else {
+            // Partial GOP at the live edge (or a failed read): never cached
+            entries.erase(key);
+        }
+        if (entries.size() > 4096) {
+            prune();
+        }
+        return gop;
+    }
+
+    void stats(guint64 &reads, guint64 &shared) {
+        std::lock_guard<std::mutex> guard(lock);
+        reads = ring_reads;
+        shared = shared_reads;
+    }
+
+private:
+    typedef std::tuple<std::string, guint64, guint64> Key;   // camera id, generation, GOP
+    struct Entry {
+        std::weak_ptr<const Gop> gop;
+        std::shared_future<GopRef> pending;
+    };
+
+    void retain(const GopRef &gop) {
+        recent.push_back(gop);
+        retained_bytes += gop->bytes;
+        while (retained_bytes > retain_bytes && !recent.empty()) {
+            retained_bytes -= recent.front()->bytes;
+            recent.pop_front();
+        }
+    }
+
+    void prune() {
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (!it->second.pending.valid() && it->second.gop.expired()) {
+                it = entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    std::mutex lock;
+    std::map<Key, Entry> entries;
+    std::deque<GopRef> recent;
+    gsize retain_bytes;
+    gsize retained_bytes;
+    guint64 ring_reads;
+    guint64 shared_reads;
+};
+
+static GopCache gop_cache(64 * 1024 * 1024);
+
+// Shift a ring timestamp so that `base` becomes zero
+static GstClockTime rebase_time(GstClockTime time, GstClockTime base) {
+    if (!GST_CLOCK_TIME_IS_VALID(time) || !GST_CLOCK_TIME_IS_VALID(base)) {
+        return time;
+    }
+    return time > base ? time - base : 0;
+}
+
+// Clip rendering helpers
+
+// Average bitrate of a run of access units, so re-encodes match the source
+static guint estimate_bitrate_kbps(const std::vector<GstBuffer *> &frames) {
+    gsize bytes = 0;
+    GstClockTime first = GST_CLOCK_TIME_NONE;
+    GstClockTime last = GST_CLOCK_TIME_NONE;
+    for (GstBuffer *frame : frames) {
+        bytes += gst_buffer_get_size(frame);
+        GstClockTime pts = GST_BUFFER_PTS(frame);
+        if (!GST_CLOCK_TIME_IS_VALID(pts)) continue;
+        if (!GST_CLOCK_TIME_IS_VALID(first) || pts < first) first = pts;
+        if (!GST_CLOCK_TIME_IS_VALID(last) || pts > last) last = pts;
+    }
+    if (!GST_CLOCK_TIME_IS_VALID(first) || last <= first) {
+        return 4000;
+    }
+    guint64 kbps = gst_util_uint64_scale(bytes * 8, GST_SECOND, (last - first) * 1000);
+    return (guint)std::min<guint64>(std::max<guint64>(kbps, 500), 50000);
+}
+
+// Pull every sample out of `sink` until EOS. Returns false if the pipeline
+// posted an error first.
+static bool drain_appsink(GstElement *pipeline_elem, GstAppSink *sink, std::vector<GstBuffer *> &output) {
+    GstBus *bus = gst_element_get_bus(pipeline_elem);
+    bool ok = true;
+    while (!gst_app_sink_is_eos(sink)) {
+        GstSample *sample = gst_app_sink_try_pull_sample(sink, 100 * GST_MSECOND);
+        if (sample) {
+            output.push_back(gst_buffer_ref(gst_sample_get_buffer(sample)));
+            gst_sample_unref(sample);
+            continue;
+        }
+        GstMessage *message = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+        if (message) {
+            gst_message_unref(message);
+            ok = false;
+            break;
+        }
+    }
+    gst_object_unref(bus);
+    return ok;
+}
+
+// Codec pipeline pool
+//
+// decode_frames, encode_frames and reencode_frames each run a short
+// pipeline per GOP or clip. Building one costs element lookups and opening
+// the codec, which for hardware codecs means a device context. A finished
+// pipeline is parked in READY: its elements stay linked and opened, while
+// EOS, queued data and negotiated caps are cleared. The next run with the
+// same key (pipeline kind and codec elements) takes it and only sets its
+// caps and encoder settings again. At most CODEC_POOL_IDLE_PER_KEY wait per
+// key; a pipeline that failed is dropped instead of returned.
+//
+// The transcoding mounts' session encoders (videoconvert ! encoder !
+// profile capsfilter bins) are pooled the same way, keyed by encoder,
+// profile, resolution and bitrate: ReplayMediaFactory borrows one for each
+// new media and takes it back out of the media when it is unprepared.
+//
+// What READY keeps depends on the codec: hardware encoders and decoders
+// open their device in NULL->READY and keep it, while x264enc and
+// avdec_h264 set the codec up again on every start, so for them the pool
+// saves building, linking and configuring the elements only.
+static const size_t CODEC_POOL_IDLE_PER_KEY = 4;
+
+class CodecPipelinePool {
+public:
+    typedef std::function<GstElement *()> Builder;
+    
+    CodecPipelinePool() : closed(false) {}
+    
+    // An idle pipeline for `key`, or a new one from `build` (null if that fails)
+    GstElement* acquire(const std::string &key, const Builder &build) {
+        std::string labels = "pipeline=\"" + key + "\"";
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            std::vector<GstElement *> &parked = idle[key];
+            if (!parked.empty()) {
+                GstElement *pipeline_elem = parked.back();
+                parked.pop_back();
+                metrics.add("codec_pool_reused_total", labels);
+                metrics.set("codec_pool_idle", labels, (gint64)parked.size());
+                return pipeline_elem;
+            }
+        }
+        metrics.add("codec_pool_built_total", labels);
+        return build();
+    }
+    
+    // Park `pipeline_elem` for the next run, or tear it down when it failed
+    // or enough are parked
+    void release(const std::string &key, GstElement *pipeline_elem, bool reusable) {
+        if (reusable && gst_element_set_state(pipeline_elem, GST_STATE_READY) != GST_STATE_CHANGE_FAILURE) {
+            // Nothing watches these buses; drop what the run posted. A
+            // session encoder bin taken out of its media has none.
+            GstBus *bus = gst_element_get_bus(pipeline_elem);
+            if (bus) {
+                gst_bus_set_flushing(bus, TRUE);
+                gst_bus_set_flushing(bus, FALSE);
+                gst_object_unref(bus);
+            }
+            
+            std::lock_guard<std::mutex> guard(lock);
+            std::vector<GstElement *> &parked = idle[key];
+            if (!closed && parked.size() < CODEC_POOL_IDLE_PER_KEY) {
+                parked.push_back(pipeline_elem);
+                metrics.set("codec_pool_idle", "pipeline=\"" + key + "\"", (gint64)parked.size());
+                return;
+            }
+        }
+        gst_element_set_state(pipeline_elem, GST_STATE_NULL);
+        gst_object_unref(pipeline_elem);
+    }
+    
+    // At shutdown: tear down the parked pipelines, and from now on every
+    // released one
+    void close() {
+        std::map<std::string, std::vector<GstElement *>> parked;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            closed = true;
+            parked.swap(idle);
+        }
+        for (const auto &entry : parked) {
+            for (GstElement *pipeline_elem : entry.second) {
+                gst_element_set_state(pipeline_elem, GST_STATE_NULL);
+                gst_object_unref(pipeline_elem);
+            }
+        }
+    }
+
+private:
+    std::mutex lock;
+    std::map<std::string, std::vector<GstElement *>> idle;
+    bool closed;
+};
+
+static CodecPipelinePool codec_pool;
+
+// Element `name` of a pooled pipeline (a borrowed pointer; the pipeline
+// holds it)
+static GstElement* pooled_element(GstElement *pipeline_elem, const char *name) {
+    GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline_elem), name);
+    if (element) {
+        gst_object_unref(element);
+    }
+    return element;
+}
+
+struct PtsWindow {
+    GstClockTime from_pts;
+    GstClockTime to_pts;
+};
+
+static GstPadProbeReturn drop_outside_window(GstPad *, GstPadProbeInfo *info, gpointer user_data) {
+    const PtsWindow *window = static_cast<const PtsWindow *>(user_data);
+    GstClockTime pts = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+    if (GST_CLOCK_TIME_IS_VALID(pts) && (pts < window->from_pts || pts >= window->to_pts)) {
+        return GST_PAD_PROBE_DROP;
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+// Decode a self-contained run of access units (starting on a random access
+// point) and re-encode the frames presented in [from_pts, to_pts) as one
+// closed GOP. The output keeps the source timestamps.
+static bool reencode_frames(const std::vector<GstBuffer *> &input, GstCaps *caps,
+                            GstClockTime from_pts, GstClockTime to_pts,
+                            std::vector<GstBuffer *> &output) {
+    std::string key = std::string("reencode/") + get_decoder_element(replay_hw_type) + "/" +
+                      get_encoder_element(replay_hw_type);
+    GstElement *reencode = codec_pool.acquire(key, [] () -> GstElement * {
+        GstElement *bin = gst_pipeline_new("reencode");
+        GstElement *elements[] = {
+            gst_element_factory_make("appsrc", "src"),
+            gst_element_factory_make("h264parse", "parse"),
+            gst_element_factory_make(get_decoder_element(replay_hw_type), "decoder"),
+            gst_element_factory_make("videoconvert", "convert"),
+            gst_element_factory_make(get_encoder_element(replay_hw_type), "encoder"),
+            gst_element_factory_make("h264parse", "out-parse"),
+            gst_element_factory_make("capsfilter", "out-filter"),
+            gst_element_factory_make("appsink", "sink")
+        };
+        bool all_created = bin != nullptr;
+        for (GstElement *element : elements) {
+            all_created = all_created && element != nullptr;
+        }
+        if (!all_created) {
+            g_printerr("Failed to create re-encode elements\n");
+            for (GstElement *element : elements) {
+                if (element) gst_object_unref(element);
+            }
+            if (bin) gst_object_unref(bin);
+            return nullptr;
+        }
+        
+        g_object_set(G_OBJECT(elements[5]), "config-interval", -1, NULL);
+        GstCaps *au_caps = gst_caps_from_string("video/x-h264,stream-format=byte-stream,alignment=au");
+        g_object_set(G_OBJECT(elements[6]), "caps", au_caps, NULL);
+        gst_caps_unref(au_caps);
+        g_object_set(G_OBJECT(elements[7]), "sync", FALSE, NULL);
+        
+        for (GstElement *element : elements) {
+            gst_bin_add(GST_BIN(bin), element);
+        }
+        for (size_t i = 1; i < G_N_ELEMENTS(elements); i++) {
+            if (!gst_element_link(elements[i - 1], elements[i])) {
+                g_printerr("Failed to link re-encode pipeline\n");
+                gst_object_unref(bin);
+                return nullptr;
+            }
+        }
+        return bin;
+    });
+    if (!reencode) {
+        return false;
+    }
+    
+    GstElement *appsrc = pooled_element(reencode, "src");
+    GstElement *encoder = pooled_element(reencode, "encoder");
+    GstElement *appsink = pooled_element(reencode, "sink");
+    g_object_set(G_OBJECT(appsrc), "caps", caps, "format", GST_FORMAT_TIME, NULL);
+    configure_encoder(encoder, replay_hw_type, estimate_bitrate_kbps(input), (guint)input.size() + 1);
+    
+    // Frames outside the window are decoded (they are references) but
+    // never reach the encoder
+    PtsWindow window = { from_pts, to_pts };
+    GstPad *encoder_sink = gst_element_get_static_pad(encoder, "sink");
+    gulong probe = gst_pad_add_probe(encoder_sink, GST_PAD_PROBE_TYPE_BUFFER, drop_outside_window, &window, NULL);
+    
+    gst_element_set_state(reencode, GST_STATE_PLAYING);
+    for (GstBuffer *frame : input) {
+        gst_app_src_push_buffer(GST_APP_SRC(appsrc), gst_buffer_copy(frame));
+    }
+    gst_app_src_end_of_stream(GST_APP_SRC(appsrc));
+    
+    bool ok = drain_appsink(reencode, GST_APP_SINK(appsink), output);
+    gst_pad_remove_probe(encoder_sink, probe);
+    gst_object_unref(encoder_sink);
+    codec_pool.release(key, reencode, ok);
+    return ok && !output.empty();
+}
+
+// Speed ramps
+//
+// A speed curve gives the playback rate at points of a clip (seconds after
+// its cut frame), interpolated linearly in between and held past either
+// end: "0:1,2:0.25,5:0.25,6:1". A single number is a constant rate. Output
+// time is the integral of 1/rate over source time, which has a closed form
+// on each linear segment, so mapping is exact in both directions.
+static bool parse_ramp_render(const std::string &name, SpeedRampRender &render) {
+    if (name == "retime") render = RAMP_RETIME;
+    else if (name == "repeat") render = RAMP_REPEAT;
+    else if (name == "blend") render = RAMP_BLEND;
+    else if (name == "interpolate") render = RAMP_INTERPOLATE;
+    else return false;
+    return true;
+}
+
+class SpeedCurve {
+public:
+    static std::shared_ptr<const SpeedCurve> parse(const std::string &text) {
+        std::shared_ptr<SpeedCurve> curve(new SpeedCurve());
+        gchar **items = g_strsplit(text.c_str(), ",", -1);
+        bool ok = items[0] != nullptr;
+        for (gchar **item = items; ok && *item; item++) {
+            Point point = { 0.0, 0.0, 0.0 };
+            gchar *end = nullptr;
+            const gchar *rate = strchr(*item, ':');
+            if (rate) {
+                point.source = g_ascii_strtod(*item, &end);
+                ok = end == rate && point.source >= 0.0 &&
+                     (curve->points.empty() || point.source > curve->points.back().source);
+                rate++;
+            } else {
+                ok = items[1] == nullptr;
+                rate = *item;
+            }
+            point.rate = g_ascii_strtod(rate, &end);
+            ok = ok && end != rate && *end == '\0' && point.rate > 0.0;
+            point.rate = std::min(std::max(point.rate, 0.05), 16.0);
+            curve->points.push_back(point);
+        }
+        g_strfreev(items);
+        if (!ok) {
+            return nullptr;
+        }
+        
+        curve->points[0].output = curve->points[0].source / curve->points[0].rate;
+        for (size_t i = 1; i < curve->points.size(); i++) {
+            const Point &a = curve->points[i - 1];
+            Point &b = curve->points[i];
+            b.output = a.output + integral(a.rate, slope(a, b), b.source - a.source);
+        }
+        return curve;
+    }
+    
+    // Seconds after the cut in the output for seconds after the cut in the
+    // source (either may be negative: before the cut the first rate holds)
+    gdouble output_offset(gdouble source) const {
+        size_t i = segment([source](const Point &p) { return p.source; }, source);
+        const Point &a = points[i];
+        if (source <= a.source || i + 1 == points.size()) {
+            return a.output + (source - a.source) / a.rate;
+        }
+        return a.output + integral(a.rate, slope(a, points[i + 1]), source - a.source);
+    }
+    
+    gdouble source_offset(gdouble output) const {
+        size_t i = segment([](const Point &p) { return p.output; }, output);
+        const Point &a = points[i];
+        if (output <= a.output || i + 1 == points.size()) {
+            return a.source + (output - a.output) * a.rate;
+        }
+        gdouble k = slope(a, points[i + 1]);
+        gdouble dt = output - a.output;
+        return a.source + (std::fabs(k) < 1e-9 ? dt * a.rate : a.rate * std::expm1(k * dt) / k);
+    }
+
+private:
+    struct Point {
+        gdouble source;
+        gdouble rate;
+        gdouble output;
+    };
+    
+    static gdouble slope(const Point &a, const Point &b) {
+        return (b.rate - a.rate) / (b.source - a.source);
+    }
+    
+    // Integral of dx / (rate + k x) over [0, ds]
+    static gdouble integral(gdouble rate, gdouble k, gdouble ds) {
+        return std::fabs(k) < 1e-9 ? ds / rate : std::log1p(k * ds / rate) / k;
+    }
+    
+    // Last point at or before `value` on the axis picked by `key` (0 if none)
+    template <typename Key>
+    size_t segment(Key key, gdouble value) const {
+        size_t i = 0;
+        while (i + 1 < points.size() && key(points[i + 1]) <= value) {
+            i++;
+        }
+        return i;
+    }
+    
+    std::vector<Point> points;
+};
+
+// Export formats
+enum ExportFormat {
+    EXPORT_FORMAT_MP4,
+    EXPORT_FORMAT_MKV,
+    EXPORT_FORMAT_TS,
+    EXPORT_FORMAT_H264
+};
+
+static bool parse_export_format(const std::string &name, ExportFormat &format) {
+    if (name == "mp4") format = EXPORT_FORMAT_MP4;
+    else if (name == "mkv") format = EXPORT_FORMAT_MKV;
+    else if (name == "ts") format = EXPORT_FORMAT_TS;
+    else if (name == "h264") format = EXPORT_FORMAT_H264;
+    else return false;
+    return true;
+}
+
+static const char* export_format_extension(ExportFormat format) {
+    switch (format) {
+        case EXPORT_FORMAT_MP4: return "mp4";
+        case EXPORT_FORMAT_MKV: return "mkv";
+        case EXPORT_FORMAT_TS: return "ts";
+        default: return "h264";
+    }
+}
+
+// Muxer element for a format (nullptr: raw byte-stream)
+static const char* export_format_muxer(ExportFormat format) {
+    switch (format) {
+        case EXPORT_FORMAT_MP4: return "mp4mux";
+        case EXPORT_FORMAT_MKV: return "matroskamux";
+        case EXPORT_FORMAT_TS: return "mpegtsmux";
+        default: return nullptr;
+    }
+}
+
+// Formats that can carry SPS/PPS changing mid-track, which frame-accurate
+// cuts produce (re-encoded head followed by camera GOPs)
+static bool export_format_allows_inband_parameters(ExportFormat format) {
+    return format != EXPORT_FORMAT_MKV;
+}
+
+// Export job queue
+enum ExportState {
+    EXPORT_QUEUED,
+    EXPORT_RUNNING,
+    EXPORT_DONE,
+    EXPORT_FAILED
+};
+
+static const char* export_state_name(ExportState state) {
+    switch (state) {
+        case EXPORT_QUEUED: return "queued";
+        case EXPORT_RUNNING: return "running";
+        case EXPORT_DONE: return "done";
+        default: return "failed";
+    }
+}
+
+struct ExportJob {
+    guint id;
+    std::vector<std::string> camera_ids;    // more than one: synchronized tracks in one file
+    gint64 start_us;                        // replay timeline
+    gint64 end_us;
+    bool frame_accurate;                    // cut on the frames nearest start/end, not the preceding keyframe
+    ExportFormat format;
+    std::string output_path;
+    std::shared_ptr<const SpeedCurve> speed_curve;  // none: real time
+    SpeedRampRender ramp_render;
+    
+    ExportJob() : id(0), start_us(0), end_us(0), frame_accurate(false), format(EXPORT_FORMAT_MP4),
+                  ramp_render(RAMP_RETIME) {}
+    
+    std::string label() const {
+        std::string result;
+        for (const std::string &camera_id : camera_ids) {
+            result += (result.empty() ? "" : "+") + camera_id;
+        }
+        return result;
+    }
+};
+
+struct ExportProgress {
+    guint job_id;
+    std::string camera_id;
+    ExportState state;
+    guint64 frames_done;
+    guint64 frames_total;
+    std::string detail;         // output path, or the failure reason
+    
+    ExportProgress() : job_id(0), state(EXPORT_QUEUED), frames_done(0), frames_total(0) {}
+};
+
+// A camera's slice of an export, resolved against its ring
+struct TrackWindow {
+    guint64 gop_seq;                    // random access point decoding starts from
+    guint64 cut_gop_seq;                // random access point of the cut frame's GOP
+    guint64 cut_seq;                    // first presented frame
+    guint64 end_seq;                    // exclusive
+    GstClockTimeDiff timeline_offset;   // stream PTS + offset = replay timeline (ns)
+    GstClockTime cut_pts;
+    GstClockTime end_pts;
+};
+
+// Resolve [start_us, end_us) for one camera. The frames nearest those
+// timeline positions are found by PTS, not by their jittered arrival
+// times. With `frame_accurate` the cut and the end land on them, so every
+// camera of a multi-angle export starts on the same instant; otherwise the
+// clip starts on the random access point of the frame nearest the start.
+static bool resolve_track_window(const Camera &camera, gint64 start_us, gint64 end_us,
+                                 bool frame_accurate, TrackWindow &window) {
+    const FrameRing &ring = *camera.ring;
+    window.timeline_offset = 0;
+    window.cut_pts = GST_CLOCK_TIME_NONE;
+    window.end_pts = GST_CLOCK_TIME_NONE;
+    
+    const gint64 margin_us = G_USEC_PER_SEC / 2;
+    guint64 scan_first, scan_end;
+    if (!ring.resolve_range(start_us - margin_us, end_us + margin_us, scan_first, scan_end)) {
+        return false;
+    }
+    
+    // Arrival jitter only ever delays frames, so the smallest
+    // (capture time - PTS) over the window is the stream-to-timeline offset
+    std::vector<RingFrame> frames;
+    GstClockTimeDiff offset = G_MAXINT64;
+    for (guint64 seq = scan_first; seq < scan_end; seq++) {
+        RingFrame frame;
+        if (!ring.read_frame(seq, frame)) {
+            return false;
+        }
+        if (GST_CLOCK_TIME_IS_VALID(frame.pts)) {
+            offset = std::min<GstClockTimeDiff>(offset,
+                frame.capture_time_us * (gint64)GST_USECOND - (GstClockTimeDiff)frame.pts);
+        }
+        frames.push_back(frame);
+    }
+    if (offset == G_MAXINT64) {
+        return false;
+    }
+    
+    auto nearest = [&](gint64 target_ns) -> const RingFrame * {
+        const RingFrame *best = nullptr;
+        gint64 best_distance = G_MAXINT64;
+        for (const RingFrame &frame : frames) {
+            if (!GST_CLOCK_TIME_IS_VALID(frame.pts)) continue;
+            gint64 distance = std::llabs((gint64)frame.pts + offset - target_ns);
+            if (distance < best_distance) {
+                best = &frame;
+                best_distance = distance;
+            }
+        }
+        return best;
+    };
+    
+    const RingFrame *cut = nearest(start_us * (gint64)GST_USECOND);
+    const RingFrame *end = nearest(end_us * (gint64)GST_USECOND);
+    if (!cut || !end || end->pts <= cut->pts) {
+        return false;
+    }
+    
+    // With B-frames decode order is not presentation order: the range ends
+    // after the last frame (in decode order) presented before the end
+    window.end_seq = cut->seq + 1;
+    for (const RingFrame &frame : frames) {
+        if (frame.seq > cut->seq && GST_CLOCK_TIME_IS_VALID(frame.pts) && frame.pts < end->pts) {
+            window.end_seq = std::max(window.end_seq, frame.seq + 1);
+        }
+    }
+    
+    if (!frame_accurate) {
+        // The head of the cut frame's GOP may have aged out: start on the next one
+        window.gop_seq = cut->gop_seq >= ring.tail() ? cut->gop_seq : ring.find_random_access_from(cut->seq);
+        window.cut_gop_seq = window.gop_seq;
+        window.cut_seq = window.gop_seq;
+        return window.gop_seq < window.end_seq;
+    }
+    if (cut->gop_seq < ring.tail()) {
+        return false;
+    }
+    
+    // A cut inside an intra-refresh cycle decodes from an earlier recovery
+    // point whose refresh had completed by the cut
+    window.gop_seq = ring.clean_decode_start(cut->seq);
+    if (window.gop_seq == G_MAXUINT64) {
+        return false;
+    }
+    window.cut_gop_seq = cut->gop_seq;
+    window.cut_seq = cut->seq;
+    window.timeline_offset = offset;
+    window.cut_pts = cut->pts;
+    window.end_pts = end->pts;
+    return true;
+}
+
+// One camera's contribution to an export: access units in decode order,
+// timestamps still in the camera's stream time
+struct ExportTrack {
+    std::shared_ptr<Camera> camera;
+    GstCaps *caps;
+    std::vector<GstBuffer *> frames;
+    GstClockTime cut_pts;           // PTS of the first presented frame
+    bool reencoded_head;            // the first GOP was rebuilt to start on the cut
+    
+    ExportTrack() : caps(nullptr), cut_pts(GST_CLOCK_TIME_NONE), reencoded_head(false) {}
+    ~ExportTrack() {
+        for (GstBuffer *frame : frames) gst_buffer_unref(frame);
+        if (caps) gst_caps_unref(caps);
+    }
+    
+    // Earliest decode timestamp, which bounds how far the track can be shifted
+    GstClockTime first_decode_time() const {
+        GstClockTime first = GST_CLOCK_TIME_NONE;
+        for (GstBuffer *frame : frames) {
+            GstClockTime t = GST_CLOCK_TIME_IS_VALID(GST_BUFFER_DTS(frame)) ?
+                             GST_BUFFER_DTS(frame) : GST_BUFFER_PTS(frame);
+            if (GST_CLOCK_TIME_IS_VALID(t) && (!GST_CLOCK_TIME_IS_VALID(first) || t < first)) {
+                first = t;
+            }
+        }
+        return first;
+    }
+};
+
+// Frame interval of a track: the smallest step between the presentation
+// timestamps of its first frames (decode order differs with B-frames)
+static GstClockTime estimate_frame_duration(const ExportTrack &track) {
+    for (GstBuffer *frame : track.frames) {
+        if (GST_BUFFER_DURATION(frame) != GST_CLOCK_TIME_NONE && GST_BUFFER_DURATION(frame) > 0) {
+            return GST_BUFFER_DURATION(frame);
+        }
+    }
+    std::vector<GstClockTime> pts;
+    for (gsize i = 0; i < track.frames.size() && pts.size() < 16; i++) {
+        if (GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(track.frames[i]))) {
+            pts.push_back(GST_BUFFER_PTS(track.frames[i]));
+        }
+    }
+    std::sort(pts.begin(), pts.end());
+    GstClockTime step = GST_CLOCK_TIME_NONE;
+    for (gsize i = 1; i < pts.size(); i++) {
+        if (pts[i] != pts[i - 1] && (!GST_CLOCK_TIME_IS_VALID(step) || pts[i] - pts[i - 1] < step)) {
+            step = pts[i] - pts[i - 1];
+        }
+    }
+    return GST_CLOCK_TIME_IS_VALID(step) ? step : GST_SECOND / 25;
+}
+
+// Map a stream time through a speed curve anchored at `origin` (the cut)
+static GstClockTime ramp_time(GstClockTime time, const SpeedCurve &curve, GstClockTime origin) {
+    if (!GST_CLOCK_TIME_IS_VALID(time)) {
+        return time;
+    }
+    gdouble source = ((gint64)time - (gint64)origin) / (gdouble)GST_SECOND;
+    gint64 output = (gint64)origin + (gint64)std::llround(curve.output_offset(source) * GST_SECOND);
+    return (GstClockTime)std::max<gint64>(output, 0);
+}
+
+// Above this playback rate a passthrough ramp drops the frames nothing
+// references, so fast sections do not multiply the output frame rate
+static const gdouble TRICK_PLAY_DROP_RATE = 2.0;
+
+// Passthrough ramp: the mapping is monotonic, so decode order and
+// DTS <= PTS survive; buffers are shallow copies of the cached ones.
+// Disposable frames (B-frames, usually) in fast sections are dropped;
+// reference frames are always kept so the rest still decodes.
+static void retime_track(ExportTrack &track, const SpeedCurve &curve) {
+    GstClockTime frame_duration = estimate_frame_duration(track);
+    std::vector<GstBuffer *> kept;
+    for (GstBuffer *frame : track.frames) {
+        GstClockTime pts = GST_BUFFER_PTS(frame);
+        if (GST_BUFFER_FLAG_IS_SET(frame, GST_BUFFER_FLAG_DROPPABLE) && GST_CLOCK_TIME_IS_VALID(pts) &&
+            ramp_time(pts + frame_duration, curve, track.cut_pts) - ramp_time(pts, curve, track.cut_pts) <
+            frame_duration / TRICK_PLAY_DROP_RATE) {
+            gst_buffer_unref(frame);
+            continue;
+        }
+        GstBuffer *retimed = gst_buffer_copy(frame);
+        GST_BUFFER_PTS(retimed) = ramp_time(pts, curve, track.cut_pts);
+        GST_BUFFER_DTS(retimed) = ramp_time(GST_BUFFER_DTS(frame), curve, track.cut_pts);
+        if (GST_CLOCK_TIME_IS_VALID(pts) && GST_CLOCK_TIME_IS_VALID(GST_BUFFER_DURATION(frame))) {
+            GST_BUFFER_DURATION(retimed) = ramp_time(pts + GST_BUFFER_DURATION(frame), curve, track.cut_pts) -
+                                           GST_BUFFER_PTS(retimed);
+        }
+        gst_buffer_unref(frame);
+        kept.push_back(retimed);
+    }
+    track.frames.swap(kept);
+}
+
+// Add `elements` to a new pipeline and link them in order (ownership is
+// taken either way)
+static GstElement* build_linear_pipeline(const char *name, const std::vector<GstElement *> &elements) {
+    GstElement *bin = gst_pipeline_new(name);
+    bool all_created = bin != nullptr;
+    for (GstElement *element : elements) {
+        all_created = all_created && element != nullptr;
+    }
+    if (!all_created) {
+        g_printerr("Failed to create %s elements\n", name);
+        for (GstElement *element : elements) {
+            if (element) gst_object_unref(element);
+        }
+        if (bin) gst_object_unref(bin);
+        return nullptr;
+    }
+    
+    for (GstElement *element : elements) {
+        gst_bin_add(GST_BIN(bin), element);
+    }
+    for (size_t i = 1; i < elements.size(); i++) {
+        if (!gst_element_link(elements[i - 1], elements[i])) {
+            g_printerr("Failed to link %s pipeline\n", name);
+            gst_object_unref(bin);
+            return nullptr;
+        }
+    }
+    return bin;
+}
+
+// Decode a self-contained run of access units to I420 frames in
+// presentation order. `raw_caps` receives the negotiated output caps.
+static bool decode_frames(const std::vector<GstBuffer *> &input, GstCaps *caps,
+                          std::vector<GstBuffer *> &output, GstCaps *&raw_caps) {
+    std::string key = std::string("decode/") + get_decoder_element(replay_hw_type);
+    GstElement *decode = codec_pool.acquire(key, [] () -> GstElement * {
+        GstElement *filter = gst_element_factory_make("capsfilter", "filter");
+        GstElement *appsink = gst_element_factory_make("appsink", "sink");
+        GstElement *bin = build_linear_pipeline("decode", {
+            gst_element_factory_make("appsrc", "src"),
+            gst_element_factory_make("h264parse", "parse"),
+            gst_element_factory_make(get_decoder_element(replay_hw_type), "decoder"),
+            gst_element_factory_make("videoconvert", "convert"),
+            filter,
+            appsink });
+        if (bin) {
+            GstCaps *i420 = gst_caps_from_string("video/x-raw,format=I420");
+            g_object_set(G_OBJECT(filter), "caps", i420, NULL);
+            gst_caps_unref(i420);
+            g_object_set(G_OBJECT(appsink), "sync", FALSE, NULL);
+        }
+        return bin;
+    });
+    if (!decode) {
+        return false;
+    }
+    
+    GstElement *appsrc = pooled_element(decode, "src");
+    GstElement *appsink = pooled_element(decode, "sink");
+    g_object_set(G_OBJECT(appsrc), "caps", caps, "format", GST_FORMAT_TIME, NULL);
+    
+    gst_element_set_state(decode, GST_STATE_PLAYING);
+    for (GstBuffer *frame : input) {
+        gst_app_src_push_buffer(GST_APP_SRC(appsrc), gst_buffer_copy(frame));
+    }
+    gst_app_src_end_of_stream(GST_APP_SRC(appsrc));
+    
+    bool ok = drain_appsink(decode, GST_APP_SINK(appsink), output);
+    GstPad *sink_pad = gst_element_get_static_pad(appsink, "sink");
+    raw_caps = gst_pad_get_current_caps(sink_pad);
+    gst_object_unref(sink_pad);
+    codec_pool.release(key, decode, ok);
+    
+    std::sort(output.begin(), output.end(), [](GstBuffer *a, GstBuffer *b) {
+        return GST_BUFFER_PTS(a) < GST_BUFFER_PTS(b);
+    });
+    return ok && raw_caps && !output.empty();
+}
+
+// Encode raw frames as one closed GOP of byte-stream access units
+static bool encode_frames(const std::vector<GstBuffer *> &input, GstCaps *raw_caps, guint bitrate_kbps,
+                          std::vector<GstBuffer *> &output) {
+    std::string key = std::string("encode/") + get_encoder_element(replay_hw_type);
+    GstElement *encode = codec_pool.acquire(key, [] () -> GstElement * {
+        GstElement *out_parse = gst_element_factory_make("h264parse", "out-parse");
+        GstElement *out_filter = gst_element_factory_make("capsfilter", "out-filter");
+        GstElement *appsink = gst_element_factory_make("appsink", "sink");
+        GstElement *bin = build_linear_pipeline("encode", {
+            gst_element_factory_make("appsrc", "src"),
+            gst_element_factory_make("videoconvert", "convert"),
+            gst_element_factory_make(get_encoder_element(replay_hw_type), "encoder"),
+            out_parse,
+            out_filter,
+            appsink });
+        if (bin) {
+            g_object_set(G_OBJECT(out_parse), "config-interval", -1, NULL);
+            GstCaps *au_caps = gst_caps_from_string("video/x-h264,stream-format=byte-stream,alignment=au");
+            g_object_set(G_OBJECT(out_filter), "caps", au_caps, NULL);
+            gst_caps_unref(au_caps);
+            g_object_set(G_OBJECT(appsink), "sync", FALSE, NULL);
+        }
+        return bin;
+    });
+    if (!encode) {
+        return false;
+    }
+    
+    GstElement *appsrc = pooled_element(encode, "src");
+    GstElement *appsink = pooled_element(encode, "sink");
+    g_object_set(G_OBJECT(appsrc), "caps", raw_caps, "format", GST_FORMAT_TIME, NULL);
+    configure_encoder(pooled_element(encode, "encoder"), replay_hw_type, bitrate_kbps, (guint)input.size() + 1);
+    
+    gst_element_set_state(encode, GST_STATE_PLAYING);
+    for (GstBuffer *frame : input) {
+        gst_app_src_push_buffer(GST_APP_SRC(appsrc), gst_buffer_ref(frame));
+    }
+    gst_app_src_end_of_stream(GST_APP_SRC(appsrc));
+    
+    bool ok = drain_appsink(encode, GST_APP_SINK(appsink), output);
+    codec_pool.release(key, encode, ok);
+    return ok && !output.empty();
+}
+
+// Weighted average of two raw frames of the same format; `weight` (0-256)
+// is the share of `b`. I420 planes blend byte by byte.
+static GstBuffer* blend_frames(GstBuffer *a, GstBuffer *b, guint weight) {
+    GstMapInfo map_a, map_b, map_out;
+    gsize size = std::min(gst_buffer_get_size(a), gst_buffer_get_size(b));
+    GstBuffer *blended = gst_buffer_new_allocate(nullptr, size, nullptr);
+    if (!gst_buffer_map(a, &map_a, GST_MAP_READ)) {
+        return blended;
+    }
+    if (gst_buffer_map(b, &map_b, GST_MAP_READ)) {
+        if (gst_buffer_map(blended, &map_out, GST_MAP_WRITE)) {
+            const guint8 *pa = map_a.data;
+            const guint8 *pb = map_b.data;
+            guint8 *out = map_out.data;
+            guint keep = 256 - weight;
+            for (gsize i = 0; i < size; i++) {
+                out[i] = (guint8)((pa[i] * keep + pb[i] * weight + 128) >> 8);
+            }
+            gst_buffer_unmap(blended, &map_out);
+        }
+        gst_buffer_unmap(b, &map_b);
+    }
+    gst_buffer_unmap(a, &map_a);
+    return blended;
+}
+
+// Motion-compensated interpolation
+//
+// Block matching on the luma plane (16x16 blocks, integer-pel). Each block
+// tries the zero vector and the vectors already found to its left and
+// above, then refines the best one with a shrinking diamond (8, 4, 2, 1
+// pixels). Every output block is fetched from both frames along its vector
+// and blended by phase. A block with no convincing match falls back to a
+// plain blend. Rows of blocks are split into bands, one thread each.
+struct I420Planes {
+    guint8 *data[3];
+    int stride[3];
+    int width;
+    int height;
+};
+
+struct MotionVector {
+    int dx;
+    int dy;
+};
+
+static const int MOTION_BLOCK = 16;
+static const guint32 MOTION_MAX_SAD = MOTION_BLOCK * MOTION_BLOCK * 24;
+
+// Sum of absolute differences of two 16x16 blocks
+static guint32 block_sad16(const guint8 *a, int a_stride, const guint8 *b, int b_stride) {
+#if defined(__SSE2__)
+    __m128i sum = _mm_setzero_si128();
+    for (int y = 0; y < 16; y++) {
+        __m128i row_a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + y * a_stride));
+        __m128i row_b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + y * b_stride));
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(row_a, row_b));
+    }
+    return (guint32)(_mm_cvtsi128_si32(sum) + _mm_extract_epi16(sum, 4));
+#elif defined(__ARM_NEON)
+    uint16x8_t sum = vdupq_n_u16(0);
+    for (int y = 0; y < 16; y++) {
+        uint8x16_t row_a = vld1q_u8(a + y * a_stride);
+        uint8x16_t row_b = vld1q_u8(b + y * b_stride);
+        sum = vabal_u8(sum, vget_low_u8(row_a), vget_low_u8(row_b));
+        sum = vabal_u8(sum, vget_high_u8(row_a), vget_high_u8(row_b));
+    }
+    uint64x2_t total = vpaddlq_u32(vpaddlq_u16(sum));
+    return (guint32)(vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1));
+#else
+    guint32 sum = 0;
+    for (int y = 0; y < 16; y++) {
+        for (int x = 0; x < 16; x++) {
+            sum += (guint32)std::abs(a[y * a_stride + x] - b[y * b_stride + x]);
+        }
+    }
+    return sum;
+#endif
+}
+
+// Cost of moving the 16x16 block at (x, y) of `a` by `mv` into `b`; blocks
+// that would leave the frame cost the maximum
+static guint32 motion_cost(const I420Planes &a, const I420Planes &b, int x, int y, MotionVector mv) {
+    int bx = x + mv.dx;
+    int by = y + mv.dy;
+    if (bx < 0 || by < 0 || bx + MOTION_BLOCK > b.width || by + MOTION_BLOCK > b.height) {
+        return G_MAXUINT32;
+    }
+    return block_sad16(a.data[0] + y * a.stride[0] + x, a.stride[0],
+                       b.data[0] + by * b.stride[0] + bx, b.stride[0]);
+}
+
+static MotionVector estimate_block_motion(const I420Planes &a, const I420Planes &b, int x, int y,
+                                          const MotionVector *candidates, int candidate_count,
+                                          guint32 &best_cost) {
+    MotionVector best = { 0, 0 };
+    best_cost = motion_cost(a, b, x, y, best);
+    for (int i = 0; i < candidate_count; i++) {
+        guint32 cost = motion_cost(a, b, x, y, candidates[i]);
+        if (cost < best_cost) {
+            best_cost = cost;
+            best = candidates[i];
+        }
+    }
+    
+    static const MotionVector diamond[] = { { 1, 0 }, { -1, 0 }, { 0, 1 }, { 0, -1 } };
+    for (int step = 8; step >= 1; step /= 2) {
+        for (int moves = 0; moves < 4; moves++) {
+            MotionVector center = best;
+            for (const MotionVector &direction : diamond) {
+                MotionVector mv = { center.dx + direction.dx * step, center.dy + direction.dy * step };
+                guint32 cost = motion_cost(a, b, x, y, mv);
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best = mv;
+                }
+            }
+            if (best.dx == center.dx && best.dy == center.dy) {
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+// out = a(p - v_a) * (1 - w) + b(p + v_b) * w over one block of one plane
+static void compensate_block(const guint8 *a, int a_stride, const guint8 *b, int b_stride,
+                             guint8 *out, int out_stride, int width, int height,
+                             int x0, int y0, int block_width, int block_height,
+                             int ax, int ay, int bx, int by, guint weight) {
+    guint keep = 256 - weight;
+    bool inside = x0 - ax >= 0 && y0 - ay >= 0 && x0 + bx >= 0 && y0 + by >= 0 &&
+                  x0 - ax + block_width <= width && y0 - ay + block_height <= height &&
+                  x0 + bx + block_width <= width && y0 + by + block_height <= height;
+    for (int y = y0; y < y0 + block_height; y++) {
+        guint8 *row = out + y * out_stride;
+        if (inside) {
+            const guint8 *row_a = a + (y - ay) * a_stride - ax;
+            const guint8 *row_b = b + (y + by) * b_stride + bx;
+            for (int x = x0; x < x0 + block_width; x++) {
+                row[x] = (guint8)((row_a[x] * keep + row_b[x] * weight + 128) >> 8);
+            }
+            continue;
+        }
+        int ya = std::min(std::max(y - ay, 0), height - 1);
+        int yb = std::min(std::max(y + by, 0), height - 1);
+        for (int x = x0; x < x0 + block_width; x++) {
+            int xa = std::min(std::max(x - ax, 0), width - 1);
+            int xb = std::min(std::max(x + bx, 0), width - 1);
+            row[x] = (guint8)((a[ya * a_stride + xa] * keep + b[yb * b_stride + xb] * weight + 128) >> 8);
+        }
+    }
+}
+
+// Estimate and compensate the block rows [first_row, end_row)
+static void interpolate_band(const I420Planes &a, const I420Planes &b, guint weight, I420Planes &out,
+                             std::vector<MotionVector> &field, int columns, int first_row, int end_row) {
+    for (int row = first_row; row < end_row; row++) {
+        for (int column = 0; column < columns; column++) {
+            // Edge blocks are matched on the full block that ends at the edge
+            int x = std::min(column * MOTION_BLOCK, a.width - MOTION_BLOCK);
+            int y = std::min(row * MOTION_BLOCK, a.height - MOTION_BLOCK);
+            MotionVector candidates[3];
+            int candidate_count = 0;
+            if (column > 0) {
+                candidates[candidate_count++] = field[row * columns + column - 1];
+            }
+            if (row > first_row) {
+                candidates[candidate_count++] = field[(row - 1) * columns + column];
+                if (column + 1 < columns) {
+                    candidates[candidate_count++] = field[(row - 1) * columns + column + 1];
+                }
+            }
+            guint32 cost;
+            MotionVector mv = estimate_block_motion(a, b, x, y, candidates, candidate_count, cost);
+            field[row * columns + column] = mv;
+            if (cost > MOTION_MAX_SAD) {
+                mv.dx = mv.dy = 0;
+            }
+            
+            // Split the vector at the output phase; chroma moves half as far
+            for (int plane = 0; plane < 3; plane++) {
+                int shift = plane == 0 ? 0 : 1;
+                int dx = mv.dx >> shift;
+                int dy = mv.dy >> shift;
+                int ax = (int)((dx * (int)weight) / 256);
+                int ay = (int)((dy * (int)weight) / 256);
+                int plane_width = (a.width + shift) >> shift;
+                int plane_height = (a.height + shift) >> shift;
+                int x0 = (column * MOTION_BLOCK) >> shift;
+                int y0 = (row * MOTION_BLOCK) >> shift;
+                compensate_block(a.data[plane], a.stride[plane], b.data[plane], b.stride[plane],
+                                 out.data[plane], out.stride[plane], plane_width, plane_height,
+                                 x0, y0,
+                                 std::min(MOTION_BLOCK >> shift, plane_width - x0),
+                                 std::min(MOTION_BLOCK >> shift, plane_height - y0),
+                                 ax, ay, dx - ax, dy - ay, weight);
+            }
+        }
+    }
+}
+
+// Synthesize the frame at phase `weight` (0-256) between `a` and `b`
+// (both at least one block in each dimension)
+static void interpolate_planes(const I420Planes &a, const I420Planes &b, guint weight, I420Planes &out,
+                               guint threads) {
+    int columns = (a.width + MOTION_BLOCK - 1) / MOTION_BLOCK;
+    int rows = (a.height + MOTION_BLOCK - 1) / MOTION_BLOCK;
+    std::vector<MotionVector> field(columns * rows);
+    int bands = std::max(1, std::min((int)threads, rows));
+    std::vector<std::thread> workers;
+    for (int band = 1; band < bands; band++) {
+        workers.emplace_back(interpolate_band, std::cref(a), std::cref(b), weight, std::ref(out),
+                             std::ref(field), columns, rows * band / bands, rows * (band + 1) / bands);
+    }
+    interpolate_band(a, b, weight, out, field, columns, 0, rows / bands);
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+static guint interpolation_threads() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Motion-compensated counterpart of blend_frames for I420 buffers, on
+// `threads` bands
+static GstBuffer* interpolate_frames(GstBuffer *a, GstBuffer *b, guint weight, const GstVideoInfo &info,
+                                     guint threads) {
+    if (GST_VIDEO_INFO_WIDTH(&info) < MOTION_BLOCK || GST_VIDEO_INFO_HEIGHT(&info) < MOTION_BLOCK) {
+        return blend_frames(a, b, weight);
+    }
+    GstBuffer *result = gst_buffer_new_allocate(nullptr, GST_VIDEO_INFO_SIZE(&info), nullptr);
+    GstVideoFrame frame_a, frame_b, frame_out;
+    if (!gst_video_frame_map(&frame_a, &info, a, GST_MAP_READ)) {
+        return result;
+    }
+    if (gst_video_frame_map(&frame_b, &info, b, GST_MAP_READ)) {
+        if (gst_video_frame_map(&frame_out, &info, result, GST_MAP_WRITE)) {
+            I420Planes planes[3];
+            GstVideoFrame *frames[3] = { &frame_a, &frame_b, &frame_out };
+            for (int i = 0; i < 3; i++) {
+                for (int plane = 0; plane < 3; plane++) {
+                    planes[i].data[plane] = GST_VIDEO_FRAME_PLANE_DATA(frames[i], plane);
+                    planes[i].stride[plane] = GST_VIDEO_FRAME_PLANE_STRIDE(frames[i], plane);
+                }
+                planes[i].width = GST_VIDEO_INFO_WIDTH(&info);
+                planes[i].height = GST_VIDEO_INFO_HEIGHT(&info);
+            }
+            interpolate_planes(planes[0], planes[1], weight, planes[2], threads);
+            gst_video_frame_unmap(&frame_out);
+        }
+        gst_video_frame_unmap(&frame_b);
+    }
+    gst_video_frame_unmap(&frame_a);
+    return result;
+}
+
+// Interpolation benchmark
+//
+// Synthetic textured frames moving by a known whole-pixel vector, so the
+// midpoint frame is known exactly. Reports interpolated frames per second
+// on one thread and on all threads, plus the midpoint PSNR as a sanity
+// check on the motion search.
+static guint8 benchmark_texture(int x, int y) {
+    guint32 h = (guint32)x * 374761393u + (guint32)y * 668265263u;
+    h = (h ^ (h >> 13)) * 1274126177u;
+    gdouble smooth = 60.0 * std::sin(x * 0.05) * std::cos(y * 0.035);
+    return (guint8)std::min(255.0, std::max(0.0, 128.0 + smooth + (gdouble)((h >> 24) & 31) - 16.0));
+}
+
+static void benchmark_fill(std::vector<guint8> &storage, I420Planes &planes, int width, int height,
+                           int offset_x, int offset_y) {
+    int chroma_width = (width + 1) / 2;
+    int chroma_height = (height + 1) / 2;
+    storage.assign(width * height + 2 * chroma_width * chroma_height, 0);
+    planes.data[0] = storage.data();
+    planes.data[1] = planes.data[0] + width * height;
+    planes.data[2] = planes.data[1] + chroma_width * chroma_height;
+    planes.stride[0] = width;
+    planes.stride[1] = planes.stride[2] = chroma_width;
+    planes.width = width;
+    planes.height = height;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            planes.data[0][y * width + x] = benchmark_texture(x - offset_x, y - offset_y);
+        }
+    }
+    for (int y = 0; y < chroma_height; y++) {
+        for (int x = 0; x < chroma_width; x++) {
+            planes.data[1][y * chroma_width + x] = benchmark_texture(x - offset_x / 2 + 7919, y - offset_y / 2);
+            planes.data[2][y * chroma_width + x] = benchmark_texture(x - offset_x / 2, y - offset_y / 2 + 7919);
+        }
+    }
+}
+
+// Luma PSNR, ignoring a margin where content enters the frame
+static gdouble benchmark_psnr(const I420Planes &a, const I420Planes &b, int margin) {
+    gdouble error = 0.0;
+    guint64 count = 0;
+    for (int y = margin; y < a.height - margin; y++) {
+        for (int x = margin; x < a.width - margin; x++) {
+            int d = a.data[0][y * a.stride[0] + x] - b.data[0][y * b.stride[0] + x];
+            error += d * d;
+            count++;
+        }
+    }
+    return error == 0.0 ? 99.0 : 10.0 * std::log10(255.0 * 255.0 * count / error);
+}
+
+static gdouble benchmark_fps(const I420Planes &a, const I420Planes &b, I420Planes &out, guint threads) {
+    auto start = std::chrono::steady_clock::now();
+    int frames = 0;
+    std::chrono::duration<gdouble> elapsed;
+    do {
+        interpolate_planes(a, b, (guint)(64 * (frames % 3 + 1)), out, threads);
+        frames++;
+        elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed.count() < 1.5);
+    return frames / elapsed.count();
+}
+
+static int run_interpolation_benchmark() {
+#if defined(__SSE2__)
+    const char *kernel = "SSE2";
+#elif defined(__ARM_NEON)
+    const char *kernel = "NEON";
+#else
+    const char *kernel = "scalar";
+#endif
+    guint threads = interpolation_threads();
+    g_print("Motion-compensated interpolation: %dx%d blocks, %s SAD, %u threads\n",
+           MOTION_BLOCK, MOTION_BLOCK, kernel, threads);
+    // 0.25x from 50p shows three synthesized frames for every source frame
+    const gdouble needed_fps = 50.0 * 3 / 4;
+    
+    const int sizes[][2] = { { 1280, 720 }, { 1920, 1080 } };
+    for (const auto &size : sizes) {
+        std::vector<guint8> storage_a, storage_b, storage_mid, storage_out;
+        I420Planes a, b, mid, out;
+        benchmark_fill(storage_a, a, size[0], size[1], 0, 0);
+        benchmark_fill(storage_b, b, size[0], size[1], 12, 6);
+        benchmark_fill(storage_mid, mid, size[0], size[1], 6, 3);
+        benchmark_fill(storage_out, out, size[0], size[1], 0, 0);
+        
+        interpolate_planes(a, b, 128, out, threads);
+        gdouble psnr = benchmark_psnr(out, mid, MOTION_BLOCK);
+        gdouble single = benchmark_fps(a, b, out, 1);
+        gdouble all = threads > 1 ? benchmark_fps(a, b, out, threads) : single;
+        g_print("  %4dx%-4d  %6.1f fps (1 thread)  %6.1f fps (%u threads)  midpoint %.1f dB  %s\n",
+               size[0], size[1], single, all, threads, psnr,
+               all >= needed_fps ? "real time for 0.25x at 50p" : "slower than real time for 0.25x at 50p");
+    }
+    return 0;
+}
+
+// Output frames of one GOP on the constant-rate output grid
+struct RampSegment {
+    size_t first_frame;             // GOP bounds in the track, decode order
+    size_t end_frame;
+    std::vector<GstClockTime> output_pts;
+    std::vector<GstClockTime> source_pts;
+};
+
+// Decode one GOP (plus the next GOP's keyframe, to blend across the
+// boundary), synthesize its output frames on `threads` threads and encode
+// them as a closed GOP
+static bool render_ramp_segment(const ExportTrack &track, const RampSegment &segment,
+                                SpeedRampRender render, GstClockTime frame_duration,
+                                guint bitrate_kbps, guint threads, std::vector<GstBuffer *> &output) {
+    std::vector<GstBuffer *> input(track.frames.begin() + segment.first_frame,
+                                   track.frames.begin() + segment.end_frame);
+    if (segment.end_frame < track.frames.size()) {
+        input.push_back(track.frames[segment.end_frame]);
+    }
+    
+    std::vector<GstBuffer *> decoded;
+    GstCaps *raw_caps = nullptr;
+    GstVideoInfo info;
+    bool ok = decode_frames(input, track.caps, decoded, raw_caps) &&
+              gst_video_info_from_caps(&info, raw_caps);
+    
+    std::vector<GstBuffer *> synthesized;
+    for (size_t n = 0; ok && n < segment.output_pts.size(); n++) {
+        GstClockTime source = segment.source_pts[n];
+        size_t b = std::upper_bound(decoded.begin(), decoded.end(), source,
+                                    [](GstClockTime t, GstBuffer *frame) { return t < GST_BUFFER_PTS(frame); }) -
+                   decoded.begin();
+        size_t a = b > 0 ? b - 1 : 0;
+        GstBuffer *frame;
+        if (render != RAMP_REPEAT && b > 0 && b < decoded.size() &&
+            GST_BUFFER_PTS(decoded[b]) > GST_BUFFER_PTS(decoded[a])) {
+            guint weight = (guint)gst_util_uint64_scale(source - GST_BUFFER_PTS(decoded[a]), 256,
+                                                        GST_BUFFER_PTS(decoded[b]) - GST_BUFFER_PTS(decoded[a]));
+            if (weight == 0) {
+                frame = gst_buffer_copy(decoded[a]);
+            } else if (render == RAMP_INTERPOLATE) {
+                frame = interpolate_frames(decoded[a], decoded[b], weight, info, threads);
+            } else {
+                frame = blend_frames(decoded[a], decoded[b], weight);
+            }
+        } else {
+            frame = gst_buffer_copy(decoded[a]);
+        }
+        GST_BUFFER_PTS(frame) = segment.output_pts[n];
+        GST_BUFFER_DTS(frame) = GST_CLOCK_TIME_NONE;
+        GST_BUFFER_DURATION(frame) = frame_duration;
+        synthesized.push_back(frame);
+    }
+    ok = ok && encode_frames(synthesized, raw_caps, bitrate_kbps, output);
+    
+    for (GstBuffer *frame : synthesized) gst_buffer_unref(frame);
+    for (GstBuffer *frame : decoded) gst_buffer_unref(frame);
+    if (raw_caps) gst_caps_unref(raw_caps);
+    return ok;
+}
+
+// Transcoded ramp at the source frame rate. Output frame n sits at
+// cut + n * frame_duration and shows the source at the inverse-mapped
+// time. GOPs are rendered in parallel and each becomes a closed GOP, so
+// the segments concatenate without re-encoding across boundaries. One
+// thread per core is shared out: GOPs first, then interpolation bands
+// within each GOP once there are fewer GOPs left than cores.
+static bool transcode_track(ExportTrack &track, const SpeedCurve &curve, SpeedRampRender render,
+                            std::string &error) {
+    std::vector<RampSegment> segments;
+    GstClockTime source_end = 0;
+    for (size_t i = 0; i < track.frames.size(); i++) {
+        GstBuffer *frame = track.frames[i];
+        if (i == 0 || !GST_BUFFER_FLAG_IS_SET(frame, GST_BUFFER_FLAG_DELTA_UNIT)) {
+            if (!segments.empty()) segments.back().end_frame = i;
+            RampSegment segment;
+            segment.first_frame = i;
+            segment.end_frame = track.frames.size();
+            segments.push_back(segment);
+        }
+        if (GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(frame))) {
+            source_end = std::max(source_end, GST_BUFFER_PTS(frame));
+        }
+    }
+    
+    // Assign output frames to the GOP whose presentation range holds their
+    // source time (GOPs start with a keyframe, presented first)
+    GstClockTime frame_duration = estimate_frame_duration(track);
+    source_end += frame_duration;
+    size_t current = 0;
+    for (guint64 n = 0;; n++) {
+        GstClockTime output_pts = track.cut_pts + n * frame_duration;
+        GstClockTime source_pts = track.cut_pts +
+            (GstClockTime)std::llround(curve.source_offset((n * frame_duration) / (gdouble)GST_SECOND) * GST_SECOND);
+        if (source_pts >= source_end) {
+            break;
+        }
+        while (current + 1 < segments.size() &&
+               source_pts >= GST_BUFFER_PTS(track.frames[segments[current + 1].first_frame])) {
+            current++;
+        }
+        segments[current].output_pts.push_back(output_pts);
+        segments[current].source_pts.push_back(source_pts);
+    }
+    
+    guint bitrate_kbps = estimate_bitrate_kbps(track.frames);
+    std::vector<std::vector<GstBuffer *>> rendered(segments.size());
+    guint budget = interpolation_threads();
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < segments.size(); i++) {
+        if (!segments[i].output_pts.empty()) pending.push_back(i);
+    }
+    bool ok = true;
+    for (size_t first = 0; first < pending.size(); first += budget) {
+        size_t jobs = std::min<size_t>(budget, pending.size() - first);
+        guint bands = std::max<guint>(1, budget / (guint)jobs);
+        std::vector<std::future<bool>> results;
+        for (size_t j = first; j < first + jobs; j++) {
+            size_t i = pending[j];
+            results.push_back(std::async(std::launch::async, [&, i, bands] {
+                return render_ramp_segment(track, segments[i], render, frame_duration,
+                                           bitrate_kbps, bands, rendered[i]);
+            }));
+        }
+        for (auto &result : results) {
+            ok = result.get() && ok;
+        }
+    }
+    
+    std::vector<GstBuffer *> frames;
+    for (auto &segment : rendered) {
+        frames.insert(frames.end(), segment.begin(), segment.end());
+    }
+    if (!ok || frames.empty()) {
+        for (GstBuffer *frame : frames) gst_buffer_unref(frame);
+        error = "failed to render speed ramp for camera " + track.camera->id;
+        return false;
+    }
+    for (GstBuffer *frame : track.frames) gst_buffer_unref(frame);
+    track.frames.swap(frames);
+    track.reencoded_head = true;
+    return true;
+}
+
+static bool apply_speed_ramp(ExportTrack &track, const SpeedCurve &curve, SpeedRampRender render,
+                             std::string &error) {
+    if (render == RAMP_RETIME) {
+        retime_track(track, curve);
+        return true;
+    }
+    return transcode_track(track, curve, render, error);
+}
+
+// Collect a track's access units through the GOP cache. When the cut is
+// not a random access point only the partial first GOP is re-encoded;
+// everything after it is passed through.
+static bool prepare_export_track(const std::string &camera_id, const ExportJob &job,
+                                 ExportTrack &track, std::string &error) {
+    track.camera = find_camera(camera_id);
+    if (!track.camera) {
+        error = "unknown camera " + camera_id;
+        return false;
+    }
+    track.caps = track.camera->get_caps();
+    if (!track.caps) {
+        error = "no stream received from camera " + camera_id + " yet";
+        return false;
+    }
+    
+    TrackWindow window;
+    if (!resolve_track_window(*track.camera, job.start_us, job.end_us, job.frame_accurate, window)) {
+        error = "range is not buffered for camera " + camera_id;
+        return false;
+    }
+    
+    // The head is re-encoded from the random access point decoding starts
+    // at, which precedes the cut frame's own GOP when that is an unfinished
+    // intra-refresh cycle
+    std::vector<GopRef> head;
+    GstClockTime clean_pts = GST_CLOCK_TIME_NONE;
+    guint64 gop_seq = window.gop_seq;
+    while (gop_seq < window.end_seq) {
+        GopRef gop = gop_cache.acquire(track.camera, gop_seq);
+        if (!gop) {
+            error = "range aged out of the ring for camera " + camera_id;
+            return false;
+        }
+        
+        if (window.cut_seq != window.gop_seq && gop_seq <= window.cut_gop_seq) {
+            head.push_back(gop);
+            if (gop_seq == window.cut_gop_seq) {
+                std::vector<GstBuffer *> input;
+                for (const GopRef &part : head) {
+                    input.insert(input.end(), part->frames.begin(), part->frames.end());
+                }
+                GstClockTime to_pts = window.end_seq <= gop->end_seq() ? window.end_pts : GST_CLOCK_TIME_NONE;
+                if (!reencode_frames(input, track.caps, window.cut_pts, to_pts, track.frames)) {
+                    error = "failed to re-encode the first GOP of camera " + camera_id;
+                    return false;
+                }
+                track.reencoded_head = true;
+                head.clear();
+            }
+        } else {
+            for (gsize i = 0; i < gop->frames.size() && gop->first_seq + i < window.end_seq; i++) {
+                GstBuffer *source = gop->frames[i];
+                if (GST_CLOCK_TIME_IS_VALID(window.end_pts) && GST_BUFFER_PTS(source) >= window.end_pts) {
+                    // Decoded ahead of frames presented before the end
+                    if (!GST_BUFFER_FLAG_IS_SET(source, GST_BUFFER_FLAG_DROPPABLE)) {
+                        GstBuffer *frame = gst_buffer_copy(source);
+                        GST_BUFFER_FLAG_SET(frame, GST_BUFFER_FLAG_DECODE_ONLY);
+                        track.frames.push_back(frame);
+                    }
+                    continue;
+                }
+                if (gop_seq == window.gop_seq && i < gop->clean_from) {
+                    // Passthrough from a recovery point: these only feed the refresh
+                    GstBuffer *frame = gst_buffer_copy(source);
+                    GST_BUFFER_FLAG_SET(frame, GST_BUFFER_FLAG_DECODE_ONLY);
+                    track.frames.push_back(frame);
+                    continue;
+                }
+                if (gop_seq == window.gop_seq && GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(source)) &&
+                    (!GST_CLOCK_TIME_IS_VALID(clean_pts) || GST_BUFFER_PTS(source) < clean_pts)) {
+                    clean_pts = GST_BUFFER_PTS(source);
+                }
+                track.frames.push_back(gst_buffer_ref(source));
+            }
+        }
+        
+        if (!gop->complete) {
+            break;
+        }
+        gop_seq = gop->end_seq();
+    }
+    
+    if (track.frames.empty()) {
+        error = "no frames in range for camera " + camera_id;
+        return false;
+    }
+    if (GST_CLOCK_TIME_IS_VALID(window.cut_pts)) {
+        track.cut_pts = window.cut_pts;
+    } else {
+        track.cut_pts = GST_CLOCK_TIME_IS_VALID(clean_pts) ? clean_pts : GST_BUFFER_PTS(track.frames.front());
+    }
+    return !job.speed_curve || apply_speed_ramp(track, *job.speed_curve, job.ramp_render, error);
+}
+
+// One `appsrc ! h264parse [! capsfilter]` branch per track into the muxer
+// (or straight into filesink for a single raw track)
+static const guint64 EXPORT_APPSRC_MAX_BYTES = 8 * 1024 * 1024;
+
+static GstElement* create_export_pipeline(const ExportJob &job,
+                                          const std::vector<std::unique_ptr<ExportTrack>> &tracks,
+                                          std::vector<GstAppSrc *> &appsrcs) {
+    gchar *name = g_strdup_printf("export-%u", job.id);
+    GstElement *pipeline_elem = gst_pipeline_new(name);
+    g_free(name);
+    
+    const char *muxer_name = export_format_muxer(job.format);
+    GstElement *muxer = muxer_name ? gst_element_factory_make(muxer_name, "mux") : nullptr;
+    GstElement *filesink = gst_element_factory_make("filesink", "output");
+    if (!pipeline_elem || (muxer_name && !muxer) || !filesink) {
+        g_printerr("Failed to create export elements for job %u\n", job.id);
+        if (pipeline_elem) gst_object_unref(pipeline_elem);
+        if (muxer) gst_object_unref(muxer);
+        if (filesink) gst_object_unref(filesink);
+        return nullptr;
+    }
+    g_object_set(G_OBJECT(filesink), "location", job.output_path.c_str(), NULL);
+    gst_bin_add(GST_BIN(pipeline_elem), filesink);
+    if (muxer) {
+        gst_bin_add(GST_BIN(pipeline_elem), muxer);
+        if (!gst_element_link(muxer, filesink)) {
+            gst_object_unref(pipeline_elem);
+            return nullptr;
+        }
+    }
+    
+    for (size_t i = 0; i < tracks.size(); i++) {
+        gchar *src_name = g_strdup_printf("src-%zu", i);
+        gchar *parse_name = g_strdup_printf("parse-%zu", i);
+        gchar *filter_name = g_strdup_printf("format-%zu", i);
+        GstElement *appsrc = gst_element_factory_make("appsrc", src_name);
+        GstElement *parse = gst_element_factory_make("h264parse", parse_name);
+        GstElement *filter = gst_element_factory_make("capsfilter", filter_name);
+        g_free(src_name);
+        g_free(parse_name);
+        g_free(filter_name);
+        if (!appsrc || !parse || !filter) {
+            g_printerr("Failed to create export elements for job %u\n", job.id);
+            if (appsrc) gst_object_unref(appsrc);
+            if (parse) gst_object_unref(parse);
+            if (filter) gst_object_unref(filter);
+            gst_object_unref(pipeline_elem);
+            return nullptr;
+        }
+        
+        g_object_set(G_OBJECT(appsrc),
+                     "caps", tracks[i]->caps,
+                     "format", GST_FORMAT_TIME,
+                     "is-live", FALSE,
+                     "max-bytes", EXPORT_APPSRC_MAX_BYTES,
+                     NULL);
+        
+        // MP4 tracks whose SPS/PPS change mid-stream must keep them in-band
+        if (job.format == EXPORT_FORMAT_MP4 && tracks[i]->reencoded_head) {
+            GstCaps *avc3 = gst_caps_from_string("video/x-h264,stream-format=avc3,alignment=au");
+            g_object_set(G_OBJECT(filter), "caps", avc3, NULL);
+            gst_caps_unref(avc3);
+        }
+        
+        gst_bin_add_many(GST_BIN(pipeline_elem), appsrc, parse, filter, NULL);
+        if (!gst_element_link_many(appsrc, parse, filter, muxer ? muxer : filesink, NULL)) {
+            g_printerr("Failed to link export pipeline for job %u\n", job.id);
+            gst_object_unref(pipeline_elem);
+            return nullptr;
+        }
+        appsrcs.push_back(GST_APP_SRC(appsrc));
+    }
+    
+    return pipeline_elem;
+}
+
+// The export worker pushes without blocking in the appsrc and waits for
+// room itself, watching the bus, so a pipeline that fails mid-stream
+// cannot leave it stuck in a push
+static bool wait_for_appsrc_room(GstElement *pipeline_elem, GstAppSrc *appsrc, std::string &error) {
+    if (gst_app_src_get_current_level_bytes(appsrc) < EXPORT_APPSRC_MAX_BYTES) {
+        return true;
+    }
+    GstBus *bus = gst_element_get_bus(pipeline_elem);
+    bool ok = true;
+    while (ok && gst_app_src_get_current_level_bytes(appsrc) >= EXPORT_APPSRC_MAX_BYTES) {
+        GstMessage *message = gst_bus_timed_pop_filtered(bus, 10 * GST_MSECOND, GST_MESSAGE_ERROR);
+        if (message) {
+            GError *err = nullptr;
+            gst_message_parse_error(message, &err, NULL);
+            error = err ? err->message : "pipeline error";
+            if (err) g_error_free(err);
+            gst_message_unref(message);
+            ok = false;
+        }
+    }
+    gst_object_unref(bus);
+    return ok;
+}
+
+// Block until a finished (EOS) or failed pipeline, then tear it down
+static bool finish_pipeline(GstElement *pipeline_elem, std::string &error) {
+    GstBus *bus = gst_element_get_bus(pipeline_elem);
+    GstMessage *message = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+        (GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+    bool ok = true;
+    if (message && GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR) {
+        GError *err = nullptr;
+        gst_message_parse_error(message, &err, NULL);
+        error = err ? err->message : "pipeline error";
+        if (err) g_error_free(err);
+        ok = false;
+    }
+    if (message) gst_message_unref(message);
+    gst_object_unref(bus);
+    gst_element_set_state(pipeline_elem, GST_STATE_NULL);
+    gst_object_unref(pipeline_elem);
+    return ok;
+}
+
+// Track timestamp in the output: the cut frame lands on `shift`
+static GstClockTime track_output_time(GstClockTime time, const ExportTrack &track, GstClockTime shift) {
+    if (!GST_CLOCK_TIME_IS_VALID(time)) {
+        return time;
+    }
+    return rebase_time(time + shift, track.cut_pts);
+}
+
+// Accepts (cameras, range, format) jobs and remuxes them on a bounded pool
+// of worker threads. Overlapping ranges share GOP reads through the GOP
+// cache. The tracks of a multi-camera job are prepared by the same
+// workers: idle ones take them, and the job's own worker works through
+// whatever is left, so no job runs more codecs than there are workers.
+// Progress is pushed to listeners from the worker threads.
+class ExportQueue {
+public:
+    typedef std::function<void(const ExportProgress &)> Listener;
+
+    explicit ExportQueue(guint worker_count) : next_id(1), stopping(false) {
+        for (guint i = 0; i < worker_count; i++) {
+            workers.emplace_back(&ExportQueue::worker_main, this);
+        }
+    }
+
+    ~ExportQueue() {
+        shutdown();
+    }
+
+    void add_listener(Listener listener) {
+        std::lock_guard<std::mutex> guard(lock);
+        listeners.push_back(listener);
+    }
+
+    // Queue a job; returns its id (0 once shut down)
+    guint submit(ExportJob job) {
+        ExportProgress progress;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (stopping) {
+                return 0;
+            }
+            job.id = next_id++;
+            progress.job_id = job.id;
+            progress.camera_id = job.label();
+            progress.detail = job.output_path;
+            status[job.id] = progress;
+            pending.push_back(job);
+        }
+        cond.notify_one();
+        publish(progress);
+        return job.id;
+    }
+
+    std::vector<ExportProgress> snapshot() {
+        std::lock_guard<std::mutex> guard(lock);
+        std::vector<ExportProgress> result;
+        for (const auto &entry : status) {
+            result.push_back(entry.second);
+        }
+        return result;
+    }
+
+    // Stop accepting work, finish the running jobs and drop the queued ones
+    void shutdown() {
+        std::deque<ExportJob> cancelled;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (stopping) {
+                return;
+            }
+            stopping = true;
+            cancelled.swap(pending);
+        }
+        cond.notify_all();
+        for (const ExportJob &job : cancelled) {
+            fail(job, "cancelled at shutdown");
+        }
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+    }
+
+private:
+    void worker_main() {
+        for (;;) {
+            ExportJob job;
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                cond.wait(guard, [this] { return stopping || !pending.empty() || !track_tasks.empty(); });
+                if (!track_tasks.empty()) {
+                    task = track_tasks.front();
+                    track_tasks.pop_front();
+                } else if (pending.empty()) {
+                    return;
+                } else {
+                    job = pending.front();
+                    pending.pop_front();
+                }
+            }
+            if (task) {
+                task();
+                continue;
+            }
+            
+            std::string error;
+            if (!run_job(job, error)) {
+                fail(job, error);
+            }
+        }
+    }
+    
+    // Run `tasks` on the workers, this one included, and wait for them
+    void run_on_workers(const std::vector<std::function<void()>> &tasks) {
+        std::vector<std::future<void>> done;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            for (const auto &work : tasks) {
+                auto packaged = std::make_shared<std::packaged_task<void()>>(work);
+                done.push_back(packaged->get_future());
+                track_tasks.push_back([packaged] { (*packaged)(); });
+            }
+        }
+        cond.notify_all();
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (track_tasks.empty()) {
+                    break;
+                }
+                task = track_tasks.front();
+                track_tasks.pop_front();
+            }
+            task();
+        }
+        for (std::future<void> &result : done) {
+            result.wait();
+        }
+    }
+
+    bool run_job(const ExportJob &job, std::string &error) {
+        ExportProgress progress;
+        progress.job_id = job.id;
+        progress.camera_id = job.label();
+        progress.state = EXPORT_RUNNING;
+        progress.detail = job.output_path;
+        publish(progress);
+        
+        // Tracks are read (and their heads re-encoded) concurrently
+        std::vector<std::unique_ptr<ExportTrack>> tracks;
+        std::vector<std::string> track_errors(job.camera_ids.size());
+        std::vector<std::function<void()>> prepare;
+        for (size_t i = 0; i < job.camera_ids.size(); i++) {
+            tracks.emplace_back(new ExportTrack());
+            ExportTrack *track = tracks.back().get();
+            std::string *track_error = &track_errors[i];
+            const std::string &camera_id = job.camera_ids[i];
+            prepare.push_back([&job, &camera_id, track, track_error] {
+                prepare_export_track(camera_id, job, *track, *track_error);
+            });
+        }
+        run_on_workers(prepare);
+        for (const std::string &track_error : track_errors) {
+            if (error.empty()) error = track_error;
+        }
+        if (!error.empty()) {
+            return false;
+        }
+        
+        std::vector<GstAppSrc *> appsrcs;
+        GstElement *export_pipeline = create_export_pipeline(job, tracks, appsrcs);
+        if (!export_pipeline) {
+            error = "failed to create export pipeline";
+            return false;
+        }
+        gst_element_set_state(export_pipeline, GST_STATE_PLAYING);
+        
+        // Shift every track by the same amount so no decode timestamp goes
+        // negative and all cut frames share one output instant
+        GstClockTime shift = 0;
+        for (const auto &track : tracks) {
+            progress.frames_total += track->frames.size();
+            GstClockTime first = track->first_decode_time();
+            if (GST_CLOCK_TIME_IS_VALID(first) && first < track->cut_pts) {
+                shift = std::max(shift, track->cut_pts - first);
+            }
+        }
+        
+        // Interleave tracks in decode order so the muxer never starves
+        std::vector<size_t> next(tracks.size(), 0);
+        for (;;) {
+            size_t pick = tracks.size();
+            GstClockTime pick_time = GST_CLOCK_TIME_NONE;
+            for (size_t i = 0; i < tracks.size(); i++) {
+                if (next[i] >= tracks[i]->frames.size()) continue;
+                GstBuffer *frame = tracks[i]->frames[next[i]];
+                GstClockTime t = track_output_time(GST_CLOCK_TIME_IS_VALID(GST_BUFFER_DTS(frame)) ?
+                                                   GST_BUFFER_DTS(frame) : GST_BUFFER_PTS(frame),
+                                                   *tracks[i], shift);
+                if (pick == tracks.size() || t < pick_time) {
+                    pick = i;
+                    pick_time = t;
+                }
+            }
+            if (pick == tracks.size()) {
+                break;
+            }
+            
+            // Shallow copy: the payload memory stays shared with the cache
+            const ExportTrack &track = *tracks[pick];
+            GstBuffer *buffer = gst_buffer_copy(track.frames[next[pick]++]);
+            GST_BUFFER_PTS(buffer) = track_output_time(GST_BUFFER_PTS(buffer), track, shift);
+            GST_BUFFER_DTS(buffer) = track_output_time(GST_BUFFER_DTS(buffer), track, shift);
+            if (!wait_for_appsrc_room(export_pipeline, appsrcs[pick], error)) {
+                gst_buffer_unref(buffer);
+                break;
+            }
+            if (gst_app_src_push_buffer(appsrcs[pick], buffer) != GST_FLOW_OK) {
+                error = "export pipeline stopped accepting data";
+                break;
+            }
+            if (++progress.frames_done % 64 == 0) {
+                publish(progress);
+            }
+        }
+        
+        if (!error.empty()) {
+            // A failed pipeline posts no EOS to wait for
+            gst_element_set_state(export_pipeline, GST_STATE_NULL);
+            gst_object_unref(export_pipeline);
+            return false;
+        }
+        for (GstAppSrc *appsrc : appsrcs) {
+            gst_app_src_end_of_stream(appsrc);
+        }
+        if (!finish_pipeline(export_pipeline, error)) {
+            return false;
+        }
+        
+        progress.state = EXPORT_DONE;
+        publish(progress);
+        return true;
+    }
+
+    void fail(const ExportJob &job, const std::string &reason) {
+        ExportProgress progress;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            progress = status[job.id];
+        }
+        progress.state = EXPORT_FAILED;
+        progress.detail = reason;
+        publish(progress);
+    }
+
+    void publish(const ExportProgress &progress) {
+        std::vector<Listener> targets;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            status[progress.job_id] = progress;
+            targets = listeners;
+        }
+        for (const Listener &listener : targets) {
+            listener(progress);
+        }
+    }
+
+    std::mutex lock;
+    std::condition_variable cond;
+    std::deque<ExportJob> pending;
+    std::deque<std::function<void()>> track_tasks;   // tracks of running jobs, taken before new jobs
+    std::map<guint, ExportProgress> status;
+    std::vector<Listener> listeners;
+    std::vector<std::thread> workers;
+    guint next_id;
+    bool stopping;
+};
+
+static ExportQueue *export_queue = nullptr;
+
+static void print_export_progress(const ExportProgress &progress) {
+    if (progress.state == EXPORT_RUNNING && progress.frames_total > 0) {
+        g_print("Export #%u [%s] %s %3d%% (%" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT " frames)\n",
+               progress.job_id, progress.camera_id.c_str(), export_state_name(progress.state),
+               (int)(progress.frames_done * 100 / progress.frames_total),
+               progress.frames_done, progress.frames_total);
+    } else {
+        g_print("Export #%u [%s] %s: %s\n",
+               progress.job_id, progress.camera_id.c_str(),
+               export_state_name(progress.state), progress.detail.c_str());
+    }
+}
+
+// Ring-backed mounts
+//
+// Mounts that play out of the frame rings use `appsrc name=src` and a
+// feeder object owned by that appsrc. need-data runs on the appsrc
+// streaming thread and pushes one access unit per call; the media's sinks
+// pace the output in real time. Transcoding mounts take raw frames instead
+// and encode them with an `encoder` element; their feeders set the raw caps.
+class MountFeeder {
+public:
+    virtual ~MountFeeder() {}
+    
+    // Push the next access unit (or raw frame) into `appsrc`, or end the stream
+    virtual void need_data(GstAppSrc *appsrc) = 0;
+    
+    // The camera the frames come from, when known up front
+    virtual std::shared_ptr<Camera> source_camera() const {
+        return nullptr;
+    }
+};
+
+static const guint MOUNT_BITRATE_KBPS = 4000;
+static const guint MOUNT_KEYFRAME_INTERVAL = 60;
+
+// Rung bitrates, top (pay0) first; empty without --ladder
+static std::vector<guint> ladder_kbps;
+
+typedef std::function<MountFeeder *()> FeederFactory;
+
+static void feeder_need_data(GstAppSrc *appsrc, guint, gpointer user_data) {
+    static_cast<MountFeeder *>(user_data)->need_data(appsrc);
+}
+
+static void feeder_destroy(gpointer user_data) {
+    delete static_cast<MountFeeder *>(user_data);
+}
+
+static GstPadProbeReturn stamp_capture_time(GstPad *, GstPadProbeInfo *info, gpointer) {
+    GST_PAD_PROBE_INFO_DATA(info) = add_capture_time_sei(GST_PAD_PROBE_INFO_BUFFER(info));
+    return GST_PAD_PROBE_OK;
+}
+
+// Every mount frame carries the capture time of the ring frame it came
+// from: as an SEI in the H.264 stream and as the RTP ntp-64 header
+// extension. Neither needs a re-encode.
+static void add_capture_time_outputs(GstElement *element) {
+    GstElement *parse = gst_bin_get_by_name_recurse_up(GST_BIN(element), "parse");
+    if (parse) {
+        GstPad *src = gst_element_get_static_pad(parse, "src");
+        gst_pad_add_probe(src, GST_PAD_PROBE_TYPE_BUFFER, stamp_capture_time, NULL, NULL);
+        gst_object_unref(src);
+        gst_object_unref(parse);
+    }
+    
+    GstElement *pay = gst_bin_get_by_name_recurse_up(GST_BIN(element), "pay0");
+    GstRTPHeaderExtension *ntp = gst_rtp_header_extension_create_from_uri("urn:ietf:params:rtp-hdrext:ntp-64");
+    if (pay && ntp) {
+        gst_rtp_header_extension_set_id(ntp, 1);
+        g_signal_emit_by_name(pay, "add-extension", ntp);
+    } else if (!ntp) {
+        g_printerr("rtphdrextntp64 not available; capture time is sent as SEI only\n");
+    }
+    if (ntp) gst_object_unref(ntp);
+    if (pay) gst_object_unref(pay);
+}
+
+// Per-session options from the request URL's query, e.g.
+// rtsp://host:8554/highlights?start=4&rate=0.5 or /scrub?rung=2
+struct MountSession {
+    GstClockTime start;     // skip this much output, resuming at a random access point
+    gdouble rate;           // playback speed; output timestamps are divided by it
+    guint rung;             // transcoding mounts: encode at this --ladder rung's bitrate
+    
+    MountSession() : start(0), rate(1.0), rung(0) {}
+};
+
+static const gdouble MOUNT_MIN_RATE = 1.0 / 16;
+static const gdouble MOUNT_MAX_RATE = 16.0;
+
+static void parse_mount_session(const gchar *query, MountSession &session) {
+    if (!query || !*query) {
+        return;
+    }
+    gchar **options = g_strsplit(query, "&", -1);
+    for (gchar **option = options; *option; option++) {
+        gchar *value = strchr(*option, '=');
+        gchar *end = nullptr;
+        gdouble number = value ? g_ascii_strtod(value + 1, &end) : 0.0;
+        bool valid = value && end != value + 1 && *end == '\0';
+        if (valid && g_str_has_prefix(*option, "start=") && number >= 0) {
+            session.start = (GstClockTime)(number * GST_SECOND);
+        } else if (valid && g_str_has_prefix(*option, "rate=") &&
+                   number >= MOUNT_MIN_RATE && number <= MOUNT_MAX_RATE) {
+            session.rate = number;
+        } else if (valid && g_str_has_prefix(*option, "rung=") && number >= 0 && number < ladder_kbps.size()) {
+            session.rung = (guint)number;
+        } else {
+            g_printerr("Ignoring mount option '%s'\n", *option);
+        }
+    }
+    g_strfreev(options);
+}
+
+struct MountSessionState {
+    MountSession session;
+    bool started;
+    GstClockTime base;      // output time that becomes 0
+};
+
+static void mount_session_destroy(gpointer user_data) {
+    delete static_cast<MountSessionState *>(user_data);
+}
+
+// On the appsrc's src pad: drop output before `start` and rescale time by `rate`
+static GstPadProbeReturn apply_mount_session(GstPad *, GstPadProbeInfo *info, gpointer user_data) {
+    MountSessionState *state = static_cast<MountSessionState *>(user_data);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    if (!state->started) {
+        if (!GST_CLOCK_TIME_IS_VALID(pts) || pts < state->session.start ||
+            GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+            return state->session.start > 0 ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+        }
+        state->started = true;
+        state->base = state->session.start > 0 ? pts : 0;
+    }
+    
+    buffer = gst_buffer_make_writable(buffer);
+    gdouble rate = state->session.rate;
+    if (GST_CLOCK_TIME_IS_VALID(pts)) {
+        GST_BUFFER_PTS(buffer) = (GstClockTime)((pts - std::min(pts, state->base)) / rate);
+    }
+    GstClockTime dts = GST_BUFFER_DTS(buffer);
+    if (GST_CLOCK_TIME_IS_VALID(dts)) {
+        GST_BUFFER_DTS(buffer) = (GstClockTime)((dts - std::min(dts, state->base)) / rate);
+    }
+    if (GST_BUFFER_DURATION_IS_VALID(buffer)) {
+        GST_BUFFER_DURATION(buffer) = (GstClockTime)(GST_BUFFER_DURATION(buffer) / rate);
+    }
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    return GST_PAD_PROBE_OK;
+}
+
+// Ring-backed mount factory
+//
+// A GstRTSPMediaFactory subclass that builds each client's media itself
+// instead of parsing a launch string:
+//   appsrc name=src [! session encoder bin] ! h264parse name=parse
+//     ! capsfilter (byte-stream, au) ! rtph264pay name=pay0
+// Element factories and caps are looked up once per mount, so creating a
+// media is a handful of gst_element_factory_create calls. The request URL
+// is parsed into a MountSession and applied to the new elements directly.
+// A transcoding mount's encoder bin (videoconvert ! encoder ! capsfilter
+// with the profile) is borrowed from the codec pool, keyed by encoder,
+// profile, the source camera's resolution and the bitrate, and is taken
+// back out of the media when the media is unprepared.
+static const char *const MOUNT_PROFILE = "high";
+struct ReplayMediaFactory {
+    GstRTSPMediaFactory parent;
+    FeederFactory *make_feeder;
+    GstElementFactory *appsrc;
+    GstElementFactory *convert;     // transcoding mounts only
+    GstElementFactory *encoder;     // transcoding mounts only
+    GstElementFactory *parse;
+    GstElementFactory *capsfilter;
+    GstElementFactory *pay;
+    GstCaps *au_caps;
+};
+
+struct ReplayMediaFactoryClass {
+    GstRTSPMediaFactoryClass parent_class;
+};
+
+G_DEFINE_TYPE(ReplayMediaFactory, replay_media_factory, GST_TYPE_RTSP_MEDIA_FACTORY)
+
+static void replay_media_factory_init(ReplayMediaFactory *factory) {
+    factory->make_feeder = nullptr;
+    factory->appsrc = nullptr;
+    factory->convert = nullptr;
+    factory->encoder = nullptr;
+    factory->parse = nullptr;
+    factory->capsfilter = nullptr;
+    factory->pay = nullptr;
+    factory->au_caps = nullptr;
+}
+
+static void replay_media_factory_finalize(GObject *object) {
+    ReplayMediaFactory *factory = reinterpret_cast<ReplayMediaFactory *>(object);
+    delete factory->make_feeder;
+    for (GstElementFactory *element_factory : { factory->appsrc, factory->convert, factory->encoder,
+                                                factory->parse, factory->capsfilter, factory->pay }) {
+        if (element_factory) gst_object_unref(element_factory);
+    }
+    if (factory->au_caps) gst_caps_unref(factory->au_caps);
+    G_OBJECT_CLASS(replay_media_factory_parent_class)->finalize(object);
+}
+
+// Pool key of a session encoder: encoder, profile, resolution, bitrate
+static std::string session_encoder_key(const ReplayMediaFactory *factory, const std::shared_ptr<Camera> &camera,
+                                       guint bitrate_kbps) {
+    gint width = 0, height = 0;
+    GstCaps *caps = camera ? camera->get_caps() : nullptr;
+    if (caps) {
+        GstStructure *structure = gst_caps_get_structure(caps, 0);
+        gst_structure_get_int(structure, "width", &width);
+        gst_structure_get_int(structure, "height", &height);
+        gst_caps_unref(caps);
+    }
+    gchar *key = g_strdup_printf("session/%s/%s/%dx%d/%u",
+                                 gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory->encoder)),
+                                 MOUNT_PROFILE, width, height, bitrate_kbps);
+    std::string result = key;
+    g_free(key);
+    return result;
+}
+
+// videoconvert ! encoder ! capsfilter (profile), behind sink and src ghost pads
+static GstElement* build_session_encoder(const ReplayMediaFactory *factory) {
+    GstElement *convert = gst_element_factory_create(factory->convert, NULL);
+    GstElement *encoder = gst_element_factory_create(factory->encoder, "encoder");
+    GstElement *profile = gst_element_factory_create(factory->capsfilter, NULL);
+    if (!convert || !encoder || !profile) {
+        for (GstElement *element : { convert, encoder, profile }) {
+            if (element) gst_object_unref(element);
+        }
+        return nullptr;
+    }
+    GstCaps *caps = gst_caps_new_simple("video/x-h264", "profile", G_TYPE_STRING, MOUNT_PROFILE, NULL);
+    g_object_set(G_OBJECT(profile), "caps", caps, NULL);
+    gst_caps_unref(caps);
+    
+    GstElement *bin = gst_bin_new("session-encoder");
+    gst_bin_add_many(GST_BIN(bin), convert, encoder, profile, NULL);
+    if (!gst_element_link_many(convert, encoder, profile, NULL)) {
+        gst_object_unref(bin);
+        return nullptr;
+    }
+    GstPad *sink = gst_element_get_static_pad(convert, "sink");
+    GstPad *src = gst_element_get_static_pad(profile, "src");
+    gst_element_add_pad(bin, gst_ghost_pad_new("sink", sink));
+    gst_element_add_pad(bin, gst_ghost_pad_new("src", src));
+    gst_object_unref(sink);
+    gst_object_unref(src);
+    // Pooled bins are held by a plain reference, like parked ones
+    gst_object_ref_sink(bin);
+    return bin;
+}
+
+// The media is finished with its encoder bin: take it out and park it
+static void return_session_encoder(GstRTSPMedia *media, gpointer) {
+    GstElement *element = gst_rtsp_media_get_element(media);
+    if (!element) {
+        return;
+    }
+    GstElement *encode = gst_bin_get_by_name(GST_BIN(element), "session-encoder");
+    const gchar *key = encode ? static_cast<const gchar *>(g_object_get_data(G_OBJECT(encode), "pool-key")) : nullptr;
+    if (key) {
+        std::string pool_key = key;
+        gst_bin_remove(GST_BIN(element), encode);     // unlinks it
+        codec_pool.release(pool_key, encode, true);
+    } else if (encode) {
+        gst_object_unref(encode);
+    }
+    gst_object_unref(element);
+}
+
+static GstElement* replay_media_factory_create_element(GstRTSPMediaFactory *base, const GstRTSPUrl *url) {
+    ReplayMediaFactory *factory = reinterpret_cast<ReplayMediaFactory *>(base);
+    MountSession session;
+    parse_mount_session(url ? url->query : nullptr, session);
+    MountFeeder *feeder = (*factory->make_feeder)();
+    
+    GstElement *encode = nullptr;
+    if (factory->encoder) {
+        guint bitrate_kbps = session.rung > 0 ? ladder_kbps[session.rung] : MOUNT_BITRATE_KBPS;
+        std::string key = session_encoder_key(factory, feeder->source_camera(), bitrate_kbps);
+        encode = codec_pool.acquire(key, [factory] () -> GstElement * {
+            return build_session_encoder(factory);
+        });
+        if (encode) {
+            configure_encoder(pooled_element(encode, "encoder"), replay_hw_type, bitrate_kbps, MOUNT_KEYFRAME_INTERVAL);
+            g_object_set_data_full(G_OBJECT(encode), "pool-key", g_strdup(key.c_str()), g_free);
+        }
+    }
+    
+    GstElement *bin = gst_bin_new(NULL);
+    GstElement *src = gst_element_factory_create(factory->appsrc, "src");
+    GstElement *parse = gst_element_factory_create(factory->parse, "parse");
+    GstElement *filter = gst_element_factory_create(factory->capsfilter, NULL);
+    GstElement *pay = gst_element_factory_create(factory->pay, "pay0");
+    if (!src || !parse || !filter || !pay || (factory->encoder && !encode)) {
+        for (GstElement *element : { src, encode, parse, filter, pay }) {
+            if (element) gst_object_unref(element);
+        }
+        gst_object_unref(bin);
+        delete feeder;
+        return nullptr;
+    }
+    
+    g_object_set(G_OBJECT(src), "format", GST_FORMAT_TIME, NULL);
+    g_object_set(G_OBJECT(filter), "caps", factory->au_caps, NULL);
+    g_object_set(G_OBJECT(pay), "pt", 96, "config-interval", -1, NULL);
+    gst_bin_add_many(GST_BIN(bin), src, parse, filter, pay, NULL);
+    bool linked;
+    if (encode) {
+        gst_bin_add(GST_BIN(bin), encode);
+        gst_object_unref(encode);       // the media's bin holds it now
+        linked = gst_element_link_many(src, encode, parse, filter, pay, NULL);
+    } else {
+        g_object_set(G_OBJECT(src), "caps", factory->au_caps, NULL);
+        linked = gst_element_link_many(src, parse, filter, pay, NULL);
+    }
+    if (!linked) {
+        gst_object_unref(bin);
+        delete feeder;
+        return nullptr;
+    }
+    
+    add_capture_time_outputs(bin);
+    if (session.start > 0 || session.rate != 1.0) {
+        MountSessionState *state = new MountSessionState();
+        state->session = session;
+        state->started = false;
+        state->base = 0;
+        GstPad *src_pad = gst_element_get_static_pad(src, "src");
+        gst_pad_add_probe(src_pad, GST_PAD_PROBE_TYPE_BUFFER, apply_mount_session, state, mount_session_destroy);
+        gst_object_unref(src_pad);
+    }
+    
+    GstAppSrcCallbacks callbacks = {};
+    callbacks.need_data = feeder_need_data;
+    gst_app_src_set_callbacks(GST_APP_SRC(src), &callbacks, feeder, feeder_destroy);
+    return bin;
+}
+
+static void replay_media_factory_configure(GstRTSPMediaFactory *base, GstRTSPMedia *media) {
+    GST_RTSP_MEDIA_FACTORY_CLASS(replay_media_factory_parent_class)->configure(base, media);
+    if (reinterpret_cast<ReplayMediaFactory *>(base)->encoder) {
+        g_signal_connect(media, "unprepared", G_CALLBACK(return_session_encoder), NULL);
+    }
+}
+
+static void replay_media_factory_class_init(ReplayMediaFactoryClass *klass) {
+    G_OBJECT_CLASS(klass)->finalize = replay_media_factory_finalize;
+    GST_RTSP_MEDIA_FACTORY_CLASS(klass)->create_element = replay_media_factory_create_element;
+    GST_RTSP_MEDIA_FACTORY_CLASS(klass)->configure = replay_media_factory_configure;
+}
+
+// Mount a per-client media that plays a feeder in passthrough, or encodes
+// its raw frames with `transcode`
+static void add_feeder_mount(GstRTSPMountPoints *mounts, const ReplayConfig &config,
+                             const std::string &path, FeederFactory make_feeder,
+                             bool transcode = false) {
+    ReplayMediaFactory *factory = static_cast<ReplayMediaFactory *>(
+        g_object_new(replay_media_factory_get_type(), NULL));
+    factory->make_feeder = new FeederFactory(make_feeder);
+    factory->appsrc = gst_element_factory_find("appsrc");
+    factory->parse = gst_element_factory_find("h264parse");
+    factory->capsfilter = gst_element_factory_find("capsfilter");
+    factory->pay = gst_element_factory_find("rtph264pay");
+    if (transcode) {
+        factory->convert = gst_element_factory_find("videoconvert");
+        factory->encoder = gst_element_factory_find(get_encoder_element(replay_hw_type));
+    }
+    factory->au_caps = gst_caps_from_string("video/x-h264,stream-format=byte-stream,alignment=au");
+    if (!factory->appsrc || !factory->parse || !factory->capsfilter || !factory->pay ||
+        (transcode && (!factory->convert || !factory->encoder))) {
+        g_printerr("Cannot mount %s: required elements are missing\n", path.c_str());
+        g_object_unref(factory);
+        return;
+    }
+    
+    GstRTSPMediaFactory *media_factory = GST_RTSP_MEDIA_FACTORY(factory);
+    gst_rtsp_media_factory_set_shared(media_factory, FALSE);
+    gst_rtsp_media_factory_set_enable_rtcp(media_factory, TRUE);
+    gst_rtsp_media_factory_set_protocols(media_factory, GST_RTSP_LOWER_TRANS_TCP);
+    
+    gst_rtsp_mount_points_add_factory(mounts, path.c_str(), media_factory);
+    g_print("✓ RTSP server mounted at rtsp://localhost:%d%s\n",
+           config.output_rtsp_port, path.c_str());
+}
+
+// Highlight reel
+struct ReelClip {
+    std::string camera_id;
+    gint64 start_us;
+    gint64 end_us;
+    std::shared_ptr<const SpeedCurve> speed_curve;
+    SpeedRampRender ramp_render;
+};
+
+static std::mutex reel_lock;
+static std::vector<ReelClip> reel_playlist;
+
+// Plays a snapshot of the playlist back-to-back. Each clip is a
+// frame-accurate export track (passthrough after at most one re-encoded
+// GOP); its timestamps are rewritten to continue where the previous clip
+// ended, and the next clip is prepared while the current one plays.
+class ReelFeeder : public MountFeeder {
+public:
+    explicit ReelFeeder(const std::vector<ReelClip> &clips)
+        : clips(clips), next_clip(0), frame_index(0), position(0), clip_end(0), shift(0),
+          frame_duration(GST_SECOND / 25) {
+        prepare_next();
+    }
+
+    void need_data(GstAppSrc *appsrc) override {
+        while (!current || frame_index >= current->frames.size()) {
+            position = clip_end;
+            current.reset();
+            if (!upcoming.valid()) {
+                gst_app_src_end_of_stream(appsrc);
+                return;
+            }
+            current = upcoming.get();
+            prepare_next();
+            if (current) {
+                start_clip();
+            }
+        }
+        
+        GstBuffer *buffer = gst_buffer_copy(current->frames[frame_index]);
+        if (frame_index == 0) {
+            splice_parameter_sets(buffer);
+        }
+        frame_index++;
+        
+        GST_BUFFER_PTS(buffer) = track_output_time(GST_BUFFER_PTS(buffer), *current, shift) + position;
+        if (GST_CLOCK_TIME_IS_VALID(GST_BUFFER_DTS(buffer))) {
+            GST_BUFFER_DTS(buffer) = track_output_time(GST_BUFFER_DTS(buffer), *current, shift) + position;
+        }
+        GST_BUFFER_DURATION(buffer) = frame_duration;
+        clip_end = std::max(clip_end, GST_BUFFER_PTS(buffer) + frame_duration);
+        gst_app_src_push_buffer(appsrc, buffer);
+    }
+
+private:
+    void prepare_next() {
+        if (next_clip >= clips.size()) {
+            upcoming = std::future<std::unique_ptr<ExportTrack>>();
+            return;
+        }
+        ReelClip clip = clips[next_clip++];
+        upcoming = std::async(std::launch::async, [clip] {
+            ExportJob job;
+            job.start_us = clip.start_us;
+            job.end_us = clip.end_us;
+            job.frame_accurate = true;
+            job.speed_curve = clip.speed_curve;
+            job.ramp_render = clip.ramp_render;
+            std::unique_ptr<ExportTrack> track(new ExportTrack());
+            std::string error;
+            if (!prepare_export_track(clip.camera_id, job, *track, error)) {
+                g_printerr("Reel: skipping clip from %s: %s\n", clip.camera_id.c_str(), error.c_str());
+                track.reset();
+            }
+            return track;
+        });
+    }
+
+    void start_clip() {
+        frame_index = 0;
+        frame_duration = estimate_frame_duration(*current);
+        GstClockTime first = current->first_decode_time();
+        shift = GST_CLOCK_TIME_IS_VALID(first) && first < current->cut_pts ? current->cut_pts - first : 0;
+    }
+
+    // Every splice starts with SPS/PPS so decoders can follow a change of
+    // camera (or of encoder, for a re-encoded head)
+    void splice_parameter_sets(GstBuffer *&buffer) {
+        GstMapInfo map;
+        if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+            return;
+        }
+        bool has_parameter_sets = !h264_parameter_sets(map.data, map.size).empty();
+        gst_buffer_unmap(buffer, &map);
+        if (has_parameter_sets) {
+            return;
+        }
+        
+        std::string parameter_sets = current->camera->get_parameter_sets();
+        if (!parameter_sets.empty()) {
+            GstBuffer *prefix = gst_buffer_new_memdup(parameter_sets.data(), parameter_sets.size());
+            GstBuffer *joined = gst_buffer_append(prefix, gst_buffer_ref(buffer));
+            gst_buffer_copy_into(joined, buffer, GST_BUFFER_COPY_METADATA, 0, -1);
+            gst_buffer_unref(buffer);
+            buffer = joined;
+        }
+    }
+
+    std::vector<ReelClip> clips;
+    size_t next_clip;
+    std::future<std::unique_ptr<ExportTrack>> upcoming;
+    std::unique_ptr<ExportTrack> current;
+    size_t frame_index;
+    GstClockTime position;          // output time where the current clip starts
+    GstClockTime clip_end;
+    GstClockTime shift;
+    GstClockTime frame_duration;
+};
+
+static MountFeeder* create_reel_feeder() {
+    std::lock_guard<std::mutex> guard(reel_lock);
+    return new ReelFeeder(reel_playlist);
+}
+
+// Loop mount
+//
+// A marked range is assembled once into a single block of memory; every
+// frame is a buffer over a slice of that block. Clients replay the frames
+// with a growing timestamp offset, so the ring is never read again and
+// each iteration only costs buffer metadata and packetization.
+struct PinnedLoop {
+    std::string camera_id;
+    gint64 start_us;
+    gint64 end_us;
+    std::vector<GstBuffer *> frames;    // decode order, timestamps from 0
+    GstClockTime duration;
+    gsize bytes;
+    
+    PinnedLoop() : start_us(0), end_us(0), duration(0), bytes(0) {}
+    ~PinnedLoop() {
+        for (GstBuffer *frame : frames) gst_buffer_unref(frame);
+    }
+};
+
+static std::mutex loop_lock;
+static std::shared_ptr<const PinnedLoop> pinned_loop;
+static guint64 loop_generation = 0;
+
+static std::shared_ptr<const PinnedLoop> current_loop() {
+    std::lock_guard<std::mutex> guard(loop_lock);
+    return pinned_loop;
+}
+
+// Copy a prepared track into one contiguous block. The first access unit
+// carries SPS/PPS so every wrap is a clean decoder entry point.
+static std::shared_ptr<PinnedLoop> pin_loop(const ExportTrack &track) {
+    std::string parameter_sets;
+    if (!track.frames.empty()) {
+        GstMapInfo map;
+        if (gst_buffer_map(track.frames[0], &map, GST_MAP_READ)) {
+            if (h264_parameter_sets(map.data, map.size).empty()) {
+                parameter_sets = track.camera->get_parameter_sets();
+            }
+            gst_buffer_unmap(track.frames[0], &map);
+        }
+    }
+    
+    gsize total = parameter_sets.size();
+    for (GstBuffer *frame : track.frames) {
+        total += gst_buffer_get_size(frame);
+    }
+    GstMemory *block = gst_allocator_alloc(nullptr, total, nullptr);
+    GstMapInfo block_map;
+    if (!block || !gst_memory_map(block, &block_map, GST_MAP_WRITE)) {
+        if (block) gst_memory_unref(block);
+        return nullptr;
+    }
+    
+    std::shared_ptr<PinnedLoop> loop(new PinnedLoop());
+    loop->camera_id = track.camera->id;
+    loop->bytes = total;
+    GstClockTime frame_duration = estimate_frame_duration(track);
+    GstClockTime first = track.first_decode_time();
+    GstClockTime shift = GST_CLOCK_TIME_IS_VALID(first) && first < track.cut_pts ? track.cut_pts - first : 0;
+    
+    gsize offset = 0;
+    for (size_t i = 0; i < track.frames.size(); i++) {
+        GstBuffer *source = track.frames[i];
+        gsize start = offset;
+        if (i == 0) {
+            memcpy(block_map.data, parameter_sets.data(), parameter_sets.size());
+            offset += parameter_sets.size();
+        }
+        offset += gst_buffer_extract(source, 0, block_map.data + offset, gst_buffer_get_size(source));
+        
+        GstBuffer *frame = gst_buffer_new();
+        gst_buffer_append_memory(frame, gst_memory_share(block, start, offset - start));
+        gst_buffer_copy_into(frame, source, GST_BUFFER_COPY_METADATA, 0, -1);
+        GST_BUFFER_PTS(frame) = track_output_time(GST_BUFFER_PTS(source), track, shift);
+        GST_BUFFER_DTS(frame) = track_output_time(GST_BUFFER_DTS(source), track, shift);
+        GST_BUFFER_DURATION(frame) = frame_duration;
+        if (GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(frame))) {
+            loop->duration = std::max(loop->duration, GST_BUFFER_PTS(frame) + frame_duration);
+        }
+        loop->frames.push_back(frame);
+    }
+    gst_memory_unmap(block, &block_map);
+    gst_memory_unref(block);
+    return loop;
+}
+
+// Pin a new loop off the main loop; a later loop-set or loop-clear wins
+// over a pin that is still being assembled
+static void start_pin_loop(const std::string &camera_id, const ExportJob &job) {
+    guint64 generation;
+    {
+        std::lock_guard<std::mutex> guard(loop_lock);
+        generation = ++loop_generation;
+    }
+    std::thread([camera_id, job, generation] {
+        ExportTrack track;
+        std::string error;
+        if (!prepare_export_track(camera_id, job, track, error)) {
+            g_printerr("Loop: cannot pin %s: %s\n", camera_id.c_str(), error.c_str());
+            return;
+        }
+        std::shared_ptr<PinnedLoop> loop = pin_loop(track);
+        if (!loop || loop->frames.empty()) {
+            g_printerr("Loop: cannot pin %s: out of memory\n", camera_id.c_str());
+            return;
+        }
+        loop->start_us = job.start_us;
+        loop->end_us = job.end_us;
+        
+        std::lock_guard<std::mutex> guard(loop_lock);
+        if (generation == loop_generation) {
+            pinned_loop = loop;
+            g_print("Loop: pinned %zu frames (%.3f s, %" G_GSIZE_FORMAT " KB) from %s\n",
+                   loop->frames.size(), loop->duration / (gdouble)GST_SECOND,
+                   loop->bytes / 1024, camera_id.c_str());
+        }
+    }).detach();
+}
+
+static void clear_loop() {
+    std::lock_guard<std::mutex> guard(loop_lock);
+    loop_generation++;
+    pinned_loop.reset();
+}
+
+// Replays the pinned loop forever. A newly pinned loop takes over at the
+// next wrap; clearing the loop ends the stream there.
+class LoopFeeder : public MountFeeder {
+public:
+    LoopFeeder() : frame_index(0), offset(0) {}
+
+    void need_data(GstAppSrc *appsrc) override {
+        if (!loop || frame_index >= loop->frames.size()) {
+            if (loop) {
+                offset += loop->duration;
+            }
+            loop = current_loop();
+            frame_index = 0;
+            if (!loop) {
+                gst_app_src_end_of_stream(appsrc);
+                return;
+            }
+        }
+        
+        GstBuffer *buffer = gst_buffer_copy(loop->frames[frame_index++]);
+        if (GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer))) {
+            GST_BUFFER_PTS(buffer) += offset;
+        }
+        if (GST_CLOCK_TIME_IS_VALID(GST_BUFFER_DTS(buffer))) {
+            GST_BUFFER_DTS(buffer) += offset;
+        }
+        gst_app_src_push_buffer(appsrc, buffer);
+    }
+
+private:
+    std::shared_ptr<const PinnedLoop> loop;
+    size_t frame_index;
+    GstClockTime offset;            // output time where the current iteration starts
+};
+
+static MountFeeder* create_loop_feeder() {
+    return new LoopFeeder();
+}
+
+// Decoded GOPs
+//
+// Raw frames of one GOP in presentation order, shared read-only between
+// the readers that play them
+struct DecodedGop {
+    std::vector<GstBuffer *> frames;
+    GstCaps *caps;
+    gsize bytes;
+    
+    DecodedGop() : caps(nullptr), bytes(0) {}
+    ~DecodedGop() {
+        for (GstBuffer *frame : frames) gst_buffer_unref(frame);
+        if (caps) gst_caps_unref(caps);
+    }
+    
+    // Frame presented at `pts`, or the nearest one
+    GstBuffer* frame_at(GstClockTime pts) const {
+        GstBuffer *best = nullptr;
+        GstClockTime best_distance = GST_CLOCK_TIME_NONE;
+        for (GstBuffer *frame : frames) {
+            GstClockTime t = GST_BUFFER_PTS(frame);
+            GstClockTime distance = t > pts ? t - pts : pts - t;
+            if (!best || distance < best_distance) {
+                best = frame;
+                best_distance = distance;
+            }
+        }
+        return best;
+    }
+};
+
+typedef std::shared_ptr<const DecodedGop> DecodedGopRef;
+
+static DecodedGopRef decode_gop(const std::shared_ptr<Camera> &camera, guint64 gop_seq) {
+    GopRef gop = gop_cache.acquire(camera, gop_seq);
+    GstCaps *stream_caps = camera->get_caps();
+    auto decoded = std::make_shared<DecodedGop>();
+    
+    // An intra-refresh GOP decodes cleanly after the GOPs from its clean
+    // decode start, as export cuts do (FrameRing::clean_decode_start). Those are fed decode-only,
+    // so the decoder never outputs them and no more than this GOP is held
+    // raw. Without them only the frames from the recovery point on are kept.
+    std::vector<GopRef> priming;
+    std::vector<GstBuffer *> input;
+    std::set<GstClockTime> keep;
+    if (gop && gop->clean_from > 0) {
+        guint64 seq = camera->ring->clean_decode_start(gop_seq);
+        while (seq < gop_seq) {
+            GopRef previous = gop_cache.acquire(camera, seq);
+            if (!previous || !previous->complete) {
+                priming.clear();
+                break;
+            }
+            priming.push_back(previous);
+            seq = previous->end_seq();
+        }
+        if (seq != gop_seq) {
+            priming.clear();
+        }
+    }
+    gsize priming_frames = 0;
+    for (const GopRef &previous : priming) {
+        priming_frames += previous->frames.size();
+        for (GstBuffer *frame : previous->frames) {
+            GstBuffer *priming_frame = gst_buffer_copy(frame);
+            GST_BUFFER_FLAG_SET(priming_frame, GST_BUFFER_FLAG_DECODE_ONLY);
+            input.push_back(priming_frame);
+        }
+    }
+    if (gop) {
+        input.insert(input.end(), gop->frames.begin(), gop->frames.end());
+        for (gsize i = priming.empty() ? gop->clean_from : 0; i < gop->frames.size(); i++) {
+            keep.insert(GST_BUFFER_PTS(gop->frames[i]));
+        }
+    }
+    bool ok = gop && stream_caps && decode_frames(input, stream_caps, decoded->frames, decoded->caps);
+    for (gsize i = 0; i < priming_frames; i++) {
+        gst_buffer_unref(input[i]);
+    }
+    if (stream_caps) gst_caps_unref(stream_caps);
+    if (!ok) {
+        g_printerr("GOP %" G_GUINT64_FORMAT " of %s is no longer available\n", gop_seq, camera->id.c_str());
+        return nullptr;
+    }
+    if (input.size() != gop->frames.size() || gop->clean_from > 0) {
+        // Decoders that ignore the decode-only flag still output primers
+        auto last = std::remove_if(decoded->frames.begin(), decoded->frames.end(), [&](GstBuffer *frame) {
+            if (keep.count(GST_BUFFER_PTS(frame))) {
+                return false;
+            }
+            gst_buffer_unref(frame);
+            return true;
+        });
+        decoded->frames.erase(last, decoded->frames.end());
+    }
+    for (GstBuffer *frame : decoded->frames) {
+        decoded->bytes += gst_buffer_get_size(frame);
+    }
+    return decoded;
+}
+
+// Recently decoded GOPs, bounded in bytes and evicted least recently used.
+// Decodes are shared: a lookup of a GOP that is being decoded waits for
+// that decode instead of starting another. Background decodes are limited
+// so prefetching never starves the decodes a viewer is waiting for.
+class DecodedGopCache {
+public:
+    DecodedGopCache(gsize budget_bytes, guint max_background)
+        : budget_bytes(budget_bytes), used_bytes(0), max_background(max_background), background(0) {}
+
+    // The decoded GOP, decoding it on this thread unless it is cached or
+    // already being decoded
+    DecodedGopRef get(const std::shared_ptr<Camera> &camera, guint64 gop_seq) {
+        std::shared_future<DecodedGopRef> result;
+        std::promise<DecodedGopRef> promise;
+        if (!lookup(key(*camera, gop_seq), promise, result)) {
+            return result.get();
+        }
+        DecodedGopRef decoded = decode_gop(camera, gop_seq);
+        promise.set_value(decoded);
+        finish(key(*camera, gop_seq), decoded);
+        return decoded;
+    }
+    
+    // The decoded GOP if it is ready, waiting at most `timeout`
+    DecodedGopRef peek(const Camera &camera, guint64 gop_seq, std::chrono::milliseconds timeout) {
+        std::shared_future<DecodedGopRef> result;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto it = entries.find(key(camera, gop_seq));
+            if (it == entries.end()) {
+                return nullptr;
+            }
+            result = it->second.result;
+            touch(it);
+        }
+        if (result.wait_for(timeout) != std::future_status::ready) {
+            return nullptr;
+        }
+        return result.get();
+    }
+    
+    // Start decoding in the background unless cached, in flight, or the
+    // background slots are all busy. Returns false only in the last case.
+    bool prefetch(const std::shared_ptr<Camera> &camera, guint64 gop_seq) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (entries.count(key(*camera, gop_seq))) {
+                return true;
+            }
+            if (background >= max_background) {
+                return false;
+            }
+            background++;
+        }
+        std::thread([this, camera, gop_seq] {
+            get(camera, gop_seq);
+            std::lock_guard<std::mutex> guard(lock);
+            background--;
+        }).detach();
+        return true;
+    }
+
+private:
+    typedef std::tuple<std::string, guint64, guint64> Key;   // camera id, generation, GOP
+    struct Entry {
+        std::shared_future<DecodedGopRef> result;
+        std::list<Key>::iterator recency;
+        gsize bytes;
+    };
+    
+    // A camera removed and added back under its id starts a new generation
+    static Key key(const Camera &camera, guint64 gop_seq) {
+        return Key(camera.id, camera.generation, gop_seq);
+    }
+    
+    // Register a decode for `key`; returns false with `result` set if one
+    // is cached or in flight
+    bool lookup(const Key &key, std::promise<DecodedGopRef> &promise, std::shared_future<DecodedGopRef> &result) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = entries.find(key);
+        if (it != entries.end()) {
+            result = it->second.result;
+            touch(it);
+            return false;
+        }
+        Entry &entry = entries[key];
+        entry.result = promise.get_future().share();
+        entry.recency = recency.insert(recency.end(), key);
+        entry.bytes = 0;
+        return true;
+    }
+    
+    void finish(const Key &key, const DecodedGopRef &decoded) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = entries.find(key);
+        if (it == entries.end()) {
+            return;
+        }
+        if (!decoded) {
+            recency.erase(it->second.recency);
+            entries.erase(it);
+            return;
+        }
+        it->second.bytes = decoded->bytes;
+        used_bytes += decoded->bytes;
+        
+        // Evict from the cold end; entries still decoding cost nothing yet
+        for (auto victim = recency.begin(); used_bytes > budget_bytes && victim != recency.end();) {
+            auto entry = entries.find(*victim);
+            if (entry->second.bytes == 0 || entry == it) {
+                ++victim;
+                continue;
+            }
+            used_bytes -= entry->second.bytes;
+            entries.erase(entry);
+            victim = recency.erase(victim);
+        }
+    }
+    
+    void touch(std::map<Key, Entry>::iterator it) {
+        recency.splice(recency.end(), recency, it->second.recency);
+    }
+    
+    std::mutex lock;
+    std::map<Key, Entry> entries;
+    std::list<Key> recency;                 // least recently used first
+    gsize budget_bytes;
+    gsize used_bytes;
+    guint max_background;
+    guint background;
+};
+
+// Scrub cache; created in main and left to process exit, since background
+// decodes may still be using it
+static DecodedGopCache *decoded_gop_cache = nullptr;
+
+// Raw-frame feeders for transcoding mounts
+class RawMountFeeder : public MountFeeder {
+public:
+    RawMountFeeder() : caps(nullptr) {}
+    ~RawMountFeeder() {
+        if (caps) gst_caps_unref(caps);
+    }
+
+protected:
+    // Push a raw frame, announcing its caps first when they change
+    void push_raw(GstAppSrc *appsrc, GstBuffer *frame, GstCaps *frame_caps) {
+        if (frame_caps && (!caps || !gst_caps_is_equal(caps, frame_caps))) {
+            gst_caps_replace(&caps, frame_caps);
+            gst_app_src_set_caps(appsrc, caps);
+        }
+        gst_app_src_push_buffer(appsrc, frame);
+    }
+
+private:
+    GstCaps *caps;
+};
+
+// Clients connecting while there is nothing to play get an empty stream
+class EmptyFeeder : public MountFeeder {
+public:
+    void need_data(GstAppSrc *appsrc) override {
+        gst_app_src_end_of_stream(appsrc);
+    }
+};
+
+// Reverse playback
+//
+// Plays a range backwards with every frame. Each GOP is decoded forward
+// and its frames are handed out last first. While one GOP plays out the
+// one before it is decoded on another thread, so no more than two GOPs of
+// raw frames are held. Each GOP is visited once, so the decoded-GOP cache
+// is bypassed.
+class ReverseReader {
+public:
+    ReverseReader(const std::shared_ptr<Camera> &camera, const TrackWindow &window)
+        : camera(camera), window(window), next_frame(0) {
+        RingFrame last;
+        if (camera->ring->read_frame(window.end_seq - 1, last)) {
+            upcoming_seq = last.gop_seq;
+            upcoming = decode_async(upcoming_seq);
+        }
+    }
+    
+    // Next raw frame going backwards (stream PTS kept), or nullptr once the
+    // start of the range, or a GOP that aged out, is reached
+    GstBuffer* next() {
+        for (;;) {
+            while (current && next_frame > 0) {
+                GstBuffer *frame = current->frames[--next_frame];
+                GstClockTime pts = GST_BUFFER_PTS(frame);
+                if (pts >= window.cut_pts && pts < window.end_pts) {
+                    return gst_buffer_ref(frame);
+                }
+            }
+            if (!upcoming.valid()) {
+                return nullptr;
+            }
+            guint64 gop_seq = upcoming_seq;
+            current = upcoming.get();
+            if (!current) {
+                return nullptr;
+            }
+            next_frame = current->frames.size();
+            
+            // Prefetch the previous GOP while this one plays out
+            guint64 previous = camera->ring->previous_random_access(gop_seq);
+            if (gop_seq > window.cut_gop_seq && previous != G_MAXUINT64) {
+                upcoming_seq = previous;
+                upcoming = decode_async(previous);
+            }
+        }
+    }
+    
+    // Raw caps of the GOP being played
+    GstCaps* caps() const {
+        return current ? current->caps : nullptr;
+    }
+
+private:
+    std::future<DecodedGopRef> decode_async(guint64 gop_seq) {
+        std::shared_ptr<Camera> source = camera;
+        return std::async(std::launch::async, [source, gop_seq] {
+            return decode_gop(source, gop_seq);
+        });
+    }
+    
+    std::shared_ptr<Camera> camera;
+    TrackWindow window;
+    DecodedGopRef current;
+    size_t next_frame;
+    guint64 upcoming_seq;
+    std::future<DecodedGopRef> upcoming;
+};
+
+struct ReverseRange {
+    std::string camera_id;
+    gint64 start_us;
+    gint64 end_us;
+};
+
+static std::mutex reverse_lock;
+static std::unique_ptr<ReverseRange> reverse_range;
+
+// Output time runs forward from the last frame of the range
+class ReverseFeeder : public RawMountFeeder {
+public:
+    ReverseFeeder(const std::shared_ptr<Camera> &camera, const TrackWindow &window)
+        : camera(camera), reader(camera, window), end_pts(window.end_pts) {}
+    
+    std::shared_ptr<Camera> source_camera() const override {
+        return camera;
+    }
+
+    void need_data(GstAppSrc *appsrc) override {
+        GstBuffer *frame = reader.next();
+        if (!frame) {
+            gst_app_src_end_of_stream(appsrc);
+            return;
+        }
+        frame = gst_buffer_make_writable(frame);
+        GstClockTime pts = GST_BUFFER_PTS(frame);
+        GST_BUFFER_PTS(frame) = end_pts > pts ? end_pts - pts : 0;
+        GST_BUFFER_DTS(frame) = GST_CLOCK_TIME_NONE;
+        push_raw(appsrc, frame, reader.caps());
+    }
+
+private:
+    std::shared_ptr<Camera> camera;
+    ReverseReader reader;
+    GstClockTime end_pts;
+};
+
+static MountFeeder* create_reverse_feeder() {
+    ReverseRange range;
+    {
+        std::lock_guard<std::mutex> guard(reverse_lock);
+        if (!reverse_range) {
+            return new EmptyFeeder();
+        }
+        range = *reverse_range;
+    }
+    std::shared_ptr<Camera> camera = find_camera(range.camera_id);
+    TrackWindow window;
+    if (!camera || !resolve_track_window(*camera, range.start_us, range.end_us, true, window)) {
+        g_printerr("Reverse: range is no longer buffered for %s\n", range.camera_id.c_str());
+        return new EmptyFeeder();
+    }
+    return new ReverseFeeder(camera, window);
+}
+
+// Jog/shuttle scrubbing
+//
+// The operator moves a cursor through one camera's buffer: `scrub` jumps,
+// `jog` steps, `shuttle` moves continuously at a rate. Cursor velocity is
+// tracked, and every time the cursor enters another GOP the GOPs ahead in
+// the direction of travel are decoded in the background. The lookahead is
+// one second of travel at the current velocity, at least one GOP and at
+// most four. A resting cursor prefetches both neighbours, so a change of
+// direction finds its GOP hot as well.
+// A shuttle runs for SCRUB_SHUTTLE_HOLD_US after the last command, so a
+// controller that goes away leaves the cursor standing; repeating the
+// shuttle command keeps it running. The measured jog velocity fades with
+// SCRUB_VELOCITY_DECAY_US once the commands stop.
+static const gint64 SCRUB_SHUTTLE_HOLD_US = 10 * G_USEC_PER_SEC;
+static const gdouble SCRUB_VELOCITY_DECAY_US = 0.5 * G_USEC_PER_SEC;
+
+class ScrubCursor {
+public:
+    ScrubCursor() : position_us(0), moved_at_us(0), shuttle_rate(0.0), velocity(0.0),
+                    prefetched_gop(G_MAXUINT64) {}
+
+    void jump(const std::string &camera, gint64 target_us) {
+        std::lock_guard<std::mutex> guard(lock);
+        gint64 now_us = g_get_monotonic_time();
+        gint64 from_us = position_locked(now_us);
+        gint64 elapsed_us = now_us - moved_at_us;
+        // Moves further apart than a second restart the estimate
+        gdouble instant = elapsed_us > 0 && elapsed_us < G_USEC_PER_SEC && camera == camera_id ?
+                          (gdouble)(target_us - from_us) / elapsed_us : 0.0;
+        velocity = 0.5 * velocity_locked(now_us) + 0.5 * instant;
+        camera_id = camera;
+        position_us = target_us;
+        moved_at_us = now_us;
+        shuttle_rate = 0.0;
+    }
+    
+    bool step(gdouble seconds) {
+        std::string camera;
+        gint64 target_us;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (camera_id.empty()) {
+                return false;
+            }
+            camera = camera_id;
+            target_us = position_locked(g_get_monotonic_time()) + (gint64)(seconds * G_USEC_PER_SEC);
+        }
+        jump(camera, target_us);
+        return true;
+    }
+    
+    std::string camera() {
+        std::lock_guard<std::mutex> guard(lock);
+        return camera_id;
+    }
+    
+    bool shuttle(gdouble rate) {
+        std::lock_guard<std::mutex> guard(lock);
+        if (camera_id.empty()) {
+            return false;
+        }
+        gint64 now_us = g_get_monotonic_time();
+        position_us = position_locked(now_us);
+        moved_at_us = now_us;
+        shuttle_rate = rate;
+        velocity = rate;
+        return true;
+    }
+    
+    // Current cursor, clamped into the camera's buffer. Kicks off the
+    // prefetch when the cursor has entered another GOP.
+    bool locate(std::shared_ptr<Camera> &camera, guint64 &seq, RingFrame &frame) {
+        std::string id;
+        gint64 target_us;
+        gdouble direction;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (camera_id.empty()) {
+                return false;
+            }
+            id = camera_id;
+            gint64 now_us = g_get_monotonic_time();
+            target_us = position_locked(now_us);
+            direction = velocity_locked(now_us);
+        }
+        camera = find_camera(id);
+        if (!camera) {
+            return false;
+        }
+        const FrameRing &ring = *camera->ring;
+        guint64 after = ring.find_frame_after(target_us);
+        seq = after > ring.tail() ? after - 1 : ring.tail();
+        if (seq >= ring.head() || !ring.read_frame(seq, frame) || frame.gop_seq < ring.tail()) {
+            return false;
+        }
+        
+        bool entered_gop;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            entered_gop = frame.gop_seq != prefetched_gop;
+            prefetched_gop = frame.gop_seq;
+        }
+        if (entered_gop) {
+            prefetch(camera, frame, direction);
+        }
+        return true;
+    }
+
+private:
+    gint64 position_locked(gint64 now_us) const {
+        return position_us + (gint64)(shuttle_rate * std::min(now_us - moved_at_us, SCRUB_SHUTTLE_HOLD_US));
+    }
+    
+    gdouble velocity_locked(gint64 now_us) const {
+        gint64 idle_us = now_us - moved_at_us;
+        if (shuttle_rate != 0.0 && idle_us < SCRUB_SHUTTLE_HOLD_US) {
+            return shuttle_rate;
+        }
+        return velocity * std::exp(-idle_us / SCRUB_VELOCITY_DECAY_US);
+    }
+    
+    static void prefetch(const std::shared_ptr<Camera> &camera, const RingFrame &frame, gdouble velocity) {
+        const FrameRing &ring = *camera->ring;
+        decoded_gop_cache->prefetch(camera, frame.gop_seq);
+        
+        const gdouble resting = 0.05;
+        gint64 reach_us = frame.capture_time_us + (gint64)(velocity * G_USEC_PER_SEC);
+        guint64 gop_seq = frame.gop_seq;
+        for (int ahead = 0; ahead < 4 && velocity >= -resting; ahead++) {
+            gop_seq = ring.find_random_access_from(gop_seq + 1);
+            RingFrame start;
+            if (!ring.read_frame(gop_seq, start) ||
+                (ahead > 0 && start.capture_time_us > reach_us) ||
+                !decoded_gop_cache->prefetch(camera, gop_seq)) {
+                break;
+            }
+        }
+        gop_seq = frame.gop_seq;
+        for (int ahead = 0; ahead < 4 && velocity <= resting; ahead++) {
+            gop_seq = ring.previous_random_access(gop_seq);
+            RingFrame start;
+            if (gop_seq == G_MAXUINT64 || !ring.read_frame(gop_seq, start) ||
+                (ahead > 0 && start.capture_time_us < reach_us) ||
+                !decoded_gop_cache->prefetch(camera, gop_seq)) {
+                break;
+            }
+        }
+    }
+    
+    std::mutex lock;
+    std::string camera_id;
+    gint64 position_us;             // replay timeline
+    gint64 moved_at_us;             // monotonic
+    gdouble shuttle_rate;           // timeline seconds per second while shuttling
+    gdouble velocity;               // smoothed, same unit
+    guint64 prefetched_gop;
+};
+
+static ScrubCursor scrub_cursor;
+
+// Shows the frame under the cursor at a steady output rate. A GOP that is
+// not decoded yet keeps the previous picture on screen for up to a frame
+// interval at a time instead of stalling the stream.
+class ScrubFeeder : public RawMountFeeder {
+public:
+    ScrubFeeder() : shown(nullptr), shown_caps(nullptr), output_pts(0) {}
+    ~ScrubFeeder() {
+        if (shown) gst_buffer_unref(shown);
+        if (shown_caps) gst_caps_unref(shown_caps);
+    }
+    
+    std::shared_ptr<Camera> source_camera() const override {
+        return find_camera(scrub_cursor.camera());
+    }
+
+    void need_data(GstAppSrc *appsrc) override {
+        const GstClockTime interval = GST_SECOND / 25;
+        std::shared_ptr<Camera> camera;
+        guint64 seq;
+        RingFrame frame;
+        if (scrub_cursor.locate(camera, seq, frame)) {
+            DecodedGopRef gop = decoded_gop_cache->peek(*camera, frame.gop_seq,
+                                                        std::chrono::milliseconds(interval / GST_MSECOND));
+            if (!gop && !shown) {
+                gop = decoded_gop_cache->get(camera, frame.gop_seq);
+            }
+            GstBuffer *picture = gop ? gop->frame_at(frame.pts) : nullptr;
+            if (picture) {
+                gst_buffer_replace(&shown, picture);
+                gst_caps_replace(&shown_caps, gop->caps);
+            }
+        }
+        if (!shown) {
+            gst_app_src_end_of_stream(appsrc);
+            return;
+        }
+        
+        GstBuffer *buffer = gst_buffer_copy(shown);
+        GST_BUFFER_PTS(buffer) = output_pts;
+        GST_BUFFER_DTS(buffer) = GST_CLOCK_TIME_NONE;
+        GST_BUFFER_DURATION(buffer) = interval;
+        output_pts += interval;
+        push_raw(appsrc, buffer, shown_caps);
+    }
+
+private:
+    GstBuffer *shown;
+    GstCaps *shown_caps;
+    GstClockTime output_pts;
+};
+
+static MountFeeder* create_scrub_feeder() {
+    return new ScrubFeeder();
+}
+
+// Client send queues
+//
+// Interleaved RTP for a TCP client leaves through that client's own bounded
+// queue, drained by a writer thread, instead of the connection's watch. The
+// media's streaming thread only ever appends, so a viewer on a bad link can
+// no longer back up a shared media for everyone else. When the queue would
+// exceed --client-queue-kb or span more than --client-queue-ms of RTP time,
+// its RTP is discarded and the client resumes at the next SPS or IDR. RTSP
+// replies and RTCP are never dropped.
+static const guint32 RTP_VIDEO_CLOCK_RATE = 90000;
+
+// A writer blocked this long on one message gives the client up; a partly
+// written interleaved frame cannot be recovered anyway
+static const gint64 CLIENT_SEND_TIMEOUT_US = 10 * G_USEC_PER_SEC;
+
+static std::string client_label(const std::string &client_id) {
+    return "client=\"" + client_id + "\"";
+}
+
+// RTP timestamp and payload of an interleaved data body
+static bool parse_rtp_packet(const guint8 *data, gsize size, guint32 &rtp_time,
+                             const guint8 *&payload, gsize &payload_size) {
+    if (size < 12 || (data[0] >> 6) != 2) {
+        return false;
+    }
+    gsize header = 12 + (data[0] & 0x0f) * 4;
+    if ((data[0] & 0x10) && size >= header + 4) {
+        header += 4 + GST_READ_UINT16_BE(data + header + 2) * 4;
+    }
+    if (header >= size) {
+        return false;
+    }
+    rtp_time = GST_READ_UINT32_BE(data + 4);
+    payload = data + header;
+    payload_size = size - header;
+    return true;
+}
+
+// An RFC 6184 payload a decoder can start from: an SPS or the first
+// fragment of an IDR slice, alone or leading an aggregate
+static bool h264_rtp_is_resync_point(const guint8 *payload, gsize size) {
+    guint8 type = payload[0] & 0x1f;
+    if (type == 24 && size > 3) {           // STAP-A
+        type = payload[3] & 0x1f;
+    } else if (type == 28 && size > 1) {    // FU-A
+        if (!(payload[1] & 0x80)) {
+            return false;
+        }
+        type = payload[1] & 0x1f;
+    }
+    return type == H264_NAL_SPS || type == H264_NAL_IDR;
+}
+
+// Adaptive ladder
+//
+// With --ladder, the /replay media encodes the decoded picture once more
+// per lower rung, each into its own payloader and appsink. Every rung has
+// the same GOP length and RTP timestamp base, so their IDRs line up. A
+// client on the ladder mount is switched by forwarding another rung's
+// packets from that rung's next SPS/IDR on, rewritten to the client's SSRC
+// and sequence numbers. Nothing is renegotiated and no encoder is added per
+// client.
+//
+// The estimate comes from the client's own queue. Backlog beyond
+// LADDER_DOWN_BACKLOG steps down, as far as the measured link rate needs.
+// A queue that has stayed nearly empty for LADDER_UP_PROBE_US probes one
+// rung up.
+static const GstClockTime LADDER_DOWN_BACKLOG = 500 * GST_MSECOND;
+static const GstClockTime LADDER_CALM_BACKLOG = 100 * GST_MSECOND;
+static const gint64 LADDER_UP_PROBE_US = 10 * G_USEC_PER_SEC;
+static const gint64 LADDER_DECISION_US = 250 * 1000;
+static const gdouble LADDER_HEADROOM = 0.8;         // share of the link a rung may use
+
+// Sending time a link estimate is averaged over
+static const gint64 LINK_WINDOW_US = G_USEC_PER_SEC;
+
+class ClientSendQueue;
+static std::mutex ladder_clients_lock;
+static std::set<ClientSendQueue *> ladder_clients;
+
+// Body of an interleaved data message, as a buffer reference
+static GstBuffer* data_body(GstRTSPMessage *message) {
+    if (gst_rtsp_message_has_body_buffer(message)) {
+        GstBuffer *body = nullptr;
+        gst_rtsp_message_get_body_buffer(message, &body);
+        return body ? gst_buffer_ref(body) : nullptr;
+    }
+    guint8 *data = nullptr;
+    guint size = 0;
+    if (gst_rtsp_message_get_body(message, &data, &size) != GST_RTSP_OK || !data) {
+        return nullptr;
+    }
+    return gst_buffer_new_memdup(data, size);
+}
+
+// Egress batching
+//
+// The writer takes everything that is waiting (up to EGRESS_BATCH_MESSAGES
+// or EGRESS_BATCH_BYTES) and hands it to the connection in one call, which
+// writes the `$` headers and the refcounted bodies with a single writev.
+// While the batch ends inside an access unit (no RTP marker bit yet) the
+// socket is corked, so the tail of a frame does not go out as a small
+// segment on its own.
+static const guint EGRESS_BATCH_MESSAGES = 64;
+static const gsize EGRESS_BATCH_BYTES = 256 * 1024;
+
+static void set_tcp_cork(GstRTSPConnection *connection, bool cork) {
+#ifdef TCP_CORK
+    GSocket *socket = gst_rtsp_connection_get_write_socket(connection);
+    if (socket) {
+        g_socket_set_option(socket, IPPROTO_TCP, TCP_CORK, cork ? 1 : 0, NULL);
+    }
+#endif
+}
+
+// Send `n` messages with one writev. `au_open`: the last message is an
+// RTP packet in the middle of an access unit, so keep the socket corked.
+static GstRTSPResult send_coalesced(GstRTSPConnection *connection, GstRTSPMessage *const *messages, guint n,
+                                    bool au_open, bool &corked, gint64 timeout_us) {
+    // Shallow copies: the connection only reads them, the originals own
+    // headers and bodies
+    std::vector<GstRTSPMessage> batch;
+    batch.reserve(n);
+    for (guint i = 0; i < n; i++) {
+        batch.push_back(*messages[i]);
+    }
+    if (au_open && !corked) {
+        set_tcp_cork(connection, true);
+        corked = true;
+    }
+    GstRTSPResult result = gst_rtsp_connection_send_messages_usec(connection, batch.data(), n, timeout_us);
+    if (!au_open && corked) {
+        set_tcp_cork(connection, false);
+        corked = false;
+    }
+    return result;
+}
+
+class ClientSendQueue {
+public:
+    ClientSendQueue(GstRTSPClient *client, const std::string &id, gsize max_bytes, GstClockTime max_duration)
+        : client(client), connection(gst_rtsp_client_get_connection(client)), id(id),
+          max_bytes(max_bytes), max_duration(max_duration), queued_bytes(0),
+          resyncing(false), stopping(false), dropped_packets(0),
+          adaptive(false), rung(0), target_rung(0), video_channel(-1), ssrc(0),
+          rewriting(false), next_seq(0), next_decision_us(0), calm_since_us(0),
+          link_kbps(0), window_bytes(0), window_us(0), sent_bytes(0) {
+        writer = std::thread(&ClientSendQueue::writer_main, this);
+    }
+    
+    ~ClientSendQueue() {
+        stop();
+        for (Entry &entry : pending) {
+            gst_rtsp_message_free(entry.message);
+        }
+        if (dropped_packets > 0) {
+            g_print("Client %s: %" G_GUINT64_FORMAT " RTP packets dropped to keep up\n",
+                    id.c_str(), dropped_packets);
+        }
+        metrics.remove(client_label(id));
+    }
+    
+    // Takes a copy of `message`; never blocks on the network
+    bool send(GstRTSPMessage *message, gboolean close) {
+        Entry entry;
+        entry.close = close;
+        GstBuffer *body = nullptr;
+        if (gst_rtsp_message_get_type(message) == GST_RTSP_MESSAGE_DATA &&
+            gst_rtsp_message_parse_data(message, &entry.channel) == GST_RTSP_OK) {
+            body = data_body(message);
+            if (body) {
+                entry.size = gst_buffer_get_size(body) + 4;
+                if (entry.channel % 2 == 0) {
+                    inspect_rtp(body, entry);
+                }
+            }
+        }
+        
+        std::lock_guard<std::mutex> guard(lock);
+        bool queued = enqueue(0, message, body, entry);
+        if (body) {
+            gst_buffer_unref(body);
+        }
+        return queued;
+    }
+    
+    // An RTP packet of lower ladder rung `source`
+    void offer_rung(guint source, GstBuffer *packet) {
+        Entry entry;
+        if (!inspect_rtp(packet, entry)) {
+            return;
+        }
+        entry.size = gst_buffer_get_size(packet) + 4;
+        std::lock_guard<std::mutex> guard(lock);
+        if (video_channel < 0) {
+            return;
+        }
+        entry.channel = (guint8)video_channel;
+        enqueue(source, nullptr, packet, entry);
+    }
+    
+    // The client plays the ladder mount: rung packets may replace pay0's,
+    // starting with `initial_rung` at its next IDR
+    // Both locks are held, in stop()'s order, so a queue being stopped is
+    // never added to the ladder clients
+    void set_adaptive(guint initial_rung) {
+        std::lock_guard<std::mutex> clients_guard(ladder_clients_lock);
+        std::lock_guard<std::mutex> guard(lock);
+        if (adaptive || stopping) {
+            return;
+        }
+        adaptive = true;
+        target_rung = std::min<guint>(initial_rung, ladder_kbps.size() - 1);
+        calm_since_us = g_get_monotonic_time();
+        metrics.set("client_rung", client_label(id), 0);
+        ladder_clients.insert(this);
+    }
+    
+    guint64 bytes_sent() const {
+        return sent_bytes.load(std::memory_order_relaxed);
+    }
+    
+    guint current_rung() {
+        std::lock_guard<std::mutex> guard(lock);
+        return rung;
+    }
+    
+    // Stop the writer and cancel a blocked send; safe to call repeatedly
+    void stop() {
+        {
+            std::lock_guard<std::mutex> clients_guard(ladder_clients_lock);
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+            ladder_clients.erase(this);
+        }
+        cond.notify_one();
+        if (writer.joinable()) {
+            gst_rtsp_connection_flush(connection, TRUE);
+            writer.join();
+        }
+    }
+
+private:
+    struct Entry {
+        GstRTSPMessage *message = nullptr;
+        gsize size = 0;
+        bool rtp = false;               // even channel: RTP, droppable
+        bool resync_point = false;
+        bool marker = false;            // last packet of an access unit
+        guint8 channel = 0;
+        guint32 rtp_time = 0;
+        guint16 seq = 0;
+        guint32 ssrc = 0;
+        gboolean close = FALSE;
+    };
+    
+    static bool inspect_rtp(GstBuffer *packet, Entry &entry) {
+        GstMapInfo map;
+        if (!gst_buffer_map(packet, &map, GST_MAP_READ)) {
+            return false;
+        }
+        const guint8 *payload;
+        gsize payload_size;
+        if (parse_rtp_packet(map.data, map.size, entry.rtp_time, payload, payload_size)) {
+            entry.rtp = true;
+            entry.seq = GST_READ_UINT16_BE(map.data + 2);
+            entry.ssrc = GST_READ_UINT32_BE(map.data + 8);
+            entry.marker = (map.data[1] & 0x80) != 0;
+            entry.resync_point = h264_rtp_is_resync_point(payload, payload_size);
+        }
+        gst_buffer_unmap(packet, &map);
+        return entry.rtp;
+    }
+    
+    // Queue a message from rung `source` (pay0 and RTSP traffic: 0); lock held
+    bool enqueue(guint source, GstRTSPMessage *message, GstBuffer *body, Entry &entry) {
+        if (stopping) {
+            return false;
+        }
+        bool rewrite = false;
+        if (entry.rtp && adaptive && (video_channel < 0 || entry.channel == video_channel)) {
+            if (source == 0) {
+                video_channel = entry.channel;
+                ssrc = entry.ssrc;
+                if (!rewriting) {
+                    next_seq = entry.seq + 1;
+                }
+            }
+            if (source == rung) {
+                adapt();
+            }
+            if (!select_rung(source, entry)) {
+                return true;
+            }
+            rewrite = rewriting;
+        }
+        if (entry.rtp && !admit(entry)) {
+            dropped_packets++;
+            metrics.add("client_dropped_packets_total", client_label(id));
+            metrics.add("client_dropped_bytes_total", client_label(id), entry.size);
+            return true;
+        }
+        
+        if (rewrite) {
+            entry.message = rewritten(entry.channel, body);
+        } else if (message && gst_rtsp_message_copy(message, &entry.message) != GST_RTSP_OK) {
+            entry.message = nullptr;
+        }
+        if (!entry.message) {
+            return false;
+        }
+        queued_bytes += entry.size;
+        pending.push_back(entry);
+        cond.notify_one();
+        return true;
+    }
+    
+    // Whether a video packet from `source` is forwarded. The current rung
+    // plays until the target rung reaches an SPS/IDR; then the target takes
+    // over from that packet on.
+    bool select_rung(guint source, const Entry &entry) {
+        if (source == target_rung && source != rung && entry.resync_point) {
+            g_print("Client %s: ladder rung %u -> %u (%u kbps)\n", id.c_str(), rung, source, ladder_kbps[source]);
+            rung = source;
+            rewriting = true;
+            metrics.add("client_rung_switches_total", client_label(id));
+            metrics.set("client_rung", client_label(id), rung);
+        }
+        return source == rung;
+    }
+    
+    // Pick the target rung from the queue's backlog and the link estimate
+    void adapt() {
+        gint64 now = g_get_monotonic_time();
+        if (now < next_decision_us) {
+            return;
+        }
+        next_decision_us = now + LADDER_DECISION_US;
+        
+        guint lowest = (guint)ladder_kbps.size() - 1;
+        GstClockTime backlog = backlog_duration();
+        if (backlog > LADDER_DOWN_BACKLOG) {
+            guint next = std::min(rung + 1, lowest);
+            while (next < lowest && link_kbps > 0 && ladder_kbps[next] > link_kbps * LADDER_HEADROOM) {
+                next++;
+            }
+            if (target_rung <= rung || next > target_rung) {
+                target_rung = next;
+            }
+            calm_since_us = now;
+        } else if (backlog < LADDER_CALM_BACKLOG) {
+            if (target_rung == rung && rung > 0 && now - calm_since_us >= LADDER_UP_PROBE_US) {
+                target_rung = rung - 1;
+                calm_since_us = now;
+            }
+        } else {
+            calm_since_us = now;
+        }
+    }
+    
+    // Copy of an RTP packet continuing the client's pay0 numbering
+    GstRTSPMessage* rewritten(guint8 channel, GstBuffer *body) {
+        GstBuffer *packet = gst_buffer_copy_deep(body);
+        GstMapInfo map;
+        if (!gst_buffer_map(packet, &map, GST_MAP_WRITE)) {
+            gst_buffer_unref(packet);
+            return nullptr;
+        }
+        GST_WRITE_UINT16_BE(map.data + 2, next_seq);
+        GST_WRITE_UINT32_BE(map.data + 8, ssrc);
+        gst_buffer_unmap(packet, &map);
+        next_seq++;
+        
+        GstRTSPMessage *message = nullptr;
+        if (gst_rtsp_message_new_data(&message, channel) != GST_RTSP_OK) {
+            gst_buffer_unref(packet);
+            return nullptr;
+        }
+        gst_rtsp_message_take_body_buffer(message, packet);
+        return message;
+    }
+    
+    // RTP time spanned by the queued packets of `entry`'s channel up to it
+    GstClockTime queued_duration(const Entry &entry) const {
+        for (const Entry &queued : pending) {
+            if (queued.rtp && queued.channel == entry.channel) {
+                guint32 span = entry.rtp_time - queued.rtp_time;
+                if (span > G_MAXINT32) {
+                    return 0;
+                }
+                return gst_util_uint64_scale(span, GST_SECOND, RTP_VIDEO_CLOCK_RATE);
+            }
+        }
+        return 0;
+    }
+    
+    // RTP time of video waiting in the queue
+    GstClockTime backlog_duration() const {
+        for (auto it = pending.rbegin(); it != pending.rend(); ++it) {
+            if (it->rtp && it->channel == video_channel) {
+                return queued_duration(*it);
+            }
+        }
+        return 0;
+    }
+    
+    // Whether an RTP packet goes on the queue; on overflow the queued RTP
+    // is discarded and the client waits for the next resync point
+    bool admit(const Entry &entry) {
+        if (!resyncing && (queued_bytes + entry.size > max_bytes ||
+                           (max_duration > 0 && queued_duration(entry) > max_duration))) {
+            guint dropped = 0;
+            gsize dropped_bytes = 0;
+            for (auto it = pending.begin(); it != pending.end();) {
+                if (it->rtp) {
+                    dropped++;
+                    dropped_bytes += it->size;
+                    queued_bytes -= it->size;
+                    gst_rtsp_message_free(it->message);
+                    it = pending.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            resyncing = true;
+            dropped_packets += dropped;
+            metrics.add("client_queue_overflows_total", client_label(id));
+            metrics.add("client_dropped_packets_total", client_label(id), dropped);
+            metrics.add("client_dropped_bytes_total", client_label(id), dropped_bytes);
+            g_print("Client %s fell behind; dropping to the next keyframe\n", id.c_str());
+            if (adaptive && rung + 1 < ladder_kbps.size()) {
+                target_rung = std::max(target_rung, rung + 1);
+            }
+        }
+        if (resyncing) {
+            if (!entry.resync_point) {
+                return false;
+            }
+            resyncing = false;
+        }
+        return true;
+    }
+    
+    void writer_main() {
+        bool corked = false;
+        std::vector<Entry> batch;
+        std::vector<GstRTSPMessage *> messages;
+        for (;;) {
+            gsize batch_bytes = 0;
+            bool backlogged;
+            batch.clear();
+            messages.clear();
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                cond.wait(guard, [this] { return stopping || !pending.empty(); });
+                if (stopping) {
+                    return;
+                }
+                while (!pending.empty() && batch.size() < EGRESS_BATCH_MESSAGES && batch_bytes < EGRESS_BATCH_BYTES) {
+                    batch.push_back(pending.front());
+                    pending.pop_front();
+                    batch_bytes += batch.back().size;
+                    messages.push_back(batch.back().message);
+                }
+                // Only a send with data still waiting behind it is link-limited
+                backlogged = !pending.empty();
+                queued_bytes -= batch_bytes;
+                metrics.set("client_send_queue_bytes", client_label(id), queued_bytes);
+            }
+            
+            bool au_open = batch.back().rtp && !batch.back().marker;
+            bool close = false;
+            for (const Entry &entry : batch) {
+                close = close || entry.close;
+            }
+            gint64 started_us = g_get_monotonic_time();
+            GstRTSPResult result = send_coalesced(connection, messages.data(), messages.size(), au_open, corked,
+                                                  CLIENT_SEND_TIMEOUT_US);
+            for (GstRTSPMessage *message : messages) {
+                gst_rtsp_message_free(message);
+            }
+            if (result != GST_RTSP_OK || close) {
+                if (result != GST_RTSP_OK) {
+                    g_printerr("Client %s: send failed, closing\n", id.c_str());
+                }
+                g_idle_add(close_client, g_object_ref(client));
+                std::lock_guard<std::mutex> guard(lock);
+                stopping = true;
+                return;
+            }
+            sent_bytes.fetch_add(batch_bytes, std::memory_order_relaxed);
+            metrics.add("client_send_calls_total", client_label(id));
+            if (backlogged) {
+                note_backlogged_send(batch_bytes, g_get_monotonic_time() - started_us);
+            }
+        }
+    }
+    
+    // With data waiting, the socket sets the pace: time spent in sends
+    // measures the link
+    void note_backlogged_send(gsize bytes, gint64 elapsed_us) {
+        std::lock_guard<std::mutex> guard(lock);
+        window_bytes += bytes;
+        window_us += elapsed_us;
+        if (window_us < LINK_WINDOW_US) {
+            return;
+        }
+        gdouble sample = window_bytes * 8.0 * 1000.0 / window_us;
+        link_kbps = link_kbps > 0 ? 0.7 * link_kbps + 0.3 * sample : sample;
+        window_bytes = 0;
+        window_us = 0;
+        metrics.set("client_link_kbps", client_label(id), (gint64)link_kbps);
+    }
+    
+    static gboolean close_client(gpointer data) {
+        GstRTSPClient *client = GST_RTSP_CLIENT(data);
+        gst_rtsp_client_close(client);
+        g_object_unref(client);
+        return G_SOURCE_REMOVE;
+    }
+    
+    GstRTSPClient *client;
+    GstRTSPConnection *connection;
+    std::string id;
+    gsize max_bytes;
+    GstClockTime max_duration;
+    
+    std::mutex lock;
+    std::condition_variable cond;
+    std::deque<Entry> pending;
+    gsize queued_bytes;
+    bool resyncing;
+    bool stopping;
+    guint64 dropped_packets;
+    
+    // Ladder state; rung 0 is pay0
+    bool adaptive;
+    guint rung;
+    guint target_rung;
+    gint video_channel;
+    guint32 ssrc;
+    bool rewriting;                 // numbering is ours since the first switch
+    guint16 next_seq;
+    gint64 next_decision_us;
+    gint64 calm_since_us;
+    gdouble link_kbps;
+    gsize window_bytes;
+    gint64 window_us;
+    
+    std::atomic<guint64> sent_bytes;
+    std::thread writer;
+};
+
+// Admission control
+//
+// Every SETUP is checked against --max-cpu and --max-egress-mbps before a
+// session exists. The check adds the measured cost of one more session of
+// that kind to the current load:
+//
+// - CPU: the process CPU time is sampled every second. When a session
+//   starts or ends and nothing else changes for ADMISSION_SETTLE_US, the
+//   change in load is one sample of that kind's cost.
+// - Egress: the bytes each client's writer actually sent, averaged over
+//   the sessions of a kind and scaled to the top ladder rung.
+//
+// Until a kind has been measured, conservative priors stand in. Each mount
+// a client sets up is decided and charged on its own; only a repeated
+// SETUP of the same mount passes without a new decision. A SETUP
+// that would cross a limit is refused with 503, so running sessions keep
+// their quality. A /replay SETUP that only exceeds the egress limit is
+// admitted on a lower ladder rung when one fits ("downgraded").
+enum SessionKind {
+    SESSION_PASSTHROUGH,    // reel, loop: ring frames as they are
+    SESSION_TRANSCODE,      // /replay: the shared transcode (ladder)
+    SESSION_TRICK_PLAY,     // reverse, scrub: decoded and re-encoded per client
+    SESSION_KIND_COUNT
+};
+
+static const char* session_kind_name(SessionKind kind) {
+    switch (kind) {
+        case SESSION_PASSTHROUGH: return "passthrough";
+        case SESSION_TRANSCODE: return "transcode";
+        case SESSION_TRICK_PLAY: return "trick_play";
+        default: return "unknown";
+    }
+}
+
+static const guint ADMISSION_PERIOD_MS = 1000;
+static const gint64 ADMISSION_SETTLE_US = 5 * G_USEC_PER_SEC;
+
+// Prior cost per session in cores, before any measurement
+static const gdouble ADMISSION_PRIOR_CORES[SESSION_KIND_COUNT] = {0.02, 0.1, 0.5};
+
+// Process CPU time (all threads) in microseconds
+static gint64 process_cpu_time_us() {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) {
+        return 0;
+    }
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    return (gint64)((k.QuadPart + u.QuadPart) / 10);
+#else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0) {
+        return 0;
+    }
+    return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+#endif
+}
+
+class AdmissionControl {
+public:
+    AdmissionControl() : max_cores(0), max_kbps(0), load_cores(0), last_cpu_us(0), last_tick_us(0), changes(0) {
+        for (int kind = 0; kind < SESSION_KIND_COUNT; kind++) {
+            costs[kind].cores = ADMISSION_PRIOR_CORES[kind];
+            costs[kind].kbps = MOUNT_BITRATE_KBPS;
+        }
+        pending_sample.due_us = 0;
+    }
+    
+    // Limits in cores and kbit/s; 0 leaves a resource unlimited
+    void configure(gdouble cores, gdouble kbps) {
+        std::lock_guard<std::mutex> guard(lock);
+        max_cores = cores;
+        max_kbps = kbps;
+    }
+    
+    // Decide on a SETUP of `mount` (a mount of `kind`) by `client`. A
+    // repeated SETUP of a mount the client was admitted to passes.
+    GstRTSPStatusCode admit(GstRTSPClient *client, const std::string &mount, SessionKind kind,
+                            const std::string &who) {
+        std::lock_guard<std::mutex> guard(lock);
+        Key key(client, mount);
+        if (sessions.count(key)) {
+            return GST_RTSP_STS_OK;
+        }
+        
+        gdouble egress_kbps = 0;
+        for (const auto &entry : sessions) {
+            egress_kbps += entry.second.kbps;
+        }
+        gdouble predicted_cores = load_cores + costs[kind].cores;
+        gdouble predicted_kbps = egress_kbps + costs[kind].kbps;
+        bool cpu_over = max_cores > 0 && predicted_cores > max_cores;
+        bool egress_over = max_kbps > 0 && predicted_kbps > max_kbps;
+        
+        guint rung = 0;
+        if (egress_over && !cpu_over && kind == SESSION_TRANSCODE) {
+            for (guint r = 1; r < ladder_kbps.size(); r++) {
+                gdouble kbps = egress_kbps + costs[kind].kbps * ladder_kbps[r] / ladder_kbps[0];
+                if (kbps <= max_kbps) {
+                    rung = r;
+                    predicted_kbps = kbps;
+                    egress_over = false;
+                    break;
+                }
+            }
+        }
+        
+        const char *decision = cpu_over || egress_over ? "rejected" : rung > 0 ? "downgraded" : "admitted";
+        const char *reason = cpu_over ? "cpu" : egress_over || rung > 0 ? "egress" : "none";
+        std::string kind_label = std::string("kind=\"") + session_kind_name(kind) + "\"";
+        metrics.add("admission_decisions_total",
+                    kind_label + ",decision=\"" + decision + "\",reason=\"" + reason + "\"");
+        metrics.set("admission_predicted_cpu_millicores", kind_label, (gint64)(predicted_cores * 1000));
+        metrics.set("admission_predicted_egress_kbps", kind_label, (gint64)predicted_kbps);
+        
+        if (cpu_over || egress_over) {
+            g_print("Refused %s session from %s: %s\n", session_kind_name(kind), who.c_str(),
+                    cpu_over ? format_cpu(predicted_cores).c_str() : format_egress(predicted_kbps).c_str());
+            return GST_RTSP_STS_SERVICE_UNAVAILABLE;
+        }
+        if (rung > 0) {
+            g_print("Admitted %s session from %s on rung %u (%u kbps): %s\n", session_kind_name(kind),
+                    who.c_str(), rung, ladder_kbps[rung], format_egress(predicted_kbps).c_str());
+        }
+        
+        Session session;
+        session.kind = kind;
+        session.rung = rung;
+        session.kbps = costs[kind].kbps * (rung > 0 ? (gdouble)ladder_kbps[rung] / ladder_kbps[0] : 1.0);
+        // A client that already has a send queue measures from now on
+        for (auto it = sessions.lower_bound(Key(client, std::string())); it != sessions.end() &&
+             it->first.first == client; ++it) {
+            if (it->second.queue) {
+                session.queue = it->second.queue;
+                session.last_bytes = session.queue->bytes_sent();
+                session.started_us = g_get_monotonic_time();
+                break;
+            }
+        }
+        sessions[key] = session;
+        note_change(kind, 1);
+        return GST_RTSP_STS_OK;
+    }
+    
+    // The client's send queue, once it exists, reports what it sends
+    void attach(GstRTSPClient *client, ClientSendQueue *queue) {
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto it = sessions.lower_bound(Key(client, std::string())); it != sessions.end() &&
+             it->first.first == client; ++it) {
+            it->second.queue = queue;
+            it->second.last_bytes = queue->bytes_sent();
+            it->second.started_us = g_get_monotonic_time();
+        }
+    }
+    
+    guint admitted_rung(GstRTSPClient *client, const std::string &mount) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = sessions.find(Key(client, mount));
+        return it != sessions.end() ? it->second.rung : 0;
+    }
+    
+    void release(GstRTSPClient *client) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = sessions.lower_bound(Key(client, std::string()));
+        while (it != sessions.end() && it->first.first == client) {
+            note_change(it->second.kind, -1);
+            it = sessions.erase(it);
+        }
+    }
+    
+    void release_queue(ClientSendQueue *queue) {
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto it = sessions.begin(); it != sessions.end();) {
+            if (it->second.queue == queue) {
+                note_change(it->second.kind, -1);
+                it = sessions.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    
+    // Once a second on the main loop: measure load and per-session costs
+    void tick() {
+        std::lock_guard<std::mutex> guard(lock);
+        gint64 now_us = g_get_monotonic_time();
+        gint64 cpu_us = process_cpu_time_us();
+        if (last_tick_us == 0) {
+            last_tick_us = now_us;
+            last_cpu_us = cpu_us;
+            return;
+        }
+        gdouble elapsed_us = (gdouble)(now_us - last_tick_us);
+        if (elapsed_us <= 0) {
+            return;
+        }
+        gdouble cores = (cpu_us - last_cpu_us) / elapsed_us;
+        load_cores = load_cores > 0 ? 0.5 * load_cores + 0.5 * cores : cores;
+        last_tick_us = now_us;
+        last_cpu_us = cpu_us;
+        
+        // Egress per session, normalised to the top rung per kind. Sessions
+        // of one client share its queue, and so its bytes.
+        std::map<ClientSendQueue *, guint> shares;
+        for (const auto &entry : sessions) {
+            if (entry.second.queue) {
+                shares[entry.second.queue]++;
+            }
+        }
+        gdouble egress_kbps = 0;
+        gdouble kind_kbps[SESSION_KIND_COUNT] = {};
+        guint kind_sessions[SESSION_KIND_COUNT] = {};
+        guint active[SESSION_KIND_COUNT] = {};
+        for (auto &entry : sessions) {
+            Session &session = entry.second;
+            active[session.kind]++;
+            if (!session.queue) {
+                continue;
+            }
+            guint64 bytes = session.queue->bytes_sent();
+            gdouble kbps = (bytes - session.last_bytes) * 8.0 * 1000.0 / elapsed_us / shares[session.queue];
+            session.last_bytes = bytes;
+            session.kbps = 0.7 * session.kbps + 0.3 * kbps;
+            egress_kbps += session.kbps;
+            if (now_us - session.started_us >= ADMISSION_SETTLE_US) {
+                guint rung = std::min<guint>(session.queue->current_rung(), ladder_kbps.size() ? ladder_kbps.size() - 1 : 0);
+                gdouble scale = rung > 0 ? (gdouble)ladder_kbps[0] / ladder_kbps[rung] : 1.0;
+                kind_kbps[session.kind] += session.kbps * scale;
+                kind_sessions[session.kind]++;
+            }
+        }
+        for (int kind = 0; kind < SESSION_KIND_COUNT; kind++) {
+            std::string kind_label = std::string("kind=\"") + session_kind_name((SessionKind)kind) + "\"";
+            if (kind_sessions[kind] > 0) {
+                costs[kind].kbps = 0.8 * costs[kind].kbps + 0.2 * kind_kbps[kind] / kind_sessions[kind];
+            }
+            metrics.set("sessions_active", kind_label, active[kind]);
+            metrics.set("session_cost_egress_kbps", kind_label, (gint64)costs[kind].kbps);
+            metrics.set("session_cost_cpu_millicores", kind_label, (gint64)(costs[kind].cores * 1000));
+        }
+        metrics.set("host_cpu_millicores", "", (gint64)(load_cores * 1000));
+        metrics.set("egress_kbps", "", (gint64)egress_kbps);
+        
+        // A start or stop with nothing else changing since: its load step
+        if (pending_sample.due_us != 0 && now_us >= pending_sample.due_us) {
+            if (pending_sample.generation == changes) {
+                gdouble step = std::max(0.0, (load_cores - pending_sample.load_before) * pending_sample.sign);
+                Cost &cost = costs[pending_sample.kind];
+                cost.cores = cost.cpu_measured ? 0.7 * cost.cores + 0.3 * step : step;
+                cost.cpu_measured = true;
+            }
+            pending_sample.due_us = 0;
+        }
+    }
+
+private:
+    typedef std::pair<GstRTSPClient *, std::string> Key;   // client, mount
+    struct Session {
+        SessionKind kind = SESSION_PASSTHROUGH;
+        guint rung = 0;
+        ClientSendQueue *queue = nullptr;
+        guint64 last_bytes = 0;
+        gint64 started_us = 0;
+        gdouble kbps = 0;
+    };
+    
+    struct Cost {
+        gdouble cores = 0;
+        gdouble kbps = 0;
+        bool cpu_measured = false;
+    };
+    
+    struct LoadSample {
+        SessionKind kind;
+        gdouble load_before;
+        gint64 due_us;
+        guint64 generation;
+        int sign;
+    };
+    
+    // Start a load-step measurement for this change; any earlier one is void
+    void note_change(SessionKind kind, int sign) {
+        pending_sample.kind = kind;
+        pending_sample.load_before = load_cores;
+        pending_sample.due_us = g_get_monotonic_time() + ADMISSION_SETTLE_US;
+        pending_sample.generation = ++changes;
+        pending_sample.sign = sign;
+    }
+    
+    std::string format_cpu(gdouble cores) const {
+        gchar *text = g_strdup_printf("CPU %.2f cores > %.2f", cores, max_cores);
+        std::string result = text;
+        g_free(text);
+        return result;
+    }
+    
+    std::string format_egress(gdouble kbps) const {
+        gchar *text = g_strdup_printf("egress %.0f kbps, limit %.0f", kbps, max_kbps);
+        std::string result = text;
+        g_free(text);
+        return result;
+    }
+    
+    std::mutex lock;
+    gdouble max_cores;
+    gdouble max_kbps;
+    gdouble load_cores;
+    gint64 last_cpu_us;
+    gint64 last_tick_us;
+    Cost costs[SESSION_KIND_COUNT];
+    std::map<Key, Session> sessions;
+    LoadSample pending_sample;
+    guint64 changes;
+};
+
+static AdmissionControl admission;
+
+static gboolean admission_tick(gpointer) {
+    admission.tick();
+    return G_SOURCE_CONTINUE;
+}
+
+// Whether `path` (a request URI path) is on `mount` or one of its streams
+static bool path_on_mount(const std::string &path, const std::string &mount) {
+    return path == mount || path.compare(0, mount.size() + 1, mount + "/") == 0;
+}
+
+// The mount `path` is on, and its kind of session
+static bool session_kind_for_path(const ReplayConfig &config, const std::string &path, std::string &mount,
+                                  SessionKind &kind) {
+    const std::pair<const std::string *, SessionKind> mounts[] = {
+        { &config.output_mount_point, SESSION_TRANSCODE },
+        { &config.reel_mount_point, SESSION_PASSTHROUGH },
+        { &config.loop_mount_point, SESSION_PASSTHROUGH },
+        { &config.reverse_mount_point, SESSION_TRICK_PLAY },
+        { &config.scrub_mount_point, SESSION_TRICK_PLAY },
+    };
+    for (const auto &entry : mounts) {
+        if (path_on_mount(path, *entry.first)) {
+            mount = *entry.first;
+            kind = entry.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Egress benchmark
+//
+// Plays a synthetic 4 Mbit/s, 30 fps stream (12 RTP packets of 1400 bytes
+// per access unit) in real time to a reader over loopback TCP. A producer
+// thread hands the packets over as the payloader does, either all of an
+// access unit at once or EGRESS_BENCHMARK_PACKET_GAP_US apart. A writer
+// thread sends them in two ways. The first is one send per message, as the
+// connection's watch writes them. The second is as the client writer
+// does: whatever is waiting goes out in one writev, corked while the batch
+// ends inside an access unit. Each run reports send calls, corked sends
+// and writer CPU per second of stream, i.e. the cost of one viewer.
+static const guint EGRESS_BENCHMARK_FPS = 30;
+static const guint EGRESS_BENCHMARK_PACKETS_PER_AU = 12;
+static const gsize EGRESS_BENCHMARK_PACKET_BYTES = 1400;
+static const guint EGRESS_BENCHMARK_SECONDS = 20;
+static const gint64 EGRESS_BENCHMARK_PACKET_GAP_US = 150;
+
+// CPU time of the calling thread in microseconds
+static gint64 thread_cpu_time_us() {
+#ifdef _WIN32
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+        return 0;
+    }
+    ULARGE_INTEGER k, u;
+    k.LowPart = kernel.dwLowDateTime;
+    k.HighPart = kernel.dwHighDateTime;
+    u.LowPart = user.dwLowDateTime;
+    u.HighPart = user.dwHighDateTime;
+    return (gint64)((k.QuadPart + u.QuadPart) / 10);
+#else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+        return 0;
+    }
+    return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+#endif
+}
+
+// Connected loopback TCP pair; false if the sandbox has no loopback
+static bool loopback_pair(GSocket *&sender, GSocket *&receiver) {
+    GSocket *listener = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, NULL);
+    GInetAddress *loopback = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+    GSocketAddress *address = g_inet_socket_address_new(loopback, 0);
+    g_object_unref(loopback);
+    sender = receiver = nullptr;
+    
+    bool ok = listener && g_socket_bind(listener, address, TRUE, NULL) && g_socket_listen(listener, NULL);
+    g_object_unref(address);
+    if (ok) {
+        GSocketAddress *bound = g_socket_get_local_address(listener, NULL);
+        sender = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, NULL);
+        ok = bound && sender && g_socket_connect(sender, bound, NULL, NULL);
+        if (bound) g_object_unref(bound);
+    }
+    if (ok) {
+        receiver = g_socket_accept(listener, NULL, NULL);
+        ok = receiver != nullptr;
+    }
+    if (listener) g_object_unref(listener);
+    if (!ok) {
+        if (sender) g_object_unref(sender);
+        sender = nullptr;
+    }
+    return ok;
+}
+
+struct EgressBenchmarkResult {
+    guint64 send_calls = 0;
+    guint64 corked_sends = 0;
+    gint64 cpu_us = 0;
+};
+
+static bool benchmark_egress_run(bool coalesced, gint64 packet_gap_us, EgressBenchmarkResult &result) {
+    GSocket *sender, *receiver;
+    if (!loopback_pair(sender, receiver)) {
+        return false;
+    }
+    GstRTSPConnection *connection = nullptr;
+    if (gst_rtsp_connection_create_from_socket(sender, "127.0.0.1", 0, NULL, &connection) != GST_RTSP_OK) {
+        g_object_unref(sender);
+        g_object_unref(receiver);
+        return false;
+    }
+    
+    std::thread reader([receiver] {
+        std::vector<gchar> scratch(256 * 1024);
+        while (g_socket_receive(receiver, scratch.data(), scratch.size(), NULL, NULL) > 0) {
+        }
+    });
+    
+    // One refcounted body per packet slot, reused for every access unit
+    std::vector<GstBuffer *> bodies;
+    for (guint i = 0; i < EGRESS_BENCHMARK_PACKETS_PER_AU; i++) {
+        GstBuffer *body = gst_buffer_new_allocate(NULL, EGRESS_BENCHMARK_PACKET_BYTES, NULL);
+        GstMapInfo map;
+        gst_buffer_map(body, &map, GST_MAP_WRITE);
+        memset(map.data, 0, map.size);
+        map.data[0] = 0x80;
+        map.data[1] = 96 | (i + 1 == EGRESS_BENCHMARK_PACKETS_PER_AU ? 0x80 : 0);
+        gst_buffer_unmap(body, &map);
+        bodies.push_back(body);
+    }
+    
+    // Producer: access units on the frame clock, (message, marker) pairs
+    std::mutex lock;
+    std::condition_variable cond;
+    std::deque<std::pair<GstRTSPMessage *, bool>> queue;
+    bool produced = false;
+    std::thread producer([&] {
+        gint64 started_us = g_get_monotonic_time();
+        for (guint au = 0; au < EGRESS_BENCHMARK_SECONDS * EGRESS_BENCHMARK_FPS; au++) {
+            gint64 wait_us = started_us + (gint64)au * G_USEC_PER_SEC / EGRESS_BENCHMARK_FPS - g_get_monotonic_time();
+            if (wait_us > 0) {
+                g_usleep(wait_us);
+            }
+            for (guint i = 0; i < bodies.size(); i++) {
+                if (i > 0 && packet_gap_us > 0) {
+                    g_usleep(packet_gap_us);
+                }
+                GstRTSPMessage *message;
+                gst_rtsp_message_new_data(&message, 0);
+                gst_rtsp_message_take_body_buffer(message, gst_buffer_ref(bodies[i]));
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    queue.emplace_back(message, i + 1 == bodies.size());
+                }
+                cond.notify_one();
+            }
+        }
+        std::lock_guard<std::mutex> guard(lock);
+        produced = true;
+        cond.notify_one();
+    });
+    
+    // Writer: as ClientSendQueue::writer_main, or one message per send
+    bool ok = true;
+    bool corked = false;
+    std::vector<GstRTSPMessage *> messages;
+    gint64 started_us = thread_cpu_time_us();
+    for (;;) {
+        bool au_open;
+        messages.clear();
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            cond.wait(guard, [&] { return produced || !queue.empty(); });
+            if (queue.empty()) {
+                break;
+            }
+            do {
+                messages.push_back(queue.front().first);
+                au_open = !queue.front().second;
+                queue.pop_front();
+            } while (coalesced && !queue.empty() && messages.size() < EGRESS_BATCH_MESSAGES);
+        }
+        if (ok && coalesced) {
+            ok = send_coalesced(connection, messages.data(), messages.size(), au_open, corked,
+                                CLIENT_SEND_TIMEOUT_US) == GST_RTSP_OK;
+            result.send_calls++;
+            result.corked_sends += au_open ? 1 : 0;
+        } else if (ok) {
+            ok = gst_rtsp_connection_send_usec(connection, messages[0], CLIENT_SEND_TIMEOUT_US) == GST_RTSP_OK;
+            result.send_calls++;
+        }
+        for (GstRTSPMessage *message : messages) {
+            gst_rtsp_message_free(message);
+        }
+    }
+    result.cpu_us = thread_cpu_time_us() - started_us;
+    producer.join();
+    
+    gst_rtsp_connection_free(connection);
+    g_socket_close(sender, NULL);
+    reader.join();
+    g_object_unref(receiver);
+    for (GstBuffer *body : bodies) {
+        gst_buffer_unref(body);
+    }
+    return ok;
+}
+
+static int run_egress_benchmark() {
+    g_print("Interleaved TCP egress: %u fps, %u x %" G_GSIZE_FORMAT " byte packets per access unit, "
+            "%u s of stream paced over loopback\n", EGRESS_BENCHMARK_FPS, EGRESS_BENCHMARK_PACKETS_PER_AU,
+            EGRESS_BENCHMARK_PACKET_BYTES, EGRESS_BENCHMARK_SECONDS);
+    const gint64 gaps_us[] = { 0, EGRESS_BENCHMARK_PACKET_GAP_US };
+    const char *modes[] = { "per message", "coalesced" };
+    for (gint64 gap_us : gaps_us) {
+        if (gap_us > 0) {
+            g_print(" Packets %" G_GINT64_FORMAT " us apart:\n", gap_us);
+        } else {
+            g_print(" Access units in one burst:\n");
+        }
+        for (int coalesced = 0; coalesced < 2; coalesced++) {
+            EgressBenchmarkResult result;
+            if (!benchmark_egress_run(coalesced != 0, gap_us, result)) {
+                g_printerr("Egress benchmark failed: no loopback TCP\n");
+                return 1;
+            }
+            g_print("  %-12s %6.0f send calls/s  %5.0f corked/s  %6.3f ms CPU per stream second "
+                    "(%.2f%% of a core per viewer)\n",
+                    modes[coalesced], (gdouble)result.send_calls / EGRESS_BENCHMARK_SECONDS,
+                    (gdouble)result.corked_sends / EGRESS_BENCHMARK_SECONDS,
+                    result.cpu_us / 1000.0 / EGRESS_BENCHMARK_SECONDS,
+                    result.cpu_us / 10000.0 / EGRESS_BENCHMARK_SECONDS);
+        }
+    }
+    return 0;
+}
+
+static gboolean client_queue_send(GstRTSPClient *, GstRTSPMessage *message, gboolean close, gpointer user_data) {
+    return static_cast<ClientSendQueue *>(user_data)->send(message, close);
+}
+
+static gboolean client_queue_send_messages(GstRTSPClient *, GstRTSPMessage *messages, guint n_messages,
+                                           gboolean close, gpointer user_data) {
+    ClientSendQueue *queue = static_cast<ClientSendQueue *>(user_data);
+    for (guint i = 0; i < n_messages; i++) {
+        if (!queue->send(&messages[i], close && i + 1 == n_messages)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static void client_queue_destroy(gpointer user_data) {
+    ClientSendQueue *queue = static_cast<ClientSendQueue *>(user_data);
+    admission.release_queue(queue);
+    delete queue;
+}
+
+// RTSP clients with an open connection, for the handoff drain
+static std::atomic<int> connected_clients(0);
+
+static void on_client_closed(GstRTSPClient *client, gpointer) {
+    connected_clients--;
+    ClientSendQueue *queue = static_cast<ClientSendQueue *>(g_object_get_data(G_OBJECT(client), "send-queue"));
+    if (queue) {
+        queue->stop();
+    }
+    admission.release(client);
+}
+
+// The client's watch is attached by the time it creates a session, and
+// the SETUP reply is not sent yet: from here on everything goes through
+// the queue, in order
+static void on_client_new_session(GstRTSPClient *client, GstRTSPSession *, gpointer user_data) {
+    const ReplayConfig *config = static_cast<const ReplayConfig *>(user_data);
+    if (g_object_get_data(G_OBJECT(client), "send-queue")) {
+        return;
+    }
+    static std::atomic<guint> next_client(1);
+    GstRTSPConnection *connection = gst_rtsp_client_get_connection(client);
+    if (!connection) {
+        return;
+    }
+    std::string id = std::string(gst_rtsp_connection_get_ip(connection)) + "#" + std::to_string(next_client++);
+    
+    // Emitted on the thread the server attached the client to
+    static std::atomic<guint> next_thread(0);
+    thread_local guint thread_index = next_thread++;
+    metrics.add("rtsp_thread_sessions_total", "thread=\"" + std::to_string(thread_index) + "\"");
+    
+    ClientSendQueue *queue = new ClientSendQueue(client, id, (gsize)config->client_queue_kb * 1024,
+                                                 (GstClockTime)config->client_queue_ms * GST_MSECOND);
+    g_object_set_data(G_OBJECT(client), "send-queue", queue);
+    gst_rtsp_client_set_send_messages_func(client, client_queue_send_messages, queue, NULL);
+    gst_rtsp_client_set_send_func(client, client_queue_send, queue, client_queue_destroy);
+    admission.attach(client, queue);
+}
+
+// Clients playing the ladder mount follow their link across the rungs
+static void on_client_play_request(GstRTSPClient *client, GstRTSPContext *ctx, gpointer user_data) {
+    const ReplayConfig *config = static_cast<const ReplayConfig *>(user_data);
+    ClientSendQueue *queue = static_cast<ClientSendQueue *>(g_object_get_data(G_OBJECT(client), "send-queue"));
+    if (!queue || ladder_kbps.size() < 2 || !ctx->uri || !ctx->uri->abspath) {
+        return;
+    }
+    if (path_on_mount(ctx->uri->abspath, config->output_mount_point)) {
+        queue->set_adaptive(admission.admitted_rung(client, config->output_mount_point));
+    }
+}
+
+// Admission control runs before the SETUP creates anything
+static GstRTSPStatusCode on_client_pre_setup(GstRTSPClient *client, GstRTSPContext *ctx, gpointer user_data) {
+    const ReplayConfig *config = static_cast<const ReplayConfig *>(user_data);
+    std::string mount;
+    SessionKind kind;
+    if (!ctx->uri || !ctx->uri->abspath || !session_kind_for_path(*config, ctx->uri->abspath, mount, kind)) {
+        return GST_RTSP_STS_OK;
+    }
+    GstRTSPConnection *connection = gst_rtsp_client_get_connection(client);
+    return admission.admit(client, mount, kind,
+                           connection ? gst_rtsp_connection_get_ip(connection) : "unknown client");
+}
+
+static void on_client_connected(GstRTSPServer *, GstRTSPClient *client, gpointer user_data) {
+    connected_clients++;
+    g_signal_connect(client, "new-session", G_CALLBACK(on_client_new_session), user_data);
+    g_signal_connect(client, "play-request", G_CALLBACK(on_client_play_request), user_data);
+    g_signal_connect(client, "pre-setup-request", G_CALLBACK(on_client_pre_setup), user_data);
+    g_signal_connect(client, "closed", G_CALLBACK(on_client_closed), NULL);
+}
+
+// Hand each RTP packet of a lower rung to the clients on the ladder
+static GstFlowReturn on_rung_sample(GstAppSink *appsink, gpointer user_data) {
+    guint rung = GPOINTER_TO_UINT(user_data);
+    GstSample *sample = gst_app_sink_pull_sample(appsink);
+    if (!sample) {
+        return GST_FLOW_EOS;
+    }
+    
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    if (buffer) {
+        std::lock_guard<std::mutex> guard(ladder_clients_lock);
+        for (ClientSendQueue *queue : ladder_clients) {
+            queue->offer_rung(rung, buffer);
+        }
+    }
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+// Parse --ladder: comma-separated <kbps>:<height> rungs below the top one
+static bool parse_ladder(const std::string &text, std::vector<LadderRung> &rungs) {
+    rungs.clear();
+    gchar **items = g_strsplit(text.c_str(), ",", -1);
+    bool ok = true;
+    for (gchar **item = items; *item && ok; item++) {
+        LadderRung rung;
+        char trailing;
+        ok = sscanf(*item, "%u:%u%c", &rung.bitrate_kbps, &rung.height, &trailing) == 2 &&
+             rung.bitrate_kbps > 0 && rung.height >= 16 && rung.height % 2 == 0;
+        rungs.push_back(rung);
+    }
+    g_strfreev(items);
+    return ok && !rungs.empty();
+}
+
+// RTSP Media Factory configuration
+static void media_configure_callback(GstRTSPMediaFactory *factory, 
+                                     GstRTSPMedia *media, 
+                                     gpointer user_data) {
+    const ReplayConfig *config = static_cast<const ReplayConfig *>(user_data);
+    g_print("Configuring RTSP media for new client\n");
+    
+    // Enable seeking and time-shifting
+    gst_rtsp_media_set_stop_on_disconnect(media, FALSE);
+    
+    if (config->ladder.empty()) {
+        return;
+    }
+    
+    // Same GOP on every rung, so their IDRs line up
+    GstElement *element = gst_rtsp_media_get_element(media);
+    for (guint i = 0; i <= config->ladder.size(); i++) {
+        gchar *name = g_strdup_printf("encoder-%u", i);
+        GstElement *encoder = gst_bin_get_by_name_recurse_up(GST_BIN(element), name);
+        g_free(name);
+        if (encoder) {
+            configure_encoder(encoder, replay_hw_type, ladder_kbps[i], MOUNT_KEYFRAME_INTERVAL);
+            gst_object_unref(encoder);
+        }
+        if (i == 0) {
+            continue;
+        }
+        
+        name = g_strdup_printf("rung-%u", i);
+        GstElement *sink = gst_bin_get_by_name_recurse_up(GST_BIN(element), name);
+        g_free(name);
+        if (sink) {
+            GstAppSinkCallbacks callbacks = {};
+            callbacks.new_sample = on_rung_sample;
+            gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks, GUINT_TO_POINTER(i), NULL);
+            gst_object_unref(sink);
+        }
+    }
+    gst_object_unref(element);
+}
+
+// Create RTSP server for output
+GstRTSPServer* create_rtsp_server(const ReplayConfig &config, HWAccelType hw_type) {
+    GstRTSPServer *server = gst_rtsp_server_new();
+    if (!server) {
+        g_printerr("Failed to create RTSP server\n");
+        return nullptr;
+    }
+    
+    // Set server port
+    gchar *port_str = g_strdup_printf("%d", config.output_rtsp_port);
+    g_object_set(server, "service", port_str, NULL);
+    g_free(port_str);
+    
+    // Get mount points
+    GstRTSPMountPoints *mounts = gst_rtsp_server_get_mount_points(server);
+    
+    // Create media factory
+    GstRTSPMediaFactory *factory = gst_rtsp_media_factory_new();
+    
+    // Build pipeline string for the factory
+    // For simplicity, we'll serve a test pattern; in production, this would read from ring buffer
+    // The spill file is a bare byte stream: frames played from it carry no
+    // capture time (no timestamp/x-ntp meta, ntp-64 extension or SEI) and
+    // no analytics metadata SEI
+    const char *decoder = get_decoder_element(hw_type);
+    const char *encoder = get_encoder_element(hw_type);
+    
+    std::string pipeline_str;
+    if (!config.ladder.empty()) {
+        // Decode once; the top rung is pay0, every lower rung is scaled,
+        // encoded and payloaded into an appsink the clients switch to.
+        // Shared timestamp offsets keep the rungs' RTP times identical.
+        ladder_kbps.assign(1, MOUNT_BITRATE_KBPS);
+        pipeline_str = "( filesrc location=" + replay_spill_path + " ! h264parse ! " + decoder +
+                       " ! tee name=ladder "
+                       "ladder. ! queue ! videoconvert ! " + encoder + " name=encoder-0 ! h264parse ! "
+                       "rtph264pay name=pay0 pt=96 config-interval=-1 timestamp-offset=0 ";
+        for (size_t i = 0; i < config.ladder.size(); i++) {
+            const LadderRung &rung = config.ladder[i];
+            ladder_kbps.push_back(rung.bitrate_kbps);
+            gchar *branch = g_strdup_printf(
+                "ladder. ! queue ! videoscale ! videoconvert ! video/x-raw,height=%u ! %s name=encoder-%zu ! "
+                "h264parse ! rtph264pay pt=96 config-interval=-1 timestamp-offset=0 ! "
+                "appsink name=rung-%zu max-buffers=256 drop=true ",
+                rung.height, encoder, i + 1, i + 1);
+            pipeline_str += branch;
+            g_free(branch);
+        }
+        pipeline_str += ")";
+    } else if (hw_type == HW_ACCEL_NVIDIA) {
+        pipeline_str = "( filesrc location=" + replay_spill_path + " ! "
+                      "h264parse ! nvh264dec ! nvh264enc bitrate=4000 ! "
+                      "h264parse ! rtph264pay name=pay0 pt=96 config-interval=1 )";
+    } else if (hw_type == HW_ACCEL_VAAPI) {
+        pipeline_str = "( filesrc location=" + replay_spill_path + " ! "
+                      "h264parse ! vaapih264dec ! vaapih264enc bitrate=4000 ! "
+                      "h264parse ! rtph264pay name=pay0 pt=96 config-interval=1 )";
+    } else {
+        pipeline_str = "( filesrc location=" + replay_spill_path + " ! "
+                      "h264parse ! avdec_h264 ! x264enc bitrate=4000 tune=zerolatency ! "
+                      "h264parse ! rtph264pay name=pay0 pt=96 config-interval=1 )";
+    }
+    
+    gst_rtsp_media_factory_set_launch(factory, pipeline_str.c_str());
+    
+    // Configure factory for sharing and seeking
+    gst_rtsp_media_factory_set_shared(factory, TRUE);
+    gst_rtsp_media_factory_set_enable_rtcp(factory, TRUE);
+    gst_rtsp_media_factory_set_protocols(factory, GST_RTSP_LOWER_TRANS_TCP);
+    
+    // Connect media configure signal
+    g_signal_connect(factory, "media-configure", 
+                    G_CALLBACK(media_configure_callback), (gpointer)&config);
+    
+    // Add factory to mount point
+    gst_rtsp_mount_points_add_factory(mounts, config.output_mount_point.c_str(), factory);
+    
+    // Every client's interleaved data goes through its own bounded queue
+    g_signal_connect(server, "client-connected", G_CALLBACK(on_client_connected), (gpointer)&config);
+    g_print("✓ RTSP server mounted at rtsp://localhost:%d%s\n", 
+           config.output_rtsp_port, config.output_mount_point.c_str());
+    if (!config.ladder.empty()) {
+        g_print("  with an adaptive ladder of %zu rungs\n", ladder_kbps.size());
+    }
+    
+    // Highlight reel of marked clips, played back-to-back in passthrough
+    add_feeder_mount(mounts, config, config.reel_mount_point, create_reel_feeder);
+    
+    // Pinned clip replayed continuously
+    add_feeder_mount(mounts, config, config.loop_mount_point, create_loop_feeder);
+    
+    // Marked range played backwards, re-encoded
+    add_feeder_mount(mounts, config, config.reverse_mount_point, create_reverse_feeder, true);
+    
+    // Jog/shuttle cursor, re-encoded
+    add_feeder_mount(mounts, config, config.scrub_mount_point, create_scrub_feeder, true);
+    
+    g_object_unref(mounts);
+    
+    return server;
+}
+
+// Server loops
+//
+// With --server-loops n (n > 1), n threads accept on the RTSP port. Each
+// runs its own GMainContext with its own listening socket on the port,
+// bound with SO_REUSEPORT, and the kernel spreads new connections across
+// them. GstRTSPServer attaches every client, however it arrived, to a
+// thread of its GstRTSPThreadPool, which defaults to a single thread; the
+// pool is sized to n as well, and hands clients to its threads in turn.
+// rtsp_thread_sessions_total shows how sessions spread over those threads.
+// Mounts, shared medias, rings and the control channel are the same for
+// every loop; egress already runs on the clients' writer threads.
+struct ServerLoop {
+    GMainContext *context;
+    GMainLoop *loop;
+    GSocket *listener;
+    GSource *accept_source;
+    std::thread thread;
+};
+
+static std::vector<ServerLoop *> server_loops;
+
+static gboolean on_loop_accept(GSocket *listener, GIOCondition, gpointer user_data) {
+    GstRTSPServer *server = GST_RTSP_SERVER(user_data);
+    GSocket *socket = g_socket_accept(listener, NULL, NULL);
+    if (!socket) {
+        return G_SOURCE_CONTINUE;
+    }
+    
+    gchar *ip = nullptr;
+    guint16 port = 0;
+    GSocketAddress *remote = g_socket_get_remote_address(socket, NULL);
+    if (remote) {
+        ip = g_inet_address_to_string(g_inet_socket_address_get_address(G_INET_SOCKET_ADDRESS(remote)));
+        port = g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(remote));
+        g_object_unref(remote);
+    }
+    if (!gst_rtsp_server_transfer_connection(server, socket, ip ? ip : "0.0.0.0", port, NULL)) {
+        g_printerr("Failed to hand over RTSP connection from %s\n", ip ? ip : "unknown peer");
+    }
+    g_free(ip);
+    return G_SOURCE_CONTINUE;
+}
+
+// A non-blocking listener on `port` that other loops may bind as well
+static GSocket* create_reuseport_listener(int port) {
+#ifdef SO_REUSEPORT
+    GError *error = nullptr;
+    GSocket *listener = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, &error);
+    if (listener && !g_socket_set_option(listener, SOL_SOCKET, SO_REUSEPORT, 1, &error)) {
+        g_clear_object(&listener);
+    }
+    if (listener) {
+        GInetAddress *any = g_inet_address_new_any(G_SOCKET_FAMILY_IPV4);
+        GSocketAddress *address = g_inet_socket_address_new(any, (guint16)port);
+        g_object_unref(any);
+        if (!g_socket_bind(listener, address, TRUE, &error) || !g_socket_listen(listener, &error)) {
+            g_clear_object(&listener);
+        }
+        g_object_unref(address);
+    }
+    if (!listener) {
+        g_printerr("Cannot listen on port %d with SO_REUSEPORT: %s\n", port, error ? error->message : "unknown error");
+        g_clear_error(&error);
+        return nullptr;
+    }
+    g_socket_set_blocking(listener, FALSE);
+    return listener;
+#else
+    g_printerr("SO_REUSEPORT is not available on this platform\n");
+    return nullptr;
+#endif
+}
+
+// Serve `server` from `count` loops, the first of them on `inherited`
+// listeners; false (and nothing running) if any listener cannot be created
+static bool start_server_loops(GstRTSPServer *server, const ReplayConfig &config, guint count,
+                               const std::vector<GSocket *> &inherited = std::vector<GSocket *>()) {
+    count = std::max(count, (guint)inherited.size());
+    for (guint i = 0; i < count; i++) {
+        GSocket *listener = i < inherited.size() ? inherited[i]
+                                                 : create_reuseport_listener(config.output_rtsp_port);
+        if (!listener) {
+            for (guint j = i + 1; j < inherited.size(); j++) {
+                g_object_unref(inherited[j]);
+            }
+            for (ServerLoop *loop : server_loops) {
+                g_source_unref(loop->accept_source);
+                g_object_unref(loop->listener);
+                g_main_loop_unref(loop->loop);
+                g_main_context_unref(loop->context);
+                delete loop;
+            }
+            server_loops.clear();
+            return false;
+        }
+        
+        ServerLoop *loop = new ServerLoop();
+        loop->context = g_main_context_new();
+        loop->loop = g_main_loop_new(loop->context, FALSE);
+        loop->listener = listener;
+        loop->accept_source = g_socket_create_source(listener, G_IO_IN, NULL);
+        g_source_set_callback(loop->accept_source, G_SOURCE_FUNC(on_loop_accept), server, NULL);
+        g_source_attach(loop->accept_source, loop->context);
+        server_loops.push_back(loop);
+    }
+    
+    GstRTSPThreadPool *thread_pool = gst_rtsp_server_get_thread_pool(server);
+    gst_rtsp_thread_pool_set_max_threads(thread_pool, (gint)count);
+    g_object_unref(thread_pool);
+    
+    for (ServerLoop *loop : server_loops) {
+        loop->thread = std::thread([loop] {
+            g_main_context_push_thread_default(loop->context);
+            g_main_loop_run(loop->loop);
+            g_main_context_pop_thread_default(loop->context);
+        });
+    }
+    if (inherited.empty()) {
+        g_print("✓ RTSP port %d served by %u loops (SO_REUSEPORT)\n", config.output_rtsp_port, count);
+    } else {
+        g_print("✓ RTSP port %d served by %u loops, %zu of them on inherited listeners\n",
+                config.output_rtsp_port, count, inherited.size());
+    }
+    return true;
+}
+
+// Leave the listeners open (a successor holds them too) but stop taking
+// connections from them; clients already connected are still served
+static void stop_accepting() {
+    for (ServerLoop *loop : server_loops) {
+        if (loop->accept_source) {
+            g_source_destroy(loop->accept_source);
+            g_source_unref(loop->accept_source);
+            loop->accept_source = nullptr;
+        }
+    }
+}
+
+static void stop_server_loops() {
+    stop_accepting();
+    for (ServerLoop *loop : server_loops) {
+        g_main_loop_quit(loop->loop);
+        loop->thread.join();
+        g_socket_close(loop->listener, NULL);
+        g_object_unref(loop->listener);
+        g_main_loop_unref(loop->loop);
+        g_main_context_unref(loop->context);
+        delete loop;
+    }
+    server_loops.clear();
+}
+
+// Upgrade handoff
+//
+// With --handoff-socket <path> the rings live in memfds and the process
+// listens on a Unix socket at <path>. A new binary started with
+// --take-over <path> connects there and receives, over SCM_RIGHTS, the
+// RTSP listening sockets and every ring, announced by a manifest:
+//   listener
+//   ring video <camera>
+//   ring metadata <camera>
+//   end
+// It maps the rings, serves the same listeners and starts its own ingest;
+// each camera's ring changes writer at the first keyframe newer than what
+// the old process stored (see take_over_rings). Once it answers "ready",
+// the old process stops accepting, gives up <path> and drains: its clients
+// keep playing from the shared rings until they leave, and it exits when
+// none remain and every ring has changed hands (or after
+// HANDOFF_DRAIN_LIMIT_US). If the new process goes away before it is
+// ready, the old one takes its rings back and carries on.
+static const size_t HANDOFF_MAX_FDS = 250;
+static const gint64 HANDOFF_DRAIN_LIMIT_US = 600 * G_USEC_PER_SEC;
+static const int HANDOFF_RELEASE_TIMEOUT_MS = 10000;
+static const guint HANDOFF_DRAIN_PERIOD_MS = 1000;
+
+struct HandoffState {
+    std::string path;
+    int listen_fd;          // where successors connect
+    guint listen_watch;
+    int successor_fd;       // the successor during a handoff
+    int predecessor_fd;     // with --take-over, until the predecessor lets go
+    gint64 drain_started_us;
+};
+
+static HandoffState handoff = { std::string(), -1, 0, -1, -1, 0 };
+
+#ifdef __linux__
+static bool handoff_address(const std::string &path, struct sockaddr_un &address) {
+    memset(&address, 0, sizeof(address));
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        g_printerr("Invalid handoff socket path: %s\n", path.c_str());
+        return false;
+    }
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+static bool send_with_fds(int socket_fd, const std::string &text, const std::vector<int> &fds) {
+    struct iovec iov;
+    iov.iov_base = const_cast<char *>(text.data());
+    iov.iov_len = text.size();
+    struct msghdr message = {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+    if (!fds.empty()) {
+        message.msg_control = control.data();
+        message.msg_controllen = control.size();
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+    }
+    return sendmsg(socket_fd, &message, MSG_NOSIGNAL) == (ssize_t)text.size();
+}
+
+// Read the manifest up to its "end" line, collecting the descriptors that
+// came with it
+static bool receive_with_fds(int socket_fd, std::string &text, std::vector<int> &fds) {
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS));
+    while (text.find("end\n") == std::string::npos) {
+        char buffer[4096];
+        struct iovec iov;
+        iov.iov_base = buffer;
+        iov.iov_len = sizeof(buffer);
+        struct msghdr message = {};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control.data();
+        message.msg_controllen = control.size();
+        ssize_t received = recvmsg(socket_fd, &message, MSG_CMSG_CLOEXEC);
+        if (received <= 0) {
+            return false;
+        }
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                size_t first = fds.size();
+                fds.resize(first + count);
+                memcpy(&fds[first], CMSG_DATA(cmsg), count * sizeof(int));
+            }
+        }
+        if (message.msg_flags & MSG_CTRUNC) {
+            return false;
+        }
+        text.append(buffer, (size_t)received);
+    }
+    return true;
+}
+
+static void stop_handoff_listener() {
+    if (handoff.listen_watch) {
+        g_source_remove(handoff.listen_watch);
+        handoff.listen_watch = 0;
+    }
+    if (handoff.listen_fd >= 0) {
+        close(handoff.listen_fd);
+        handoff.listen_fd = -1;
+        unlink(handoff.path.c_str());
+    }
+}
+
+// The successor writes its own spill files, so nothing reads these after us
+static void remove_spill_files() {
+    for (const auto &camera : list_cameras()) {
+        unlink(camera->spill_path.c_str());
+    }
+}
+
+static gboolean handoff_drain_tick(gpointer) {
+    bool rings_released = true;
+    for (const auto &camera : list_cameras()) {
+        if (camera->ring->owns_writer()) {
+            rings_released = false;
+        }
+    }
+    if (rings_released && !ingest_released) {
+        // Nothing ingested here is stored any more; the successor's ingest
+        // keeps the shared rings, and so these clients, live
+        ingest_released = true;
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        g_print("All rings handed over; closed the camera connections\n");
+    }
+    
+    int clients = connected_clients.load();
+    if (rings_released && clients == 0) {
+        g_print("Drained; exiting\n");
+        remove_spill_files();
+        g_main_loop_quit(main_loop);
+        return G_SOURCE_REMOVE;
+    }
+    if (g_get_monotonic_time() - handoff.drain_started_us > HANDOFF_DRAIN_LIMIT_US) {
+        g_print("Drain limit reached with %d clients connected; exiting\n", clients);
+        remove_spill_files();
+        g_main_loop_quit(main_loop);
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+// The successor answered (or went away): drain, or take the rings back
+static gboolean on_handoff_ready(gint fd, GIOCondition, gpointer) {
+    char buffer[16];
+    ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+    handoff.successor_fd = -1;
+    if (received < 6 || memcmp(buffer, "ready\n", 6) != 0) {
+        close(fd);
+        for (const auto &camera : list_cameras()) {
+            camera->ring->reclaim_writer();
+            camera->metadata_ring->reclaim_writer();
+        }
+        g_printerr("The successor went away before it was ready; still serving\n");
+        metrics.add("handoff_aborted_total", "");
+        return G_SOURCE_REMOVE;
+    }
+    
+    // Give up the path before the successor, woken by the close, binds it
+    stop_accepting();
+    stop_handoff_listener();
+    close(fd);
+    handoff.drain_started_us = g_get_monotonic_time();
+    g_print("Successor is serving; draining %d clients\n", connected_clients.load());
+    g_timeout_add(HANDOFF_DRAIN_PERIOD_MS, handoff_drain_tick, NULL);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean on_handoff_connection(gint fd, GIOCondition, gpointer) {
+    int peer = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+    if (peer < 0) {
+        return G_SOURCE_CONTINUE;
+    }
+    if (handoff.successor_fd >= 0) {
+        g_printerr("Refusing a second successor while a handoff is in progress\n");
+        close(peer);
+        return G_SOURCE_CONTINUE;
+    }
+    
+    std::string manifest;
+    std::vector<int> fds;
+    for (ServerLoop *loop : server_loops) {
+        manifest += "listener\n";
+        fds.push_back(g_socket_get_fd(loop->listener));
+    }
+    for (const auto &camera : list_cameras()) {
+        if (camera->ring->shared_fd() >= 0) {
+            manifest += "ring video " + camera->id + "\n";
+            fds.push_back(camera->ring->shared_fd());
+        }
+        if (camera->metadata_ring->shared_fd() >= 0) {
+            manifest += "ring metadata " + camera->id + "\n";
+            fds.push_back(camera->metadata_ring->shared_fd());
+        }
+    }
+    manifest += "end\n";
+    if (fds.size() > HANDOFF_MAX_FDS || !send_with_fds(peer, manifest, fds)) {
+        g_printerr("Cannot hand over to the successor: %s\n",
+                   fds.size() > HANDOFF_MAX_FDS ? "too many descriptors" : g_strerror(errno));
+        close(peer);
+        return G_SOURCE_CONTINUE;
+    }
+    g_print("Handed %zu descriptors to a successor; waiting for it to serve\n", fds.size());
+    handoff.successor_fd = peer;
+    g_unix_fd_add(peer, (GIOCondition)(G_IO_IN | G_IO_HUP | G_IO_ERR), on_handoff_ready, NULL);
+    return G_SOURCE_CONTINUE;
+}
+
+// Offer this process's listeners and rings to the next upgrade at `path`
+static bool start_handoff_listener(const std::string &path) {
+    struct sockaddr_un address;
+    if (!handoff_address(path, address)) {
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        g_printerr("Cannot create handoff socket: %s\n", g_strerror(errno));
+        return false;
+    }
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+        g_printerr("Another process is serving %s; start this one with --take-over\n", path.c_str());
+        close(fd);
+        return false;
+    }
+    unlink(path.c_str()); // left behind by a process that is gone
+    close(fd);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, 1) != 0) {
+        g_printerr("Cannot listen on handoff socket %s: %s\n", path.c_str(), g_strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    handoff.path = path;
+    handoff.listen_fd = fd;
+    handoff.listen_watch = g_unix_fd_add(fd, G_IO_IN, on_handoff_connection, NULL);
+    g_print("✓ Upgrade handoff offered on %s\n", path.c_str());
+    return true;
+}
+
+// Successor side: receive the running process's listeners and rings into
+// `inherited`, before any camera or server is created
+static bool receive_handoff(const std::string &path) {
+    struct sockaddr_un address;
+    if (!handoff_address(path, address)) {
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        g_printerr("Nothing to take over at %s: %s\n", path.c_str(), g_strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    
+    std::string manifest;
+    std::vector<int> fds;
+    bool valid = receive_with_fds(fd, manifest, fds);
+    size_t next = 0;
+    gchar **lines = g_strsplit(manifest.c_str(), "\n", -1);
+    for (gchar **line = lines; valid && *line && strcmp(*line, "end") != 0; line++) {
+        if (next >= fds.size()) {
+            valid = false;
+            break;
+        }
+        int received = fds[next++];
+        if (strcmp(*line, "listener") == 0) {
+            GSocket *listener = g_socket_new_from_fd(received, NULL);
+            if (listener) {
+                g_socket_set_blocking(listener, FALSE);
+                inherited.listeners.push_back(listener);
+            } else {
+                close(received);
+                valid = false;
+            }
+        } else if (g_str_has_prefix(*line, "ring video ")) {
+            inherited.video_rings[*line + strlen("ring video ")] = received;
+        } else if (g_str_has_prefix(*line, "ring metadata ")) {
+            inherited.metadata_rings[*line + strlen("ring metadata ")] = received;
+        } else {
+            close(received);
+        }
+    }
+    g_strfreev(lines);
+    for (; next < fds.size(); next++) {
+        close(fds[next]);
+    }
+    if (!valid || inherited.listeners.empty()) {
+        g_printerr("Malformed handoff from %s\n", path.c_str());
+        close(fd);
+        return false;
+    }
+    
+    handoff.predecessor_fd = fd;
+    g_print("✓ Took over %zu listeners and %zu rings from the running process\n", inherited.listeners.size(),
+            inherited.video_rings.size() + inherited.metadata_rings.size());
+    return true;
+}
+
+// Tell the predecessor this process is serving, wait for it to let go of
+// `path`, then offer the same handoff to the next upgrade
+static bool complete_takeover(const std::string &path) {
+    if (send(handoff.predecessor_fd, "ready\n", 6, MSG_NOSIGNAL) != 6) {
+        g_printerr("Lost the predecessor before taking over: %s\n", g_strerror(errno));
+    } else {
+        struct pollfd released = { handoff.predecessor_fd, POLLIN, 0 };
+        if (poll(&released, 1, HANDOFF_RELEASE_TIMEOUT_MS) <= 0) {
+            g_printerr("The predecessor did not release %s in time\n", path.c_str());
+        }
+    }
+    close(handoff.predecessor_fd);
+    handoff.predecessor_fd = -1;
+    return start_handoff_listener(path);
+}
+#else
+static void stop_handoff_listener() {}
+
+static bool start_handoff_listener(const std::string &path) {
+    g_printerr("Upgrade handoff needs Linux\n");
+    return false;
+}
+
+static bool receive_handoff(const std::string &path) {
+    return start_handoff_listener(path);
+}
+
+static bool complete_takeover(const std::string &path) {
+    return start_handoff_listener(path);
+}
+#endif
+
+// Operator control channel
+//
+// Line-based commands read from stdin on a helper thread and executed on
+// the main loop. Times are seconds relative to the live edge ("-12.5"),
+// "now", an absolute timeline position in Unix seconds ("@1718000000.25"),
+// or a camera's SMPTE timecode ("10:04:31:12").
+static const ReplayConfig *control_config = nullptr;
+
+static std::vector<std::string> split_words(const std::string &line) {
+    std::vector<std::string> words;
+    gchar **tokens = g_strsplit(line.c_str(), " ", -1);
+    for (gchar **token = tokens; *token; token++) {
+        if (**token != '\0') {
+            words.push_back(*token);
+        }
+    }
+    g_strfreev(tokens);
+    return words;
+}
+
+// What follows the first `count` words of `line`, as typed
+static std::string after_words(const std::string &line, size_t count) {
+    size_t position = line.find_first_not_of(' ');
+    for (size_t i = 0; i < count && position != std::string::npos; i++) {
+        position = line.find_first_not_of(' ', line.find(' ', position));
+    }
+    return position == std::string::npos ? std::string() : line.substr(position);
+}
+
+// Timeline position of a timecode on `camera_id`'s ring, or on the first
+// camera that has it buffered when no camera is given
+static bool resolve_timecode(guint32 timecode, const std::string &camera_id, gint64 &time_us) {
+    for (const auto &camera : list_cameras()) {
+        if ((camera_id.empty() || camera->id == camera_id) && camera->ring->find_timecode(timecode, time_us)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_time_argument(const std::string &arg, gint64 now_us, gint64 &time_us,
+                                const std::string &camera_id = std::string()) {
+    if (arg == "now") {
+        time_us = now_us;
+        return true;
+    }
+    guint32 timecode;
+    if (parse_timecode(arg, timecode)) {
+        if (!resolve_timecode(timecode, camera_id, time_us)) {
+            g_printerr("Timecode %s is not buffered\n", arg.c_str());
+            return false;
+        }
+        return true;
+    }
+    bool absolute = !arg.empty() && arg[0] == '@';
+    const gchar *text = arg.c_str() + (absolute ? 1 : 0);
+    gchar *end = nullptr;
+    gdouble seconds = g_ascii_strtod(text, &end);
+    if (end == text || *end != '\0') {
+        return false;
+    }
+    if (absolute) {
+        time_us = (gint64)(seconds * G_USEC_PER_SEC);
+    } else if (seconds <= 0) {
+        time_us = now_us + (gint64)(seconds * G_USEC_PER_SEC);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void print_control_help() {
+    g_print("Commands:\n");
+    g_print("  export <camera> <start> <end> [mp4|mkv|ts|h264] [path] [ramp options]\n");
+    g_print("                              Queue a clip export\n");
+    g_print("  export-all <start> <end> [mp4|ts|h264] [combined] [path] [ramp options]\n");
+    g_print("                              Same range from every camera, frame-aligned;\n");
+    g_print("                              separate files in <path> or one multi-track file\n");
+    g_print("  jobs                        List export jobs\n");
+    g_print("  reel-add <camera> <start> <end> [ramp options]\n");
+    g_print("                              Append a clip to the highlight reel\n");
+    g_print("  reel-list | reel-clear      Show or empty the highlight reel\n");
+    g_print("  loop-set <camera> <start> <end> [ramp options]\n");
+    g_print("                              Pin a clip and replay it on the loop mount\n");
+    g_print("  loop-status | loop-clear    Show or release the pinned loop\n");
+    g_print("  reverse-set <camera> <start> <end>\n");
+    g_print("                              Play a range backwards on the reverse mount\n");
+    g_print("  reverse-clear               Stop offering the reverse range\n");
+    g_print("  scrub <camera> <time>       Put the scrub cursor on a camera and time\n");
+    g_print("  jog <seconds>               Move the scrub cursor (negative: backwards)\n");
+    g_print("  shuttle <rate>              Move the scrub cursor continuously (0: stop)\n");
+    g_print("  branch-attach <camera> <name> <pipeline>\n");
+    g_print("                              Feed a launch description (e.g. 'mpegtsmux !\n");
+    g_print("                              filesink location=a.ts') from the camera's ingest\n");
+    g_print("  branch-detach <camera> <name> | branch-list\n");
+    g_print("                              Finish and remove an attached branch, or list them\n");
+    g_print("  cameras                     List cameras and buffered frames\n");
+    g_print("  metrics                     Print counters and gauges (Prometheus text)\n");
+    g_print("  help                        Show this help\n");
+    g_print("Times: -<sec> before live, 'now', @<unix-seconds>, or timecode HH:MM:SS:FF\n");
+    g_print("Ramp options: ramp=<sec>:<rate>,... (e.g. ramp=0:1,2:0.25,5:0.25,6:1)\n");
+    g_print("              render=retime|repeat|blend|interpolate\n");
+}
+
+// Move "ramp=" and "render=" options out of `args` into `job`
+static bool take_ramp_options(std::vector<std::string> &args, ExportJob &job, bool &render_given) {
+    render_given = false;
+    for (auto it = args.begin(); it != args.end();) {
+        if (g_str_has_prefix(it->c_str(), "ramp=")) {
+            job.speed_curve = SpeedCurve::parse(it->substr(5));
+            if (!job.speed_curve) {
+                g_printerr("Invalid speed curve '%s'\n", it->c_str() + 5);
+                return false;
+            }
+        } else if (g_str_has_prefix(it->c_str(), "render=")) {
+            if (!parse_ramp_render(it->substr(7), job.ramp_render)) {
+                g_printerr("Unknown render mode '%s'\n", it->c_str() + 7);
+                return false;
+            }
+            render_given = true;
+        } else {
+            ++it;
+            continue;
+        }
+        it = args.erase(it);
+    }
+    return true;
+}
+
+// Exports retime by default, except raw H.264, which has no timestamps to
+// carry the ramp and gets blended frames instead
+static SpeedRampRender default_export_render(ExportFormat format) {
+    return format == EXPORT_FORMAT_H264 ? RAMP_BLEND : RAMP_RETIME;
+}
+
+// Default output location: <directory>/<label>-<start ms>.<ext>
+static std::string default_export_path(const std::string &directory, const std::string &label,
+                                       gint64 start_us, ExportFormat format) {
+    g_mkdir_with_parents(directory.c_str(), 0755);
+    gchar *file_name = g_strdup_printf("%s-%" G_GINT64_FORMAT ".%s", label.c_str(),
+                                       start_us / 1000, export_format_extension(format));
+    gchar *path = g_build_filename(directory.c_str(), file_name, NULL);
+    std::string result = path;
+    g_free(path);
+    g_free(file_name);
+    return result;
+}
+
+static void handle_export_command(std::vector<std::string> args) {
+    ExportJob job;
+    bool render_given;
+    if (!take_ramp_options(args, job, render_given)) {
+        return;
+    }
+    if (args.size() < 4) {
+        g_printerr("Usage: export <camera> <start> <end> [mp4|mkv|ts|h264] [path]\n");
+        return;
+    }
+    
+    job.camera_ids.push_back(args[1]);
+    gint64 now_us = timeline_now_us();
+    if (!parse_time_argument(args[2], now_us, job.start_us, args[1]) ||
+        !parse_time_argument(args[3], now_us, job.end_us, args[1])) {
+        g_printerr("Invalid time range '%s' .. '%s'\n", args[2].c_str(), args[3].c_str());
+        return;
+    }
+    if (args.size() > 4 && !parse_export_format(args[4], job.format)) {
+        g_printerr("Unknown export format '%s'\n", args[4].c_str());
+        return;
+    }
+    if (!find_camera(args[1])) {
+        g_printerr("Unknown camera '%s'\n", args[1].c_str());
+        return;
+    }
+    if (!render_given) {
+        job.ramp_render = default_export_render(job.format);
+    }
+    
+    job.output_path = args.size() > 5 ? args[5] :
+        default_export_path(control_config->export_directory, args[1], job.start_us, job.format);
+    if (export_queue->submit(job) == 0) {
+        g_printerr("Export queue is shut down\n");
+    }
+}
+
+// Same wall-clock range from every camera. The first camera is the
+// reference: its frames nearest <start>/<end> fix the common boundary and
+// every other camera cuts on its own frame nearest that instant.
+static void handle_export_all_command(std::vector<std::string> args) {
+    ExportJob job;
+    bool render_given;
+    if (!take_ramp_options(args, job, render_given)) {
+        return;
+    }
+    if (args.size() < 3) {
+        g_printerr("Usage: export-all <start> <end> [mp4|ts|h264] [combined] [path]\n");
+        return;
+    }
+    
+    job.frame_accurate = true;
+    gint64 now_us = timeline_now_us();
+    if (!parse_time_argument(args[1], now_us, job.start_us) ||
+        !parse_time_argument(args[2], now_us, job.end_us)) {
+        g_printerr("Invalid time range '%s' .. '%s'\n", args[1].c_str(), args[2].c_str());
+        return;
+    }
+    
+    size_t next = 3;
+    if (next < args.size() && parse_export_format(args[next], job.format)) {
+        next++;
+    }
+    bool combined = next < args.size() && args[next] == "combined";
+    if (combined) {
+        next++;
+    }
+    std::string path = next < args.size() ? args[next] : "";
+    if (!render_given) {
+        job.ramp_render = default_export_render(job.format);
+    }
+    
+    if (!export_format_allows_inband_parameters(job.format)) {
+        g_printerr("Frame-accurate multi-angle export needs mp4, ts or h264\n");
+        return;
+    }
+    if (combined && !export_format_muxer(job.format)) {
+        g_printerr("A combined multi-track export needs mp4 or ts\n");
+        return;
+    }
+    
+    std::vector<std::shared_ptr<Camera>> all = list_cameras();
+    if (all.empty()) {
+        return;
+    }
+    TrackWindow reference;
+    if (!resolve_track_window(*all[0], job.start_us, job.end_us, true, reference)) {
+        g_printerr("Range is not buffered on reference camera %s\n", all[0]->id.c_str());
+        return;
+    }
+    job.start_us = ((gint64)reference.cut_pts + reference.timeline_offset) / (gint64)GST_USECOND;
+    job.end_us = ((gint64)reference.end_pts + reference.timeline_offset) / (gint64)GST_USECOND;
+    
+    if (combined) {
+        for (const auto &camera : all) {
+            job.camera_ids.push_back(camera->id);
+        }
+        job.output_path = !path.empty() ? path :
+            default_export_path(control_config->export_directory, "multi", job.start_us, job.format);
+        if (export_queue->submit(job) == 0) {
+            g_printerr("Export queue is shut down\n");
+        }
+        return;
+    }
+    
+    // Separate files: one job per camera, run concurrently by the workers
+    size_t queued = 0;
+    for (const auto &camera : all) {
+        ExportJob camera_job = job;
+        camera_job.camera_ids.assign(1, camera->id);
+        camera_job.output_path = default_export_path(path.empty() ? control_config->export_directory : path,
+                                                     camera->id, job.start_us, job.format);
+        if (export_queue->submit(camera_job) == 0) {
+            break;
+        }
+        queued++;
+    }
+    if (queued < all.size()) {
+        g_printerr("Export queue is shut down; %zu of %zu cameras queued\n", queued, all.size());
+    }
+}
+
+static void handle_reel_command(std::vector<std::string> args) {
+    ExportJob ramp;
+    bool render_given;
+    if (!take_ramp_options(args, ramp, render_given)) {
+        return;
+    }
+    const std::string &command = args[0];
+    std::lock_guard<std::mutex> guard(reel_lock);
+    if (command == "reel-clear") {
+        reel_playlist.clear();
+        g_print("Highlight reel cleared\n");
+    } else if (command == "reel-list") {
+        for (size_t i = 0; i < reel_playlist.size(); i++) {
+            const ReelClip &clip = reel_playlist[i];
+            g_print("%zu: %s %.3f s from @%.3f%s\n", i + 1, clip.camera_id.c_str(),
+                   (clip.end_us - clip.start_us) / (gdouble)G_USEC_PER_SEC,
+                   clip.start_us / (gdouble)G_USEC_PER_SEC, clip.speed_curve ? " (ramped)" : "");
+        }
+    } else if (command == "reel-add" && args.size() >= 4) {
+        ReelClip clip;
+        clip.camera_id = args[1];
+        clip.speed_curve = ramp.speed_curve;
+        clip.ramp_render = render_given ? ramp.ramp_render : control_config->ramp_render;
+        gint64 now_us = timeline_now_us();
+        if (!find_camera(clip.camera_id)) {
+            g_printerr("Unknown camera '%s'\n", clip.camera_id.c_str());
+        } else if (!parse_time_argument(args[2], now_us, clip.start_us, clip.camera_id) ||
+                   !parse_time_argument(args[3], now_us, clip.end_us, clip.camera_id) ||
+                   clip.end_us <= clip.start_us) {
+            g_printerr("Invalid time range '%s' .. '%s'\n", args[2].c_str(), args[3].c_str());
+        } else {
+            reel_playlist.push_back(clip);
+            g_print("Highlight reel: %zu clip%s\n", reel_playlist.size(),
+                   reel_playlist.size() == 1 ? "" : "s");
+        }
+    } else {
+        g_printerr("Usage: reel-add <camera> <start> <end> | reel-list | reel-clear\n");
+    }
+}
+
+static void handle_loop_command(std::vector<std::string> args) {
+    ExportJob job;
+    bool render_given;
+    if (!take_ramp_options(args, job, render_given)) {
+        return;
+    }
+    const std::string &command = args[0];
+    if (command == "loop-clear") {
+        clear_loop();
+        g_print("Loop released\n");
+    } else if (command == "loop-status") {
+        std::shared_ptr<const PinnedLoop> loop = current_loop();
+        if (loop) {
+            g_print("Loop: %s %.3f s from @%.3f, %zu frames, %" G_GSIZE_FORMAT " KB pinned\n",
+                   loop->camera_id.c_str(), loop->duration / (gdouble)GST_SECOND,
+                   loop->start_us / (gdouble)G_USEC_PER_SEC, loop->frames.size(), loop->bytes / 1024);
+        } else {
+            g_print("Loop: none\n");
+        }
+    } else if (command == "loop-set" && args.size() >= 4) {
+        gint64 now_us = timeline_now_us();
+        job.frame_accurate = true;
+        if (!render_given) {
+            job.ramp_render = control_config->ramp_render;
+        }
+        if (!find_camera(args[1])) {
+            g_printerr("Unknown camera '%s'\n", args[1].c_str());
+        } else if (!parse_time_argument(args[2], now_us, job.start_us, args[1]) ||
+                   !parse_time_argument(args[3], now_us, job.end_us, args[1]) ||
+                   job.end_us <= job.start_us) {
+            g_printerr("Invalid time range '%s' .. '%s'\n", args[2].c_str(), args[3].c_str());
+        } else {
+            start_pin_loop(args[1], job);
+        }
+    } else {
+        g_printerr("Usage: loop-set <camera> <start> <end> | loop-status | loop-clear\n");
+    }
+}
+
+static void handle_reverse_command(const std::vector<std::string> &args) {
+    const std::string &command = args[0];
+    if (command == "reverse-clear") {
+        std::lock_guard<std::mutex> guard(reverse_lock);
+        reverse_range.reset();
+        g_print("Reverse range cleared\n");
+    } else if (command == "reverse-set" && args.size() >= 4) {
+        std::unique_ptr<ReverseRange> range(new ReverseRange());
+        range->camera_id = args[1];
+        gint64 now_us = timeline_now_us();
+        if (!find_camera(range->camera_id)) {
+            g_printerr("Unknown camera '%s'\n", range->camera_id.c_str());
+        } else if (!parse_time_argument(args[2], now_us, range->start_us, range->camera_id) ||
+                   !parse_time_argument(args[3], now_us, range->end_us, range->camera_id) ||
+                   range->end_us <= range->start_us) {
+            g_printerr("Invalid time range '%s' .. '%s'\n", args[2].c_str(), args[3].c_str());
+        } else {
+            std::lock_guard<std::mutex> guard(reverse_lock);
+            reverse_range = std::move(range);
+            g_print("Reverse: %s %.3f s on %s\n", reverse_range->camera_id.c_str(),
+                   (reverse_range->end_us - reverse_range->start_us) / (gdouble)G_USEC_PER_SEC,
+                   control_config->reverse_mount_point.c_str());
+        }
+    } else {
+        g_printerr("Usage: reverse-set <camera> <start> <end> | reverse-clear\n");
+    }
+}
+
+static void handle_scrub_command(const std::vector<std::string> &args) {
+    const std::string &command = args[0];
+    gdouble value = 0.0;
+    bool numeric = false;
+    if (args.size() >= 2) {
+        gchar *end = nullptr;
+        value = g_ascii_strtod(args[1].c_str(), &end);
+        numeric = end != args[1].c_str() && *end == '\0' && std::isfinite(value);
+    }
+    bool moved;
+    if (command == "scrub" && args.size() >= 3) {
+        gint64 target_us;
+        if (!find_camera(args[1])) {
+            g_printerr("Unknown camera '%s'\n", args[1].c_str());
+            return;
+        }
+        if (!parse_time_argument(args[2], timeline_now_us(), target_us, args[1])) {
+            g_printerr("Invalid time '%s'\n", args[2].c_str());
+            return;
+        }
+        scrub_cursor.jump(args[1], target_us);
+        moved = true;
+    } else if (command == "jog" && numeric) {
+        moved = scrub_cursor.step(value);
+    } else if (command == "shuttle" && numeric) {
+        moved = scrub_cursor.shuttle(value);
+    } else {
+        g_printerr("Usage: scrub <camera> <time> | jog <seconds> | shuttle <rate>\n");
+        return;
     }
-    
-    // Configure rtspsrc
-    g_object_set(G_OBJECT(rtspsrc),
-                 "location", config.input_rtsp_url.c_str(),
-                 "latency", 2000,
-                 "protocols", 0x00000004, // TCP
-                 "buffer-mode", 1, // Slave (synchronize with source)
-                 NULL);
-    
-    // Configure queue2 as ring buffer
-    guint64 max_size_time = (guint64)config.buffer_seconds * GST_SECOND;
-    guint64 ring_buffer_max_size = 1000000000; // 1GB max
-    
-    g_object_set(G_OBJECT(queue_buffer),
-                 "max-size-time", max_size_time,
-                 "ring-buffer-max-size", ring_buffer_max_size,
-                 "use-buffering", TRUE,
-                 "temp-template", NULL, // Memory-based ring buffer
-                 NULL);
-    
-    // For testing: save to file (in production, connect to RTSP server)
-    g_object_set(G_OBJECT(filesink),
-                 "location", "/tmp/replay-buffer.h264",
-                 NULL);
-    
-    // Add elements to pipeline
-    gst_bin_add_many(GST_BIN(pipeline_elem), 
-                     rtspsrc, depay, parse, queue_buffer, filesink, NULL);
-    
-    // Link static elements (rtspsrc has dynamic pads)
-    if (!gst_element_link_many(depay, parse, queue_buffer, filesink, NULL)) {
-        g_printerr("Failed to link pipeline elements\n");
-        gst_object_unref(pipeline_elem);
-        return nullptr;
+    if (!moved) {
+        g_printerr("Place the cursor with 'scrub <camera> <time>' first\n");
+        return;
     }
     
-    // Connect pad-added signal for dynamic linking
-    g_signal_connect(rtspsrc, "pad-added", G_CALLBACK(on_pad_added), depay);
-    
-    g_print("✓ Input pipeline created successfully\n");
-    return pipeline_elem;
+    // Start prefetching now rather than on the next output frame
+    std::shared_ptr<Camera> camera;
+    guint64 seq;
+    RingFrame frame;
+    scrub_cursor.locate(camera, seq, frame);
 }
 
-// RTSP Media Factory configuration
-static void media_configure_callback(GstRTSPMediaFactory *factory, 
-                                     GstRTSPMedia *media, 
-                                     gpointer user_data) {
-    g_print("Configuring RTSP media for new client\n");
-    
-    // Enable seeking and time-shifting
-    gst_rtsp_media_set_stop_on_disconnect(media, FALSE);
+static void handle_branch_command(const std::vector<std::string> &args, const std::string &line) {
+    const std::string &command = args[0];
+    if (command == "branch-list") {
+        for (const auto &entry : output_branches) {
+            const OutputBranch &branch = *entry.second;
+            g_print("%s: %s%s\n", entry.first.c_str(), branch.description.c_str(),
+                   branch.detach_started_us ? " (detaching)" : "");
+        }
+    } else if (command == "branch-attach" && args.size() >= 4) {
+        // The pipeline as typed: quoted properties may hold repeated spaces
+        attach_output_branch(args[1], args[2], after_words(line, 3));
+    } else if (command == "branch-detach" && args.size() >= 3) {
+        detach_output_branch(args[1], args[2]);
+    } else {
+        g_printerr("Usage: branch-attach <camera> <name> <pipeline> | branch-detach <camera> <name> | branch-list\n");
+    }
 }
 
-// Create RTSP server for output
-GstRTSPServer* create_rtsp_server(const ReplayConfig &config, HWAccelType hw_type) {
-    GstRTSPServer *server = gst_rtsp_server_new();
-    if (!server) {
-        g_printerr("Failed to create RTSP server\n");
-        return nullptr;
+static void handle_control_command(const std::string &line) {
+    std::vector<std::string> args = split_words(line);
+    if (args.empty()) {
+        return;
     }
     
-    // Set server port
-    gchar *port_str = g_strdup_printf("%d", config.output_rtsp_port);
-    g_object_set(server, "service", port_str, NULL);
-    g_free(port_str);
-    
-    // Get mount points
-    GstRTSPMountPoints *mounts = gst_rtsp_server_get_mount_points(server);
-    
-    // Create media factory
-    GstRTSPMediaFactory *factory = gst_rtsp_media_factory_new();
-    
-    // Build pipeline string for the factory
-    // For simplicity, we'll serve a test pattern; in production, this would read from ring buffer
-    const char *decoder = get_decoder_element(hw_type);
-    const char *encoder = get_encoder_element(hw_type);
-    
-    std::string pipeline_str;
-    if (hw_type == HW_ACCEL_NVIDIA) {
-        pipeline_str = "( filesrc location=/tmp/replay-buffer.h264 ! "
-                      "h264parse ! nvh264dec ! nvh264enc bitrate=4000 ! "
-                      "h264parse ! rtph264pay name=pay0 pt=96 config-interval=1 )";
-    } else if (hw_type == HW_ACCEL_VAAPI) {
-        pipeline_str = "( filesrc location=/tmp/replay-buffer.h264 ! "
-                      "h264parse ! vaapih264dec ! vaapih264enc bitrate=4000 ! "
-                      "h264parse ! rtph264pay name=pay0 pt=96 config-interval=1 )";
+    const std::string &command = args[0];
+    if (command == "export") {
+        handle_export_command(args);
+    } else if (command == "export-all") {
+        handle_export_all_command(args);
+    } else if (g_str_has_prefix(command.c_str(), "reel-")) {
+        handle_reel_command(args);
+    } else if (g_str_has_prefix(command.c_str(), "loop-")) {
+        handle_loop_command(args);
+    } else if (g_str_has_prefix(command.c_str(), "reverse-")) {
+        handle_reverse_command(args);
+    } else if (command == "scrub" || command == "jog" || command == "shuttle") {
+        handle_scrub_command(args);
+    } else if (g_str_has_prefix(command.c_str(), "branch-")) {
+        handle_branch_command(args, line);
+    } else if (command == "jobs") {
+        for (const ExportProgress &progress : export_queue->snapshot()) {
+            print_export_progress(progress);
+        }
+    } else if (command == "cameras") {
+        for (const auto &camera : list_cameras()) {
+            const FrameRing &ring = *camera->ring;
+            RingFrame oldest, newest;
+            bool buffered = ring.head() > ring.tail() &&
+                            ring.read_frame(ring.tail(), oldest) && ring.read_frame(ring.head() - 1, newest);
+            g_print("%s: %s (%" G_GUINT64_FORMAT " frames, %" G_GUINT64_FORMAT
+                   " metadata packets buffered, timecode %s .. %s)\n",
+                   camera->id.c_str(), camera->rtsp_url.c_str(), ring.head() - ring.tail(),
+                   camera->metadata_ring->head() - camera->metadata_ring->tail(),
+                   format_timecode(buffered ? oldest.timecode : NO_TIMECODE).c_str(),
+                   format_timecode(buffered ? newest.timecode : NO_TIMECODE).c_str());
+        }
+    } else if (command == "metrics") {
+        g_print("%s", metrics.render().c_str());
+    } else if (command == "help") {
+        print_control_help();
     } else {
-        pipeline_str = "( filesrc location=/tmp/replay-buffer.h264 ! "
-                      "h264parse ! avdec_h264 ! x264enc bitrate=4000 tune=zerolatency ! "
-                      "h264parse ! rtph264pay name=pay0 pt=96 config-interval=1 )";
+        g_printerr("Unknown command '%s' (try 'help')\n", command.c_str());
     }
-    
-    gst_rtsp_media_factory_set_launch(factory, pipeline_str.c_str());
-    
-    // Configure factory for sharing and seeking
-    gst_rtsp_media_factory_set_shared(factory, TRUE);
-    gst_rtsp_media_factory_set_enable_rtcp(factory, TRUE);
-    gst_rtsp_media_factory_set_protocols(factory, GST_RTSP_LOWER_TRANS_TCP);
-    
-    // Connect media configure signal
-    g_signal_connect(factory, "media-configure", 
-                    G_CALLBACK(media_configure_callback), NULL);
-    
-    // Add factory to mount point
-    gst_rtsp_mount_points_add_factory(mounts, config.output_mount_point.c_str(), factory);
-    g_print("✓ RTSP server mounted at rtsp://localhost:%d%s\n", 
-           config.output_rtsp_port, config.output_mount_point.c_str());
-    
-    g_object_unref(mounts);
-    
-    return server;
+}
+
+static gboolean dispatch_control_command(gpointer data) {
+    std::string *line = static_cast<std::string *>(data);
+    handle_control_command(*line);
+    delete line;
+    return G_SOURCE_REMOVE;
+}
+
+// Blocking stdin reads stay off the main loop; each line is handed over
+// with an idle source so commands run on the main loop
+static void start_control_channel(const ReplayConfig &config) {
+    control_config = &config;
+    std::thread reader([] {
+        std::string line;
+        while (!shutdown_requested && std::getline(std::cin, line)) {
+            g_idle_add(dispatch_control_command, new std::string(line));
+        }
+    });
+    reader.detach();
 }
 
 // Parse command line arguments
@@ -362,11 +8247,32 @@ bool parse_arguments(int argc, char *argv[], ReplayConfig &config) {
         std::string arg = argv[i];
         
         if ((arg == "-i" || arg == "--input") && i + 1 < argc) {
-            config.input_rtsp_url = argv[++i];
+            // Either a plain URL or <id>=<url>
+            std::string value = argv[++i];
+            CameraConfig camera;
+            size_t scheme = value.find("://");
+            size_t equals = value.find('=');
+            if (equals != std::string::npos && equals < scheme) {
+                camera.id = value.substr(0, equals);
+                camera.rtsp_url = value.substr(equals + 1);
+            } else {
+                camera.id = "cam" + std::to_string(config.cameras.size());
+                camera.rtsp_url = value;
+            }
+            config.cameras.push_back(camera);
         }
         else if ((arg == "-b" || arg == "--buffer") && i + 1 < argc) {
             config.buffer_seconds = std::stoi(argv[++i]);
         }
+        else if (arg == "--ring-mb" && i + 1 < argc) {
+            config.ring_megabytes = std::stoi(argv[++i]);
+        }
+        else if (arg == "--export-workers" && i + 1 < argc) {
+            config.export_workers = std::stoi(argv[++i]);
+        }
+        else if (arg == "--export-dir" && i + 1 < argc) {
+            config.export_directory = argv[++i];
+        }
         else if ((arg == "-p" || arg == "--port") && i + 1 < argc) {
             config.output_rtsp_port = std::stoi(argv[++i]);
         }
@@ -379,19 +8285,126 @@ bool parse_arguments(int argc, char *argv[], ReplayConfig &config) {
         else if ((arg == "-m" || arg == "--mount") && i + 1 < argc) {
             config.output_mount_point = argv[++i];
         }
+        else if (arg == "--replay-camera" && i + 1 < argc) {
+            config.replay_camera = argv[++i];
+        }
+        else if (arg == "--reel-mount" && i + 1 < argc) {
+            config.reel_mount_point = argv[++i];
+        }
+        else if (arg == "--loop-mount" && i + 1 < argc) {
+            config.loop_mount_point = argv[++i];
+        }
+        else if (arg == "--reverse-mount" && i + 1 < argc) {
+            config.reverse_mount_point = argv[++i];
+        }
+        else if (arg == "--scrub-mount" && i + 1 < argc) {
+            config.scrub_mount_point = argv[++i];
+        }
+        else if (arg == "--scrub-cache-mb" && i + 1 < argc) {
+            config.scrub_cache_megabytes = std::stoi(argv[++i]);
+        }
+        else if (arg == "--timecode-rate" && i + 1 < argc) {
+            config.timecode_rate = std::stoi(argv[++i]);
+        }
+        else if (arg == "--stall-tolerance" && i + 1 < argc) {
+            config.stall_tolerance = std::stod(argv[++i]);
+        }
+        else if (arg == "--client-queue-kb" && i + 1 < argc) {
+            config.client_queue_kb = std::stoi(argv[++i]);
+        }
+        else if (arg == "--client-queue-ms" && i + 1 < argc) {
+            config.client_queue_ms = std::stoi(argv[++i]);
+        }
+        else if (arg == "--max-cpu" && i + 1 < argc) {
+            config.max_cpu_percent = std::stod(argv[++i]);
+        }
+        else if (arg == "--max-egress-mbps" && i + 1 < argc) {
+            config.max_egress_mbps = std::stod(argv[++i]);
+        }
+        else if (arg == "--server-loops" && i + 1 < argc) {
+            config.server_loops = std::stoi(argv[++i]);
+        }
+        else if (arg == "--config" && i + 1 < argc) {
+            config.config_file = argv[++i];
+        }
+        else if (arg == "--handoff-socket" && i + 1 < argc) {
+            config.handoff_socket = argv[++i];
+        }
+        else if (arg == "--take-over" && i + 1 < argc) {
+            config.take_over_socket = argv[++i];
+        }
+        else if (arg == "--ladder" && i + 1 < argc) {
+            if (!parse_ladder(argv[++i], config.ladder)) {
+                g_printerr("Invalid ladder (expected <kbps>:<height>,...): %s\n", argv[i]);
+                return false;
+            }
+        }
+        else if (arg == "--ramp-render" && i + 1 < argc) {
+            if (!parse_ramp_render(argv[++i], config.ramp_render)) {
+                g_printerr("Unknown ramp render mode: %s\n", argv[i]);
+                return false;
+            }
+        }
+        else if (arg == "--benchmark-interpolation") {
+            config.benchmark_interpolation = true;
+        }
+        else if (arg == "--benchmark-egress") {
+            config.benchmark_egress = true;
+        }
+        else if (arg == "--simulate-drift") {
+            config.simulate_drift = true;
+        }
         else if (arg == "-h" || arg == "--help") {
             std::cout << "GStreamer Instant Replay Software v1.0.0\n\n";
             std::cout << "Usage: " << argv[0] << " [OPTIONS]\n\n";
             std::cout << "Options:\n";
-            std::cout << "  -i, --input <url>      Input RTSP URL (required)\n";
+            std::cout << "  -i, --input [id=]<url> Input RTSP URL (required, repeat for more cameras)\n";
+            std::cout << "  --config <path>        Options and cameras from a key file, reapplied\n";
+            std::cout << "                         when it changes\n";
             std::cout << "  -b, --buffer <sec>     Buffer duration in seconds (default: 60)\n";
+            std::cout << "  --ring-mb <mb>         Frame ring size per camera in MB (default: 256)\n";
             std::cout << "  -p, --port <port>      Output RTSP server port (default: 8554)\n";
             std::cout << "  -m, --mount <path>     RTSP mount point (default: /replay)\n";
+            std::cout << "  --replay-camera <id>   Camera the RTSP mount serves (default: the first)\n";
+            std::cout << "  --reel-mount <path>    Highlight reel mount point (default: /highlights)\n";
+            std::cout << "  --loop-mount <path>    Loop mount point (default: /loop)\n";
+            std::cout << "  --reverse-mount <path> Reverse playback mount point (default: /reverse)\n";
+            std::cout << "  --scrub-mount <path>   Jog/shuttle mount point (default: /scrub)\n";
+            std::cout << "  --scrub-cache-mb <n>   Decoded frame cache for scrubbing (default: 1024)\n";
+            std::cout << "  --timecode-rate <fps>  Frame rate of wall-clock timecode for cameras\n";
+            std::cout << "                         without timecode SEI (default: 25)\n";
+            std::cout << "  --stall-tolerance <n>  Frame intervals without data before a camera's\n";
+            std::cout << "                         source is rebuilt; 0 disables (default: 10)\n";
+            std::cout << "  --client-queue-kb <n>  Per-client TCP send queue before it drops to\n";
+            std::cout << "                         the next keyframe (default: 4096)\n";
+            std::cout << "  --client-queue-ms <n>  RTP time a client may fall behind; 0 disables\n";
+            std::cout << "                         (default: 2000)\n";
+            std::cout << "  --max-cpu <percent>    Refuse sessions that would take the process past\n";
+            std::cout << "                         this share of all cores; 0 disables (default: 0)\n";
+            std::cout << "  --max-egress-mbps <n>  Refuse sessions that would send more than this;\n";
+            std::cout << "                         0 disables (default: 0)\n";
+            std::cout << "  --server-loops <n>     RTSP server loops sharing the port through\n";
+            std::cout << "                         SO_REUSEPORT (default: 1)\n";
+            std::cout << "  --handoff-socket <path> Keep rings in shared memory and offer them and the\n";
+            std::cout << "                         RTSP listeners to an upgraded binary at <path>\n";
+            std::cout << "  --take-over <path>     Start as the upgrade of the process serving\n";
+            std::cout << "                         --handoff-socket <path>, which then drains and exits\n";
+            std::cout << "  --ladder <rungs>       Lower /replay rungs as <kbps>:<height>,...; clients\n";
+            std::cout << "                         switch between them with their link\n";
+            std::cout << "  --ramp-render <mode>   Speed ramps on mounts: retime, repeat, blend\n";
+            std::cout << "                         or interpolate (default: retime)\n";
             std::cout << "  --no-hw                Disable hardware acceleration\n";
             std::cout << "  --gpu <id>             GPU device ID for NVIDIA (default: 0)\n";
+            std::cout << "  --benchmark-interpolation\n";
+            std::cout << "                         Measure slow-motion interpolation speed and exit\n";
+            std::cout << "  --benchmark-egress     Measure interleaved TCP send cost per viewer and exit\n";
+            std::cout << "  --simulate-drift       Check the clock drift estimator on simulated cameras and exit\n";
+            std::cout << "  --export-workers <n>   Concurrent clip exports (default: half the cores)\n";
+            std::cout << "  --export-dir <path>    Directory for exported clips (default: temp dir)\n";
             std::cout << "  -h, --help             Show this help message\n\n";
             std::cout << "Example:\n";
             std::cout << "  " << argv[0] << " -i rtsp://camera:554/stream -b 60 -p 8554\n";
+            std::cout << "  " << argv[0] << " -i left=rtsp://cam1/stream -i right=rtsp://cam2/stream\n";
             return false;
         }
         else {
@@ -400,18 +8413,320 @@ bool parse_arguments(int argc, char *argv[], ReplayConfig &config) {
         }
     }
     
-    if (config.input_rtsp_url.empty()) {
+    if (config.benchmark_interpolation || config.benchmark_egress || config.simulate_drift) {
+        return true;
+    }
+    
+    if (config.cameras.empty()) {
         g_printerr("Error: Input RTSP URL is required (use -i or --input)\n");
         return false;
     }
     
+    for (size_t i = 0; i < config.cameras.size(); i++) {
+        for (size_t j = 0; j < i; j++) {
+            if (config.cameras[i].id == config.cameras[j].id) {
+                g_printerr("Error: Duplicate camera id '%s'\n", config.cameras[i].id.c_str());
+                return false;
+            }
+        }
+    }
+    
+    if (config.replay_camera.empty()) {
+        config.replay_camera = config.cameras[0].id;
+    } else if (std::none_of(config.cameras.begin(), config.cameras.end(),
+                            [&](const CameraConfig &c) { return c.id == config.replay_camera; })) {
+        g_printerr("Error: --replay-camera '%s' is not one of the cameras\n", config.replay_camera.c_str());
+        return false;
+    }
+    
+    if (config.ring_megabytes <= 0) {
+        g_printerr("Error: --ring-mb must be positive\n");
+        return false;
+    }
+    
+    if (config.scrub_cache_megabytes <= 0) {
+        g_printerr("Error: --scrub-cache-mb must be positive\n");
+        return false;
+    }
+    
+    if (config.stall_tolerance < 0) {
+        g_printerr("Error: --stall-tolerance must not be negative\n");
+        return false;
+    }
+    
+    if (config.client_queue_kb <= 0) {
+        g_printerr("Error: --client-queue-kb must be positive\n");
+        return false;
+    }
+    
+    if (config.client_queue_ms < 0) {
+        g_printerr("Error: --client-queue-ms must not be negative\n");
+        return false;
+    }
+    
+    if (config.max_cpu_percent < 0 || config.max_cpu_percent > 100) {
+        g_printerr("Error: --max-cpu must be between 0 and 100\n");
+        return false;
+    }
+    
+    if (config.server_loops <= 0 || config.server_loops > 64) {
+        g_printerr("Error: --server-loops must be between 1 and 64\n");
+        return false;
+    }
+    
+    if (!config.take_over_socket.empty()) {
+        if (!config.handoff_socket.empty() && config.handoff_socket != config.take_over_socket) {
+            g_printerr("Error: --take-over and --handoff-socket must name the same socket\n");
+            return false;
+        }
+        config.handoff_socket = config.take_over_socket;
+    }
+    
+#ifndef __linux__
+    if (!config.handoff_socket.empty()) {
+        g_printerr("Error: --handoff-socket and --take-over need Linux\n");
+        return false;
+    }
+#endif
+    
+    if (config.max_egress_mbps < 0) {
+        g_printerr("Error: --max-egress-mbps must not be negative\n");
+        return false;
+    }
+    
+    guint previous_kbps = MOUNT_BITRATE_KBPS;
+    for (const LadderRung &rung : config.ladder) {
+        if (rung.bitrate_kbps >= previous_kbps) {
+            g_printerr("Error: --ladder rungs must be below %u kbps and in descending order\n", MOUNT_BITRATE_KBPS);
+            return false;
+        }
+        previous_kbps = rung.bitrate_kbps;
+    }
+    
+    if (config.timecode_rate <= 0 || config.timecode_rate > 255) {
+        g_printerr("Error: --timecode-rate must be between 1 and 255\n");
+        return false;
+    }
+    
+    if (config.export_workers <= 0) {
+        config.export_workers = std::max(1u, g_get_num_processors() / 2);
+    }
+    
+    return true;
+}
+
+// Configuration file
+//
+// --config <path> reads options from a key file. [replay] takes the long
+// options without their dashes, and each [camera <id>] group a url:
+//   [replay]
+//   buffer=120
+//   ladder=1500:540,600:360
+//   no-hw=true
+//   [camera left]
+//   url=rtsp://10.0.0.11/stream
+// The file's options come before the command line's, so the command line
+// wins. The file is checked every CONFIG_POLL_MS; when its content changes
+// it is parsed again together with the command line and, if valid,
+// applied: cameras are added, removed or re-pointed in place, the stall
+// tolerance and admission limits take effect at once, and buffer sizes
+// apply to cameras added afterwards. Anything else is reported as needing
+// a restart.
+static const guint CONFIG_POLL_MS = 1000;
+
+static std::string program_name;
+static std::vector<std::string> command_line;       // argv[1..]
+static std::string config_file_contents;            // as last loaded
+
+static std::string config_file_option() {
+    for (size_t i = 0; i + 1 < command_line.size(); i++) {
+        if (command_line[i] == "--config") {
+            return command_line[i + 1];
+        }
+    }
+    return std::string();
+}
+
+static bool read_config_file(const std::string &path, std::string &contents) {
+    gchar *text = nullptr;
+    gsize length = 0;
+    GError *error = nullptr;
+    if (!g_file_get_contents(path.c_str(), &text, &length, &error)) {
+        g_printerr("Cannot read config file %s: %s\n", path.c_str(), error->message);
+        g_clear_error(&error);
+        return false;
+    }
+    contents.assign(text, length);
+    g_free(text);
+    return true;
+}
+
+// The file's settings as command-line arguments
+static bool config_file_arguments(const std::string &contents, const std::string &path,
+                                  std::vector<std::string> &args) {
+    GKeyFile *file = g_key_file_new();
+    GError *error = nullptr;
+    if (!g_key_file_load_from_data(file, contents.c_str(), contents.size(), G_KEY_FILE_NONE, &error)) {
+        g_printerr("Cannot parse %s: %s\n", path.c_str(), error->message);
+        g_clear_error(&error);
+        g_key_file_free(file);
+        return false;
+    }
+    
+    bool valid = true;
+    gchar **groups = g_key_file_get_groups(file, NULL);
+    for (gchar **group = groups; *group; group++) {
+        bool camera = g_str_has_prefix(*group, "camera ");
+        gchar **keys = g_key_file_get_keys(file, *group, NULL, NULL);
+        for (gchar **key = keys; keys && *key; key++) {
+            gchar *value = g_key_file_get_string(file, *group, *key, NULL);
+            if (!value) {
+                valid = false;
+            } else if (camera && strcmp(*key, "url") == 0) {
+                args.push_back("--input");
+                args.push_back(std::string(*group + strlen("camera ")) + "=" + value);
+            } else if (!camera && strcmp(*group, "replay") == 0 && strcmp(*key, "config") != 0) {
+                // Switches are key=true; key=false leaves them off
+                if (strcmp(value, "false") != 0) {
+                    args.push_back(std::string("--") + *key);
+                }
+                if (strcmp(value, "true") != 0 && strcmp(value, "false") != 0) {
+                    args.push_back(value);
+                }
+            } else {
+                g_printerr("%s: unknown setting %s in [%s]\n", path.c_str(), *key, *group);
+                valid = false;
+            }
+            g_free(value);
+        }
+        g_strfreev(keys);
+    }
+    g_strfreev(groups);
+    g_key_file_free(file);
+    return valid;
+}
+
+// Parse the config file (if any) and then the command line into `config`
+static bool load_configuration(const std::string &contents, const std::string &path, ReplayConfig &config) {
+    std::vector<std::string> args(1, program_name);
+    if (!path.empty() && !config_file_arguments(contents, path, args)) {
+        return false;
+    }
+    args.insert(args.end(), command_line.begin(), command_line.end());
+    std::vector<char *> argv;
+    for (std::string &arg : args) {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+    try {
+        return parse_arguments((int)args.size(), argv.data(), config);
+    } catch (const std::exception &) {
+        g_printerr("Invalid number in the options\n");
+        return false;
+    }
+}
+
+static bool same_ladder(const std::vector<LadderRung> &a, const std::vector<LadderRung> &b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].bitrate_kbps != b[i].bitrate_kbps || a[i].height != b[i].height) {
+            return false;
+        }
+    }
     return true;
 }
 
+static void apply_configuration(ReplayConfig &config, const ReplayConfig &next) {
+    g_print("Applying %s\n", config.config_file.c_str());
+    
+    if (next.buffer_seconds != config.buffer_seconds || next.ring_megabytes != config.ring_megabytes) {
+        g_print("  buffer %d s / %d MB applies to cameras added from now on\n",
+                next.buffer_seconds, next.ring_megabytes);
+        config.buffer_seconds = next.buffer_seconds;
+        config.ring_megabytes = next.ring_megabytes;
+    }
+    for (const auto &camera : list_cameras()) {
+        auto wanted = std::find_if(next.cameras.begin(), next.cameras.end(),
+                                   [&](const CameraConfig &c) { return c.id == camera->id; });
+        if (wanted == next.cameras.end()) {
+            remove_camera(camera->id);
+        } else if (wanted->rtsp_url != camera->rtsp_url) {
+            set_camera_url(camera, wanted->rtsp_url);
+        }
+    }
+    for (const CameraConfig &camera_config : next.cameras) {
+        if (!find_camera(camera_config.id) && !add_camera(camera_config, config)) {
+            g_printerr("  camera %s could not be added\n", camera_config.id.c_str());
+        }
+    }
+    config.cameras = next.cameras;
+    
+    config.stall_tolerance = next.stall_tolerance;
+    if (next.max_cpu_percent != config.max_cpu_percent || next.max_egress_mbps != config.max_egress_mbps) {
+        config.max_cpu_percent = next.max_cpu_percent;
+        config.max_egress_mbps = next.max_egress_mbps;
+        admission.configure(config.max_cpu_percent / 100.0 * g_get_num_processors(),
+                            config.max_egress_mbps * 1000.0);
+        g_print("  admission limits: %.0f%% CPU, %.0f Mbit/s\n", config.max_cpu_percent, config.max_egress_mbps);
+    }
+    
+    std::vector<std::string> restart;
+    if (next.output_rtsp_port != config.output_rtsp_port) restart.push_back("port");
+    if (next.output_mount_point != config.output_mount_point ||
+        next.reel_mount_point != config.reel_mount_point ||
+        next.loop_mount_point != config.loop_mount_point ||
+        next.reverse_mount_point != config.reverse_mount_point ||
+        next.scrub_mount_point != config.scrub_mount_point) restart.push_back("mounts");
+    if (next.replay_camera != config.replay_camera) restart.push_back("replay-camera");
+    if (!same_ladder(next.ladder, config.ladder)) restart.push_back("ladder");
+    if (next.client_queue_kb != config.client_queue_kb ||
+        next.client_queue_ms != config.client_queue_ms) restart.push_back("client queues");
+    if (next.server_loops != config.server_loops) restart.push_back("server-loops");
+    if (next.timecode_rate != config.timecode_rate) restart.push_back("timecode-rate");
+    if (next.scrub_cache_megabytes != config.scrub_cache_megabytes) restart.push_back("scrub-cache-mb");
+    if (next.ramp_render != config.ramp_render) restart.push_back("ramp-render");
+    if (next.use_hardware_accel != config.use_hardware_accel || next.gpu_id != config.gpu_id) restart.push_back("hardware");
+    if (next.export_workers != config.export_workers ||
+        next.export_directory != config.export_directory) restart.push_back("exports");
+    if (next.handoff_socket != config.handoff_socket) restart.push_back("handoff-socket");
+    if (!restart.empty()) {
+        std::string names;
+        for (const std::string &name : restart) {
+            names += (names.empty() ? "" : ", ") + name;
+        }
+        g_printerr("  restart needed to change: %s\n", names.c_str());
+    }
+}
+
+static gboolean config_reload_tick(gpointer user_data) {
+    ReplayConfig *config = static_cast<ReplayConfig *>(user_data);
+    gchar *text = nullptr;
+    gsize length = 0;
+    if (ingest_released || !g_file_get_contents(config->config_file.c_str(), &text, &length, NULL)) {
+        return G_SOURCE_CONTINUE; // draining, or the file is being replaced
+    }
+    std::string contents(text, length);
+    g_free(text);
+    if (contents == config_file_contents) {
+        return G_SOURCE_CONTINUE;
+    }
+    config_file_contents = contents;
+    
+    ReplayConfig next;
+    if (!load_configuration(contents, config->config_file, next)) {
+        g_printerr("%s not applied; keeping the running configuration\n", config->config_file.c_str());
+        return G_SOURCE_CONTINUE;
+    }
+    apply_configuration(*config, next);
+    return G_SOURCE_CONTINUE;
+}
+
 // Check required plugins
 bool check_required_plugins() {
     const char* required_plugins[] = {
-        "rtsp", "rtp", "rtpmanager", "coreelements", 
+        "rtsp", "rtp", "rtpmanager", "coreelements", "app",
         "playback", "videoparsersbad", "libav", NULL
     };
     
@@ -440,10 +8755,25 @@ int main(int argc, char *argv[]) {
     g_print("Initializing GStreamer 1.28.0...\n");
     gst_init(&argc, &argv);
     
-    // Parse arguments
-    if (!parse_arguments(argc, argv, config)) {
+    // Parse arguments, after the config file's if there is one
+    program_name = argv[0];
+    command_line.assign(argv + 1, argv + argc);
+    std::string config_path = config_file_option();
+    if (!config_path.empty() && !read_config_file(config_path, config_file_contents)) {
+        return 1;
+    }
+    if (!load_configuration(config_file_contents, config_path, config)) {
         return 1;
     }
+    if (config.benchmark_interpolation) {
+        return run_interpolation_benchmark();
+    }
+    if (config.benchmark_egress) {
+        return run_egress_benchmark();
+    }
+    if (config.simulate_drift) {
+        return run_drift_simulation();
+    }
     
     // Check plugins
     if (!check_required_plugins()) {
@@ -459,20 +8789,42 @@ int main(int argc, char *argv[]) {
     } else {
         g_print("Hardware acceleration disabled by user\n");
     }
+    replay_hw_type = hw_type;
     
     // Print configuration
     g_print("\n=== Configuration ===\n");
-    g_print("Input RTSP: %s\n", config.input_rtsp_url.c_str());
-    g_print("Buffer Size: %d seconds\n", config.buffer_seconds);
+    for (const CameraConfig &camera : config.cameras) {
+        g_print("Input RTSP [%s]: %s\n", camera.id.c_str(), camera.rtsp_url.c_str());
+    }
+    g_print("Buffer Size: %d seconds (%d MB ring per camera)\n",
+           config.buffer_seconds, config.ring_megabytes);
     g_print("Output Port: %d\n", config.output_rtsp_port);
     g_print("Mount Point: %s\n", config.output_mount_point.c_str());
     g_print("HW Accel: %s\n", hw_type != HW_ACCEL_NONE ? "Enabled" : "Disabled");
+    g_print("Export Workers: %d (into %s)\n", config.export_workers, config.export_directory.c_str());
     g_print("====================\n\n");
     
     // Setup signal handlers
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
     
+    // An upgrade continues the running process's rings and listeners
+    if (!config.take_over_socket.empty() && !receive_handoff(config.take_over_socket)) {
+        return 1;
+    }
+    if (!config.take_over_socket.empty()) {
+        spill_suffix = "-" + std::to_string(getpid());
+    }
+    
+    // Create camera rings; the /replay camera keeps the historical spill file
+    replay_camera_id = config.replay_camera;
+    replay_spill_path = camera_spill_path(replay_camera_id);
+    for (const CameraConfig &camera_config : config.cameras) {
+        auto camera = std::make_shared<Camera>(camera_config, config);
+        camera->spill_path = camera_spill_path(camera->id);
+        cameras.push_back(camera);
+    }
+    
     // Create input pipeline
     pipeline = create_input_pipeline(config, hw_type);
     if (!pipeline) {
@@ -493,9 +8845,24 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
-    // Attach server to default context
-    guint server_id = gst_rtsp_server_attach(rtsp_server, NULL);
-    if (server_id == 0) {
+    // Offer the handoff before binding the port, so a second instance
+    // started without --take-over fails here rather than sharing it
+    if (!config.handoff_socket.empty() && config.take_over_socket.empty() &&
+        !start_handoff_listener(config.handoff_socket)) {
+        gst_object_unref(rtsp_server);
+        gst_object_unref(pipeline);
+        return 1;
+    }
+    
+    // Attach server to default context, or serve it from several loops
+    // (always with the handoff, whose listeners must be passable)
+    bool attached;
+    if (config.server_loops > 1 || !config.handoff_socket.empty()) {
+        attached = start_server_loops(rtsp_server, config, (guint)config.server_loops, inherited.listeners);
+    } else {
+        attached = gst_rtsp_server_attach(rtsp_server, NULL) != 0;
+    }
+    if (!attached) {
         g_printerr("Failed to attach RTSP server\n");
         gst_object_unref(rtsp_server);
         gst_object_unref(pipeline);
@@ -512,16 +8879,42 @@ int main(int argc, char *argv[]) {
         return 1;
     }
     
+    // The predecessor stops accepting and drains once it hears from us
+    if (!config.take_over_socket.empty()) {
+        complete_takeover(config.take_over_socket);
+    }
+    
     // Create and run main loop
     g_print("\n✓ System running. Press Ctrl+C to stop.\n");
     g_print("Access replay stream at: rtsp://localhost:%d%s\n\n", 
            config.output_rtsp_port, config.output_mount_point.c_str());
     
+    // Export workers and operator commands
+    export_queue = new ExportQueue(config.export_workers);
+    decoded_gop_cache = new DecodedGopCache((gsize)config.scrub_cache_megabytes * 1024 * 1024, 2);
+    export_queue->add_listener(print_export_progress);
+    start_control_channel(config);
+    g_print("Type 'help' for operator commands.\n\n");
+    
+    g_timeout_add(WATCHDOG_PERIOD_MS, watchdog_tick, &config);
+    if (!config.config_file.empty()) {
+        g_timeout_add(CONFIG_POLL_MS, config_reload_tick, &config);
+    }
+    
+    admission.configure(config.max_cpu_percent / 100.0 * g_get_num_processors(),
+                        config.max_egress_mbps * 1000.0);
+    g_timeout_add(ADMISSION_PERIOD_MS, admission_tick, NULL);
+    
     main_loop = g_main_loop_new(NULL, FALSE);
     g_main_loop_run(main_loop);
     
     // Cleanup
     g_print("\nCleaning up...\n");
+    delete export_queue;
+    export_queue = nullptr;
+    codec_pool.close();
+    stop_handoff_listener();
+    stop_server_loops();
     gst_element_set_state(pipeline, GST_STATE_NULL);
     gst_object_unref(pipeline);
     g_object_unref(rtsp_server);